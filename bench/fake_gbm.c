@@ -0,0 +1,260 @@
+/*
+ * @File           fake_gbm.c
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+ * Fake gbm_kms device and surface. See fake_gbm.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "fake_gbm.h"
+
+#define FAKE_GBM_NUM_BOS	2
+#define FAKE_GBM_PITCH_ALIGN	128
+
+#define FAKE_GBM_ALIGN(x, a)	(((x) + (a) - 1) & ~((a) - 1))
+
+struct fake_gbm_surface {
+	struct gbm_kms_surface		base;
+	struct gbm_kms_bo		bos[FAKE_GBM_NUM_BOS];
+
+	struct fake_gbm_schedule	schedule;
+	struct fake_gbm_stats		stats;
+
+	/* BO locked by the previous page flip, released at release_ns */
+	int				pending_release;
+	uint64_t			release_ns;
+
+	/* page flips requested by the client, and the last one followed by a v4l2 frame */
+	unsigned int			frame;
+	unsigned int			v4l2_frame;
+};
+
+static uint64_t fake_gbm_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct gbm_device *fake_gbm_device_create(void)
+{
+	struct gbm_device *gbm;
+
+	if (!(gbm = calloc(1, sizeof(*gbm))))
+		return NULL;
+
+	/* this is how the WSEGL tells a GBM device from a wl_display */
+	gbm->dummy = gbm_create_device;
+	gbm->name = "fake";
+	gbm->refcount = 1;
+
+	if ((gbm->fd = open("/dev/null", O_RDWR | O_CLOEXEC)) < 0) {
+		free(gbm);
+		return NULL;
+	}
+
+	return gbm;
+}
+
+void fake_gbm_device_destroy(struct gbm_device *gbm)
+{
+	close(gbm->fd);
+	free(gbm);
+}
+
+static int fake_gbm_bo_init(struct gbm_kms_bo *bo, struct gbm_device *gbm, int index,
+			    uint32_t width, uint32_t height, uint32_t format)
+{
+	bo->base.gbm = gbm;
+	bo->base.width = width;
+	bo->base.height = height;
+	bo->base.format = format;
+	bo->base.stride = FAKE_GBM_ALIGN(width * 4, FAKE_GBM_PITCH_ALIGN);
+	bo->size = bo->base.stride * height;
+
+	if ((bo->fd = memfd_create("fake_gbm_bo", MFD_CLOEXEC)) < 0)
+		return -1;
+
+	if (ftruncate(bo->fd, bo->size) < 0)
+		goto error;
+
+	bo->addr = mmap(NULL, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED, bo->fd, 0);
+	if (bo->addr == MAP_FAILED)
+		goto error;
+
+	*(uint32_t*)bo->addr = FAKE_GBM_STAMP | index;
+
+	return 0;
+
+error:
+	close(bo->fd);
+	bo->fd = -1;
+	bo->addr = NULL;
+	return -1;
+}
+
+static void fake_gbm_bo_fini(struct gbm_kms_bo *bo)
+{
+	if (bo->addr)
+		munmap(bo->addr, bo->size);
+	if (bo->fd >= 0)
+		close(bo->fd);
+}
+
+struct gbm_surface *fake_gbm_surface_create(struct gbm_device *gbm,
+					    uint32_t width, uint32_t height,
+					    uint32_t format,
+					    const struct fake_gbm_schedule *schedule)
+{
+	struct fake_gbm_surface *surface;
+	int i;
+
+	if (!(surface = calloc(1, sizeof(*surface))))
+		return NULL;
+
+	surface->base.base.gbm = gbm;
+	surface->base.base.width = width;
+	surface->base.base.height = height;
+	surface->base.base.format = format;
+	surface->base.base.flags = GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING;
+	surface->schedule = *schedule;
+	surface->pending_release = -1;
+
+	/*
+	 * Nothing is shown yet. The WSEGL starts rendering into BO 0, so
+	 * point the front at BO 1 not to make it skip BO 0 right away.
+	 */
+	surface->base.front = 1;
+
+	for (i = 0; i < FAKE_GBM_NUM_BOS; i++)
+		surface->bos[i].fd = -1;
+
+	for (i = 0; i < FAKE_GBM_NUM_BOS; i++) {
+		if (fake_gbm_bo_init(&surface->bos[i], gbm, i, width, height, format)) {
+			fake_gbm_surface_destroy(&surface->base.base);
+			return NULL;
+		}
+		surface->base.bo[i] = &surface->bos[i];
+	}
+
+	return &surface->base.base;
+}
+
+void fake_gbm_surface_destroy(struct gbm_surface *gbm_surface)
+{
+	struct fake_gbm_surface *surface = (struct fake_gbm_surface*)gbm_surface;
+	int i;
+
+	for (i = 0; i < FAKE_GBM_NUM_BOS; i++)
+		fake_gbm_bo_fini(&surface->bos[i]);
+
+	free(surface);
+}
+
+static void fake_gbm_surface_lock(struct fake_gbm_surface *surface, int front)
+{
+	uint64_t now = fake_gbm_now_ns();
+	int i;
+
+	/* a flip that is still pending is completed by the new one */
+	if (surface->pending_release >= 0 && surface->pending_release != front) {
+		surface->bos[surface->pending_release].locked = 0;
+		surface->stats.releases++;
+	}
+
+	surface->bos[front].locked = 1;
+	surface->stats.flips++;
+
+	/* everything but the new front is released when the flip completes */
+	surface->pending_release = -1;
+	for (i = 0; i < FAKE_GBM_NUM_BOS; i++) {
+		if (i != front && surface->bos[i].locked)
+			surface->pending_release = i;
+	}
+	surface->release_ns = now + (uint64_t)surface->schedule.flip_us * 1000;
+}
+
+void fake_gbm_surface_page_flip(struct gbm_surface *gbm_surface)
+{
+	struct fake_gbm_surface *surface = (struct fake_gbm_surface*)gbm_surface;
+
+	fake_gbm_surface_lock(surface, surface->base.front);
+	surface->frame++;
+
+	if (!surface->schedule.flip_us)
+		fake_gbm_surface_tick(gbm_surface);
+}
+
+void fake_gbm_surface_tick(struct gbm_surface *gbm_surface)
+{
+	struct fake_gbm_surface *surface = (struct fake_gbm_surface*)gbm_surface;
+
+	if (surface->pending_release >= 0 && fake_gbm_now_ns() >= surface->release_ns) {
+		surface->bos[surface->pending_release].locked = 0;
+		surface->pending_release = -1;
+		surface->stats.releases++;
+	}
+
+	/* the v4l2-renderer composes into the back BO and shows it */
+	if (surface->schedule.v4l2_every && surface->frame != surface->v4l2_frame &&
+	    surface->frame % surface->schedule.v4l2_every == 0) {
+		int back = surface->base.front ^ 1;
+
+		surface->v4l2_frame = surface->frame;
+		surface->stats.v4l2_frames++;
+		gbm_kms_set_front(&surface->base, back);
+		fake_gbm_surface_lock(surface, back);
+	}
+}
+
+int fake_gbm_bo_index(const void *addr)
+{
+	uint32_t stamp = *(const uint32_t*)addr;
+
+	if ((stamp & ~0xffU) != FAKE_GBM_STAMP)
+		return -1;
+	return stamp & 0xff;
+}
+
+bool fake_gbm_surface_is_locked(struct gbm_surface *gbm_surface, int index)
+{
+	struct fake_gbm_surface *surface = (struct fake_gbm_surface*)gbm_surface;
+
+	return surface->bos[index].locked;
+}
+
+void fake_gbm_surface_get_stats(struct gbm_surface *gbm_surface, struct fake_gbm_stats *stats)
+{
+	struct fake_gbm_surface *surface = (struct fake_gbm_surface*)gbm_surface;
+
+	*stats = surface->stats;
+}
@@ -0,0 +1,99 @@
+/*
+ * @File           fake_gbm.h
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __FAKE_GBM_H__
+#define __FAKE_GBM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "gbm_kmsint.h"
+
+/*
+ * Fake gbm_kms device and surface for benchmarking the server backend.
+ *
+ * The surface is a double buffered gbm_kms_surface as the server backend
+ * expects it, with memfd backed BOs that can be imported by the libsrv_um
+ * stand-in. The compositor side is emulated by a front buffer lock schedule:
+ *
+ *  - after each swap the compositor locks the new front BO for a page flip,
+ *    and releases the previously locked BO once the flip completed, i.e.
+ *    flip_us later;
+ *  - every v4l2_every-th frame the compositor composes into the back BO
+ *    itself and makes it the front BO, as the v4l2-renderer in weston does.
+ *
+ * The schedule is evaluated lazily in fake_gbm_surface_tick(), which the
+ * caller runs before each frame.
+ */
+
+#define FAKE_GBM_STAMP		0x6762ff00	/* first word of BO n is STAMP | n */
+
+struct fake_gbm_schedule {
+	unsigned int	flip_us;
+	unsigned int	v4l2_every;
+};
+
+struct fake_gbm_stats {
+	uint64_t	flips;
+	uint64_t	releases;
+	uint64_t	v4l2_frames;
+};
+
+/**
+ * Create a device that the WSEGL recognizes as a GBM device.
+ */
+extern struct gbm_device *fake_gbm_device_create(void);
+
+extern void fake_gbm_device_destroy(struct gbm_device *gbm);
+
+/**
+ * Create a double buffered surface with both BOs allocated.
+ */
+extern struct gbm_surface *fake_gbm_surface_create(struct gbm_device *gbm,
+						   uint32_t width, uint32_t height,
+						   uint32_t format,
+						   const struct fake_gbm_schedule *schedule);
+
+extern void fake_gbm_surface_destroy(struct gbm_surface *surface);
+
+/**
+ * Compositor side of a swap: lock the front BO for a page flip.
+ */
+extern void fake_gbm_surface_page_flip(struct gbm_surface *surface);
+
+/**
+ * Run the compositor events that are due, i.e. flip completions and
+ * v4l2-renderer frames.
+ */
+extern void fake_gbm_surface_tick(struct gbm_surface *surface);
+
+/**
+ * Index of a BO given a CPU mapping of it, or -1 if it is not stamped.
+ */
+extern int fake_gbm_bo_index(const void *addr);
+
+extern bool fake_gbm_surface_is_locked(struct gbm_surface *surface, int index);
+
+extern void fake_gbm_surface_get_stats(struct gbm_surface *surface, struct fake_gbm_stats *stats);
+
+#endif /* !__FAKE_GBM_H__ */
@@ -0,0 +1,1409 @@
+/*
+ * @File           headless_compositor.c
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include <drm_fourcc.h>
+
+#include "wayland-server.h"
+#include "wayland-client.h"
+#include "wayland-kms-server-protocol.h"
+#include "linux-dmabuf-unstable-v1-server-protocol.h"
+#include "linux-explicit-synchronization-unstable-v1-server-protocol.h"
+#include "presentation-time-server-protocol.h"
+
+#include "headless_compositor.h"
+
+#define HC_DEFAULT_REFRESH_US	16667
+#define HC_DMABUF_VERSION	3
+
+enum {
+	HC_OP_CONNECT,
+	HC_OP_VSYNC,
+	HC_OP_WAKE,
+	HC_OP_QUIT,
+};
+
+struct hc_op {
+	int	op;
+	int	fd;
+};
+
+struct headless_compositor {
+	struct headless_config	config;
+
+	struct wl_display	*display;
+	struct wl_event_loop	*loop;
+	pthread_t		thread;
+	int			running;
+
+	/* control pipe from the benchmark thread */
+	int			ctl[2];
+	int			vsync_fd;
+	int			release_fd;
+
+	struct wl_list		surfaces;
+	struct wl_list		releases;	/* hc_buffer.release_link */
+
+	uint64_t		virtual_ns;	/* virtual vsync clock */
+	uint64_t		msc;		/* vsyncs, for wp_presentation */
+	unsigned int		frame_count;
+	volatile int		hold;
+
+	pthread_mutex_t		stats_lock;
+	struct headless_stats	stats;
+};
+
+struct hc_buffer {
+	struct headless_compositor	*hc;
+	struct wl_resource		*resource;
+	int				fd;
+	int32_t				width;
+	int32_t				height;
+	uint32_t			stride;
+	uint32_t			format;
+	int				dmabuf;		/* created via zwp_linux_dmabuf_v1 */
+
+	/* zwp_linux_buffer_release_v1 of the commit it was attached in */
+	struct wl_resource		*release;
+
+	uint64_t			release_due_ns;
+	struct wl_list			release_link;
+};
+
+struct hc_surface {
+	struct headless_compositor	*hc;
+	struct wl_resource		*resource;
+	struct wl_list			link;
+
+	/* zwp_linux_surface_synchronization_v1, if any */
+	struct wl_resource		*sync;
+
+	/* pending state, applied on commit */
+	struct hc_buffer		*pending_buffer;
+	int				pending_attached;
+	int				pending_acquire_fence;
+	struct wl_resource		*pending_release;
+	struct wl_list			pending_frames;
+	struct wl_list			pending_feedback;
+
+	/* committed, waiting for the next vsync and the acquire fence */
+	struct hc_buffer		*queued;
+	uint64_t			queued_ns;
+	int				queued_acquire_fence;
+	struct wl_list			queued_frames;
+	struct wl_list			queued_feedback;
+
+	/* latched */
+	struct hc_buffer		*front;
+	struct wl_list			deferred_frames;
+};
+
+/* wl_callback of a frame, or wp_presentation_feedback */
+struct hc_frame {
+	struct wl_resource	*resource;
+	struct wl_list		link;
+};
+
+struct hc_params {
+	struct headless_compositor	*hc;
+	int				fd;
+	uint32_t			stride;
+	int				used;
+};
+
+static uint64_t hc_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#define HC_STATS_ADD(hc, field, n)				\
+	do {							\
+		pthread_mutex_lock(&(hc)->stats_lock);		\
+		(hc)->stats.field += (n);			\
+		pthread_mutex_unlock(&(hc)->stats_lock);	\
+	} while (0)
+
+/*
+ * buffer release
+ */
+
+static int hc_buffer_is_busy(struct headless_compositor *hc, struct hc_buffer *buffer)
+{
+	struct hc_surface *surface;
+
+	wl_list_for_each(surface, &hc->surfaces, link) {
+		if (surface->queued == buffer || surface->front == buffer)
+			return 1;
+	}
+	return 0;
+}
+
+static void hc_arm_release_timer(struct headless_compositor *hc)
+{
+	struct itimerspec its;
+	struct hc_buffer *buffer;
+	uint64_t due = 0;
+
+	wl_list_for_each(buffer, &hc->releases, release_link) {
+		if (!due || buffer->release_due_ns < due)
+			due = buffer->release_due_ns;
+	}
+
+	memset(&its, 0, sizeof(its));
+	if (due) {
+		its.it_value.tv_sec = due / 1000000000ULL;
+		its.it_value.tv_nsec = due % 1000000000ULL;
+	}
+	timerfd_settime(hc->release_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/*
+ * A release fence is a timerfd expiring once the (virtual) composition has
+ * finished reading the buffer, like a sync_file.
+ */
+static int hc_fence_create(unsigned int delay_us)
+{
+	struct itimerspec its;
+	int fd;
+
+	if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) < 0)
+		return -1;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = delay_us / 1000000;
+	its.it_value.tv_nsec = (delay_us % 1000000) * 1000;
+	if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void hc_buffer_send_release_event(struct headless_compositor *hc,
+					 struct hc_buffer *buffer, unsigned int delay_us)
+{
+	int fence = delay_us ? hc_fence_create(delay_us) : -1;
+
+	if (fence >= 0) {
+		zwp_linux_buffer_release_v1_send_fenced_release(buffer->release, fence);
+		close(fence);
+		HC_STATS_ADD(hc, fenced_releases, 1);
+	} else {
+		zwp_linux_buffer_release_v1_send_immediate_release(buffer->release);
+	}
+
+	/* both events are destructors */
+	wl_resource_destroy(buffer->release);
+}
+
+static void hc_flush_releases(struct headless_compositor *hc)
+{
+	struct hc_buffer *buffer, *tmp;
+	uint64_t now = hc_now_ns();
+
+	if (hc->hold)
+		return;
+
+	wl_list_for_each_safe(buffer, tmp, &hc->releases, release_link) {
+		if (buffer->release_due_ns > now)
+			continue;
+
+		wl_list_remove(&buffer->release_link);
+		wl_list_init(&buffer->release_link);
+		buffer->release_due_ns = 0;
+
+		/* the client may have attached it again meanwhile */
+		if (hc_buffer_is_busy(hc, buffer))
+			continue;
+
+		if (buffer->release)
+			hc_buffer_send_release_event(hc, buffer, 0);
+
+		wl_buffer_send_release(buffer->resource);
+		HC_STATS_ADD(hc, releases, 1);
+	}
+
+	hc_arm_release_timer(hc);
+}
+
+static void hc_schedule_release(struct headless_compositor *hc, struct hc_buffer *buffer)
+{
+	if (!buffer || buffer->release_due_ns || hc_buffer_is_busy(hc, buffer))
+		return;
+
+	buffer->release_due_ns = hc_now_ns() + (uint64_t)hc->config.release_delay_us * 1000;
+	wl_list_insert(hc->releases.prev, &buffer->release_link);
+
+	/*
+	 * As weston does, hand out the release fence right away, and send
+	 * wl_buffer.release as well once the buffer is actually idle.
+	 */
+	if (buffer->release && !hc->hold)
+		hc_buffer_send_release_event(hc, buffer, hc->config.release_delay_us);
+
+	if (!hc->config.release_delay_us)
+		hc_flush_releases(hc);
+	else
+		hc_arm_release_timer(hc);
+}
+
+static int hc_handle_release_timer(int fd, uint32_t mask, void *data)
+{
+	struct headless_compositor *hc = data;
+	uint64_t expirations;
+	(void)mask;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		return 0;
+
+	hc_flush_releases(hc);
+	return 0;
+}
+
+/*
+ * wl_buffer
+ */
+
+static void hc_buffer_destroy_request(struct wl_client *client, struct wl_resource *resource)
+{
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_buffer_interface hc_buffer_implementation = {
+	.destroy = hc_buffer_destroy_request,
+};
+
+static void hc_buffer_destroy(struct wl_resource *resource)
+{
+	struct hc_buffer *buffer = wl_resource_get_user_data(resource);
+	struct hc_surface *surface;
+
+	wl_list_for_each(surface, &buffer->hc->surfaces, link) {
+		if (surface->pending_buffer == buffer)
+			surface->pending_buffer = NULL;
+		if (surface->queued == buffer)
+			surface->queued = NULL;
+		if (surface->front == buffer)
+			surface->front = NULL;
+	}
+
+	wl_list_remove(&buffer->release_link);
+	if (buffer->release)
+		wl_resource_destroy(buffer->release);
+	if (buffer->fd >= 0)
+		close(buffer->fd);
+	free(buffer);
+}
+
+static struct hc_buffer *hc_buffer_create(struct headless_compositor *hc,
+					  struct wl_client *client, uint32_t id,
+					  int fd, int32_t width, int32_t height,
+					  uint32_t stride, uint32_t format)
+{
+	struct hc_buffer *buffer;
+
+	if (!(buffer = calloc(1, sizeof(*buffer))))
+		goto error;
+
+	if (!(buffer->resource = wl_resource_create(client, &wl_buffer_interface, 1, id))) {
+		free(buffer);
+		goto error;
+	}
+
+	buffer->hc = hc;
+	buffer->fd = fd;
+	buffer->width = width;
+	buffer->height = height;
+	buffer->stride = stride;
+	buffer->format = format;
+	wl_list_init(&buffer->release_link);
+
+	wl_resource_set_implementation(buffer->resource, &hc_buffer_implementation,
+				       buffer, hc_buffer_destroy);
+
+	HC_STATS_ADD(hc, buffers_created, 1);
+
+	return buffer;
+
+error:
+	close(fd);
+	wl_client_post_no_memory(client);
+	return NULL;
+}
+
+/*
+ * zwp_linux_buffer_release_v1, pending on a surface until the commit,
+ * then on the buffer attached in it
+ */
+
+static void hc_release_destroy(struct wl_resource *resource)
+{
+	struct hc_buffer *buffer = wl_resource_get_user_data(resource);
+
+	if (buffer && buffer->release == resource)
+		buffer->release = NULL;
+}
+
+static void hc_release_set_buffer(struct wl_resource *resource, struct hc_buffer *buffer)
+{
+	/* a buffer committed again before being released gets only the latest */
+	if (buffer->release)
+		hc_buffer_send_release_event(buffer->hc, buffer, 0);
+
+	buffer->release = resource;
+	wl_resource_set_user_data(resource, buffer);
+}
+
+/*
+ * wl_surface
+ */
+
+static void hc_frame_destroy(struct wl_resource *resource)
+{
+	struct hc_frame *frame = wl_resource_get_user_data(resource);
+
+	wl_list_remove(&frame->link);
+	free(frame);
+}
+
+static void hc_frames_destroy(struct wl_list *frames)
+{
+	struct hc_frame *frame, *tmp;
+
+	wl_list_for_each_safe(frame, tmp, frames, link)
+		wl_resource_destroy(frame->resource);
+}
+
+static void hc_frames_done(struct headless_compositor *hc, struct wl_list *frames)
+{
+	struct hc_frame *frame, *tmp;
+	uint32_t msecs = (uint32_t)(hc->virtual_ns / 1000000ULL);
+
+	wl_list_for_each_safe(frame, tmp, frames, link) {
+		wl_callback_send_done(frame->resource, msecs);
+		wl_resource_destroy(frame->resource);
+		HC_STATS_ADD(hc, frame_callbacks, 1);
+	}
+}
+
+static void hc_feedback_discard(struct headless_compositor *hc, struct wl_list *feedback)
+{
+	struct hc_frame *frame, *tmp;
+
+	wl_list_for_each_safe(frame, tmp, feedback, link) {
+		wp_presentation_feedback_send_discarded(frame->resource);
+		wl_resource_destroy(frame->resource);
+		HC_STATS_ADD(hc, feedback_discarded, 1);
+	}
+}
+
+static void hc_feedback_present(struct headless_compositor *hc, struct wl_list *feedback,
+				uint64_t now)
+{
+	struct hc_frame *frame, *tmp;
+	uint64_t sec = now / 1000000000ULL;
+	uint32_t refresh = hc->config.refresh_us * 1000;
+
+	wl_list_for_each_safe(frame, tmp, feedback, link) {
+		wp_presentation_feedback_send_presented(frame->resource,
+							(uint32_t)(sec >> 32), (uint32_t)sec,
+							(uint32_t)(now % 1000000000ULL), refresh,
+							(uint32_t)(hc->msc >> 32), (uint32_t)hc->msc,
+							WP_PRESENTATION_FEEDBACK_KIND_VSYNC);
+		wl_resource_destroy(frame->resource);
+		HC_STATS_ADD(hc, feedback_presented, 1);
+	}
+}
+
+static void hc_surface_destroy_request(struct wl_client *client, struct wl_resource *resource)
+{
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static void hc_surface_attach(struct wl_client *client, struct wl_resource *resource,
+			      struct wl_resource *buffer_resource, int32_t x, int32_t y)
+{
+	struct hc_surface *surface = wl_resource_get_user_data(resource);
+	(void)client;
+	(void)x;
+	(void)y;
+
+	surface->pending_buffer = buffer_resource ? wl_resource_get_user_data(buffer_resource) : NULL;
+	surface->pending_attached = 1;
+}
+
+static void hc_surface_damage(struct wl_client *client, struct wl_resource *resource,
+			      int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct hc_surface *surface = wl_resource_get_user_data(resource);
+	(void)client;
+	(void)x;
+	(void)y;
+	(void)width;
+	(void)height;
+
+	HC_STATS_ADD(surface->hc, damage_rects, 1);
+}
+
+static void hc_surface_frame(struct wl_client *client, struct wl_resource *resource,
+			     uint32_t callback)
+{
+	struct hc_surface *surface = wl_resource_get_user_data(resource);
+	struct hc_frame *frame;
+
+	if (!(frame = calloc(1, sizeof(*frame)))) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	if (!(frame->resource = wl_resource_create(client, &wl_callback_interface, 1, callback))) {
+		free(frame);
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_resource_set_implementation(frame->resource, NULL, frame, hc_frame_destroy);
+	wl_list_insert(surface->pending_frames.prev, &frame->link);
+}
+
+static void hc_surface_set_region(struct wl_client *client, struct wl_resource *resource,
+				  struct wl_resource *region)
+{
+	(void)client;
+	(void)resource;
+	(void)region;
+}
+
+static void hc_surface_commit(struct wl_client *client, struct wl_resource *resource)
+{
+	struct hc_surface *surface = wl_resource_get_user_data(resource);
+	struct headless_compositor *hc = surface->hc;
+	(void)client;
+
+	if (surface->pending_acquire_fence >= 0 || surface->pending_release) {
+		if (!surface->pending_attached || !surface->pending_buffer) {
+			wl_resource_post_error(surface->sync,
+					       ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_BUFFER,
+					       "acquire fence or release without a buffer");
+			return;
+		}
+		if (surface->pending_acquire_fence >= 0 && !surface->pending_buffer->dmabuf) {
+			wl_resource_post_error(surface->sync,
+					       ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_UNSUPPORTED_BUFFER,
+					       "acquire fence on a non dma-buf buffer");
+			return;
+		}
+	}
+
+	if (surface->pending_attached) {
+		struct hc_buffer *replaced = surface->queued;
+
+		surface->queued = surface->pending_buffer;
+		surface->queued_ns = hc_now_ns();
+		surface->pending_buffer = NULL;
+		surface->pending_attached = 0;
+
+		if (surface->queued_acquire_fence >= 0)
+			close(surface->queued_acquire_fence);
+		surface->queued_acquire_fence = surface->pending_acquire_fence;
+		surface->pending_acquire_fence = -1;
+
+		if (surface->pending_release) {
+			hc_release_set_buffer(surface->pending_release, surface->queued);
+			surface->pending_release = NULL;
+		}
+
+		if (replaced && replaced != surface->queued) {
+			HC_STATS_ADD(hc, replaced, 1);
+			hc_schedule_release(hc, replaced);
+		}
+
+		/* never shown */
+		if (replaced)
+			hc_feedback_discard(hc, &surface->queued_feedback);
+	}
+
+	wl_list_insert_list(surface->queued_frames.prev, &surface->pending_frames);
+	wl_list_init(&surface->pending_frames);
+	wl_list_insert_list(surface->queued_feedback.prev, &surface->pending_feedback);
+	wl_list_init(&surface->pending_feedback);
+
+	HC_STATS_ADD(hc, commits, 1);
+}
+
+static void hc_surface_set_int(struct wl_client *client, struct wl_resource *resource,
+			       int32_t value)
+{
+	(void)client;
+	(void)resource;
+	(void)value;
+}
+
+static const struct wl_surface_interface hc_surface_implementation = {
+	.destroy = hc_surface_destroy_request,
+	.attach = hc_surface_attach,
+	.damage = hc_surface_damage,
+	.frame = hc_surface_frame,
+	.set_opaque_region = hc_surface_set_region,
+	.set_input_region = hc_surface_set_region,
+	.commit = hc_surface_commit,
+	.set_buffer_transform = hc_surface_set_int,
+	.set_buffer_scale = hc_surface_set_int,
+	.damage_buffer = hc_surface_damage,
+};
+
+static void hc_surface_destroy(struct wl_resource *resource)
+{
+	struct hc_surface *surface = wl_resource_get_user_data(resource);
+	struct hc_buffer *queued = surface->queued, *front = surface->front;
+
+	hc_frames_destroy(&surface->pending_frames);
+	hc_frames_destroy(&surface->queued_frames);
+	hc_frames_destroy(&surface->deferred_frames);
+	hc_feedback_discard(surface->hc, &surface->pending_feedback);
+	hc_feedback_discard(surface->hc, &surface->queued_feedback);
+
+	if (surface->pending_acquire_fence >= 0)
+		close(surface->pending_acquire_fence);
+	if (surface->queued_acquire_fence >= 0)
+		close(surface->queued_acquire_fence);
+	if (surface->pending_release)
+		wl_resource_destroy(surface->pending_release);
+
+	/* the synchronization object becomes inert */
+	if (surface->sync)
+		wl_resource_set_user_data(surface->sync, NULL);
+
+	wl_list_remove(&surface->link);
+
+	/* the buffers are no longer used by us */
+	hc_schedule_release(surface->hc, queued);
+	if (front != queued)
+		hc_schedule_release(surface->hc, front);
+
+	free(surface);
+}
+
+/*
+ * vsync
+ */
+
+static int hc_fence_is_signalled(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	return poll(&pfd, 1, 0) > 0;
+}
+
+static void hc_repaint(struct headless_compositor *hc)
+{
+	struct hc_surface *surface;
+	uint64_t now = hc_now_ns();
+
+	hc->virtual_ns += (uint64_t)(hc->config.refresh_us ? hc->config.refresh_us : HC_DEFAULT_REFRESH_US) * 1000;
+	hc->msc++;
+	HC_STATS_ADD(hc, vsyncs, 1);
+
+	if (hc->hold)
+		return;
+
+	wl_list_for_each(surface, &hc->surfaces, link) {
+		/* frame callbacks held back on the previous vsync */
+		hc_frames_done(hc, &surface->deferred_frames);
+
+		/* the rendering is not complete yet; try again on the next vsync */
+		if (surface->queued && surface->queued_acquire_fence >= 0) {
+			if (!hc_fence_is_signalled(surface->queued_acquire_fence)) {
+				HC_STATS_ADD(hc, acquire_fence_waits, 1);
+				continue;
+			}
+			close(surface->queued_acquire_fence);
+			surface->queued_acquire_fence = -1;
+		}
+
+		if (surface->queued) {
+			struct hc_buffer *previous = surface->front;
+			uint64_t latency = now - surface->queued_ns;
+
+			surface->front = surface->queued;
+			surface->queued = NULL;
+
+			pthread_mutex_lock(&hc->stats_lock);
+			hc->stats.presented++;
+			hc->stats.present_latency_ns_total += latency;
+			if (latency > hc->stats.present_latency_ns_max)
+				hc->stats.present_latency_ns_max = latency;
+			pthread_mutex_unlock(&hc->stats_lock);
+
+			if (previous != surface->front)
+				hc_schedule_release(hc, previous);
+		}
+
+		/* the content of the commits, if any, is up now */
+		hc_feedback_present(hc, &surface->queued_feedback, now);
+
+		if (wl_list_empty(&surface->queued_frames))
+			continue;
+
+		if (hc->config.defer_frame_callback_every &&
+		    ++hc->frame_count % hc->config.defer_frame_callback_every == 0) {
+			wl_list_insert_list(surface->deferred_frames.prev, &surface->queued_frames);
+			wl_list_init(&surface->queued_frames);
+			HC_STATS_ADD(hc, frame_callbacks_deferred, 1);
+			continue;
+		}
+
+		hc_frames_done(hc, &surface->queued_frames);
+	}
+}
+
+static int hc_handle_vsync_timer(int fd, uint32_t mask, void *data)
+{
+	struct headless_compositor *hc = data;
+	uint64_t expirations;
+	(void)mask;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0)
+		return 0;
+
+	/* missed vsyncs are just counted */
+	if (expirations > 1) {
+		hc->virtual_ns += (expirations - 1) * hc->config.refresh_us * 1000ULL;
+		HC_STATS_ADD(hc, vsyncs, expirations - 1);
+	}
+
+	hc_repaint(hc);
+	return 0;
+}
+
+/*
+ * wl_compositor
+ */
+
+static void hc_compositor_create_surface(struct wl_client *client,
+					 struct wl_resource *resource, uint32_t id)
+{
+	struct headless_compositor *hc = wl_resource_get_user_data(resource);
+	struct hc_surface *surface;
+
+	if (!(surface = calloc(1, sizeof(*surface)))) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	surface->resource = wl_resource_create(client, &wl_surface_interface,
+					       wl_resource_get_version(resource), id);
+	if (!surface->resource) {
+		free(surface);
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	surface->hc = hc;
+	surface->pending_acquire_fence = surface->queued_acquire_fence = -1;
+	wl_list_init(&surface->pending_frames);
+	wl_list_init(&surface->queued_frames);
+	wl_list_init(&surface->deferred_frames);
+	wl_list_init(&surface->pending_feedback);
+	wl_list_init(&surface->queued_feedback);
+	wl_list_insert(&hc->surfaces, &surface->link);
+
+	wl_resource_set_implementation(surface->resource, &hc_surface_implementation,
+				       surface, hc_surface_destroy);
+}
+
+static void hc_region_destroy_request(struct wl_client *client, struct wl_resource *resource)
+{
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static void hc_region_op(struct wl_client *client, struct wl_resource *resource,
+			 int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	(void)client;
+	(void)resource;
+	(void)x;
+	(void)y;
+	(void)width;
+	(void)height;
+}
+
+static const struct wl_region_interface hc_region_implementation = {
+	.destroy = hc_region_destroy_request,
+	.add = hc_region_op,
+	.subtract = hc_region_op,
+};
+
+static void hc_compositor_create_region(struct wl_client *client,
+					struct wl_resource *resource, uint32_t id)
+{
+	struct wl_resource *region;
+
+	if (!(region = wl_resource_create(client, &wl_region_interface, 1, id))) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+	wl_resource_set_implementation(region, &hc_region_implementation, NULL, NULL);
+}
+
+static const struct wl_compositor_interface hc_compositor_implementation = {
+	.create_surface = hc_compositor_create_surface,
+	.create_region = hc_compositor_create_region,
+};
+
+static void hc_compositor_bind(struct wl_client *client, void *data,
+			       uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	if (!(resource = wl_resource_create(client, &wl_compositor_interface, version, id))) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &hc_compositor_implementation, data, NULL);
+}
+
+/*
+ * wl_kms
+ */
+
+static void hc_kms_authenticate(struct wl_client *client, struct wl_resource *resource,
+				uint32_t magic)
+{
+	(void)client;
+	(void)magic;
+
+	wl_kms_send_authenticated(resource);
+}
+
+static void hc_kms_create_buffer(struct wl_client *client, struct wl_resource *resource,
+				 uint32_t id, int32_t fd, int32_t width, int32_t height,
+				 uint32_t stride, uint32_t format, uint32_t handle)
+{
+	struct headless_compositor *hc = wl_resource_get_user_data(resource);
+	(void)handle;
+
+	hc_buffer_create(hc, client, id, fd, width, height, stride, format);
+}
+
+static void hc_kms_create_mp_buffer(struct wl_client *client, struct wl_resource *resource,
+				    uint32_t id, int32_t width, int32_t height, uint32_t format,
+				    int32_t fd0, uint32_t stride0, int32_t fd1, uint32_t stride1,
+				    int32_t fd2, uint32_t stride2)
+{
+	struct headless_compositor *hc = wl_resource_get_user_data(resource);
+	(void)stride1;
+	(void)stride2;
+
+	if (fd1 >= 0 && fd1 != fd0)
+		close(fd1);
+	if (fd2 >= 0 && fd2 != fd0)
+		close(fd2);
+
+	hc_buffer_create(hc, client, id, fd0, width, height, stride0, format);
+}
+
+static const struct wl_kms_interface hc_kms_implementation = {
+	.authenticate = hc_kms_authenticate,
+	.create_buffer = hc_kms_create_buffer,
+	.create_mp_buffer = hc_kms_create_mp_buffer,
+};
+
+static void hc_kms_bind(struct wl_client *client, void *data,
+			uint32_t version, uint32_t id)
+{
+	struct headless_compositor *hc = data;
+	struct wl_resource *resource;
+
+	if (!(resource = wl_resource_create(client, &wl_kms_interface, version, id))) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &hc_kms_implementation, hc, NULL);
+
+	wl_kms_send_device(resource, hc->config.kms_device);
+	wl_kms_send_format(resource, WL_KMS_FORMAT_ARGB8888);
+	wl_kms_send_format(resource, WL_KMS_FORMAT_XRGB8888);
+}
+
+/*
+ * zwp_linux_dmabuf_v1
+ */
+
+static void hc_params_destroy_request(struct wl_client *client, struct wl_resource *resource)
+{
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static void hc_params_add(struct wl_client *client, struct wl_resource *resource,
+			  int32_t fd, uint32_t plane_idx, uint32_t offset, uint32_t stride,
+			  uint32_t modifier_hi, uint32_t modifier_lo)
+{
+	struct hc_params *params = wl_resource_get_user_data(resource);
+	(void)client;
+	(void)offset;
+	(void)modifier_hi;
+	(void)modifier_lo;
+
+	/* we only deal with single plane RGB */
+	if (plane_idx != 0 || params->fd >= 0) {
+		close(fd);
+		return;
+	}
+
+	params->fd = fd;
+	params->stride = stride;
+}
+
+static struct hc_buffer *hc_params_create_buffer(struct wl_client *client,
+						 struct wl_resource *resource, uint32_t id,
+						 int32_t width, int32_t height, uint32_t format)
+{
+	struct hc_params *params = wl_resource_get_user_data(resource);
+	struct hc_buffer *buffer;
+
+	if (params->used) {
+		wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+				       "params was already used to create a wl_buffer");
+		return NULL;
+	}
+	params->used = 1;
+
+	if (params->fd < 0 ||
+	    (format != DRM_FORMAT_ARGB8888 && format != DRM_FORMAT_XRGB8888))
+		return NULL;
+
+	buffer = hc_buffer_create(params->hc, client, id, params->fd,
+				  width, height, params->stride, format);
+	params->fd = -1;
+	if (buffer)
+		buffer->dmabuf = 1;
+
+	return buffer;
+}
+
+static void hc_params_create(struct wl_client *client, struct wl_resource *resource,
+			     int32_t width, int32_t height, uint32_t format, uint32_t flags)
+{
+	struct hc_buffer *buffer;
+	(void)flags;
+
+	if ((buffer = hc_params_create_buffer(client, resource, 0, width, height, format)))
+		zwp_linux_buffer_params_v1_send_created(resource, buffer->resource);
+	else
+		zwp_linux_buffer_params_v1_send_failed(resource);
+}
+
+static void hc_params_create_immed(struct wl_client *client, struct wl_resource *resource,
+				   uint32_t buffer_id, int32_t width, int32_t height,
+				   uint32_t format, uint32_t flags)
+{
+	(void)flags;
+
+	if (!hc_params_create_buffer(client, resource, buffer_id, width, height, format))
+		wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_WL_BUFFER,
+				       "importing the dmabuf failed");
+}
+
+static const struct zwp_linux_buffer_params_v1_interface hc_params_implementation = {
+	.destroy = hc_params_destroy_request,
+	.add = hc_params_add,
+	.create = hc_params_create,
+	.create_immed = hc_params_create_immed,
+};
+
+static void hc_params_destroy(struct wl_resource *resource)
+{
+	struct hc_params *params = wl_resource_get_user_data(resource);
+
+	if (params->fd >= 0)
+		close(params->fd);
+	free(params);
+}
+
+static void hc_dmabuf_destroy_request(struct wl_client *client, struct wl_resource *resource)
+{
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static void hc_dmabuf_create_params(struct wl_client *client, struct wl_resource *resource,
+				    uint32_t id)
+{
+	struct hc_params *params;
+	struct wl_resource *params_resource;
+
+	if (!(params = calloc(1, sizeof(*params)))) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	params_resource = wl_resource_create(client, &zwp_linux_buffer_params_v1_interface,
+					     wl_resource_get_version(resource), id);
+	if (!params_resource) {
+		free(params);
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	params->hc = wl_resource_get_user_data(resource);
+	params->fd = -1;
+
+	wl_resource_set_implementation(params_resource, &hc_params_implementation,
+				       params, hc_params_destroy);
+}
+
+static const struct zwp_linux_dmabuf_v1_interface hc_dmabuf_implementation = {
+	.destroy = hc_dmabuf_destroy_request,
+	.create_params = hc_dmabuf_create_params,
+};
+
+static void hc_dmabuf_bind(struct wl_client *client, void *data,
+			   uint32_t version, uint32_t id)
+{
+	static const uint32_t formats[] = { DRM_FORMAT_ARGB8888, DRM_FORMAT_XRGB8888 };
+	struct wl_resource *resource;
+	unsigned int i;
+
+	if (!(resource = wl_resource_create(client, &zwp_linux_dmabuf_v1_interface, version, id))) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &hc_dmabuf_implementation, data, NULL);
+
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+		zwp_linux_dmabuf_v1_send_format(resource, formats[i]);
+		if (version >= ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION)
+			zwp_linux_dmabuf_v1_send_modifier(resource, formats[i],
+							  DRM_FORMAT_MOD_LINEAR >> 32,
+							  DRM_FORMAT_MOD_LINEAR & 0xffffffff);
+	}
+}
+
+/*
+ * zwp_linux_explicit_synchronization_v1
+ */
+
+static void hc_sync_destroy_request(struct wl_client *client, struct wl_resource *resource)
+{
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static void hc_sync_set_acquire_fence(struct wl_client *client, struct wl_resource *resource,
+				      int32_t fd)
+{
+	struct hc_surface *surface = wl_resource_get_user_data(resource);
+	(void)client;
+
+	if (!surface) {
+		close(fd);
+		wl_resource_post_error(resource, ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_SURFACE,
+				       "the surface was destroyed");
+		return;
+	}
+
+	if (surface->pending_acquire_fence >= 0) {
+		close(fd);
+		wl_resource_post_error(resource, ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_DUPLICATE_FENCE,
+				       "an acquire fence was already set");
+		return;
+	}
+
+	surface->pending_acquire_fence = fd;
+	HC_STATS_ADD(surface->hc, acquire_fences, 1);
+}
+
+static void hc_sync_get_release(struct wl_client *client, struct wl_resource *resource,
+				uint32_t id)
+{
+	struct hc_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!surface) {
+		wl_resource_post_error(resource, ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_NO_SURFACE,
+				       "the surface was destroyed");
+		return;
+	}
+
+	if (surface->pending_release) {
+		wl_resource_post_error(resource, ZWP_LINUX_SURFACE_SYNCHRONIZATION_V1_ERROR_DUPLICATE_RELEASE,
+				       "a release was already requested");
+		return;
+	}
+
+	surface->pending_release = wl_resource_create(client, &zwp_linux_buffer_release_v1_interface,
+						      wl_resource_get_version(resource), id);
+	if (!surface->pending_release) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_resource_set_implementation(surface->pending_release, NULL, NULL, hc_release_destroy);
+}
+
+static const struct zwp_linux_surface_synchronization_v1_interface hc_sync_implementation = {
+	.destroy = hc_sync_destroy_request,
+	.set_acquire_fence = hc_sync_set_acquire_fence,
+	.get_release = hc_sync_get_release,
+};
+
+static void hc_sync_destroy(struct wl_resource *resource)
+{
+	struct hc_surface *surface = wl_resource_get_user_data(resource);
+
+	if (!surface)
+		return;
+
+	if (surface->pending_acquire_fence >= 0) {
+		close(surface->pending_acquire_fence);
+		surface->pending_acquire_fence = -1;
+	}
+	surface->sync = NULL;
+}
+
+static void hc_explicit_sync_destroy_request(struct wl_client *client, struct wl_resource *resource)
+{
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static void hc_explicit_sync_get_synchronization(struct wl_client *client,
+						 struct wl_resource *resource,
+						 uint32_t id, struct wl_resource *surface_resource)
+{
+	struct hc_surface *surface = wl_resource_get_user_data(surface_resource);
+
+	if (surface->sync) {
+		wl_resource_post_error(resource,
+				       ZWP_LINUX_EXPLICIT_SYNCHRONIZATION_V1_ERROR_SYNCHRONIZATION_EXISTS,
+				       "the surface already has a synchronization object");
+		return;
+	}
+
+	surface->sync = wl_resource_create(client, &zwp_linux_surface_synchronization_v1_interface,
+					   wl_resource_get_version(resource), id);
+	if (!surface->sync) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_resource_set_implementation(surface->sync, &hc_sync_implementation,
+				       surface, hc_sync_destroy);
+}
+
+static const struct zwp_linux_explicit_synchronization_v1_interface hc_explicit_sync_implementation = {
+	.destroy = hc_explicit_sync_destroy_request,
+	.get_synchronization = hc_explicit_sync_get_synchronization,
+};
+
+static void hc_explicit_sync_bind(struct wl_client *client, void *data,
+				  uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &zwp_linux_explicit_synchronization_v1_interface,
+				      version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &hc_explicit_sync_implementation, data, NULL);
+}
+
+/*
+ * wp_presentation
+ */
+
+static void hc_presentation_destroy_request(struct wl_client *client, struct wl_resource *resource)
+{
+	(void)client;
+	wl_resource_destroy(resource);
+}
+
+static void hc_presentation_feedback(struct wl_client *client, struct wl_resource *resource,
+				     struct wl_resource *surface_resource, uint32_t id)
+{
+	struct hc_surface *surface = wl_resource_get_user_data(surface_resource);
+	struct hc_frame *frame;
+
+	if (!(frame = calloc(1, sizeof(*frame)))) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	if (!(frame->resource = wl_resource_create(client, &wp_presentation_feedback_interface,
+						   1, id))) {
+		free(frame);
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_resource_set_implementation(frame->resource, NULL, frame, hc_frame_destroy);
+	wl_list_insert(surface->pending_feedback.prev, &frame->link);
+}
+
+static const struct wp_presentation_interface hc_presentation_implementation = {
+	.destroy = hc_presentation_destroy_request,
+	.feedback = hc_presentation_feedback,
+};
+
+static void hc_presentation_bind(struct wl_client *client, void *data,
+				 uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wp_presentation_interface, version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+	wl_resource_set_implementation(resource, &hc_presentation_implementation, data, NULL);
+
+	/* the vsync timer runs on it */
+	wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+/*
+ * compositor thread
+ */
+
+static int hc_handle_ctl(int fd, uint32_t mask, void *data)
+{
+	struct headless_compositor *hc = data;
+	struct hc_op op;
+	(void)mask;
+
+	if (read(fd, &op, sizeof(op)) != sizeof(op))
+		return 0;
+
+	switch (op.op) {
+	case HC_OP_CONNECT:
+		if (!wl_client_create(hc->display, op.fd))
+			close(op.fd);
+		break;
+	case HC_OP_VSYNC:
+		hc_repaint(hc);
+		break;
+	case HC_OP_WAKE:
+		hc_flush_releases(hc);
+		break;
+	case HC_OP_QUIT:
+		hc->running = 0;
+		break;
+	}
+
+	return 0;
+}
+
+static void *hc_thread(void *data)
+{
+	struct headless_compositor *hc = data;
+
+	while (hc->running) {
+		wl_display_flush_clients(hc->display);
+		if (wl_event_loop_dispatch(hc->loop, -1) < 0 && errno != EINTR)
+			break;
+	}
+
+	return NULL;
+}
+
+static void hc_send_op(struct headless_compositor *hc, int opcode, int fd)
+{
+	struct hc_op op = { .op = opcode, .fd = fd };
+
+	if (write(hc->ctl[1], &op, sizeof(op)) != sizeof(op))
+		fprintf(stderr, "headless: %s: %s\n", __func__, strerror(errno));
+}
+
+void headless_compositor_default_config(struct headless_config *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->refresh_us = HC_DEFAULT_REFRESH_US;
+	config->enable_wl_kms = true;
+	config->enable_dmabuf = true;
+	config->enable_explicit_sync = true;
+	config->enable_presentation = true;
+	config->kms_device = "/dev/null";
+}
+
+struct headless_compositor *headless_compositor_create(const struct headless_config *config)
+{
+	struct headless_compositor *hc;
+
+	if (!(hc = calloc(1, sizeof(*hc))))
+		return NULL;
+
+	hc->config = *config;
+	hc->ctl[0] = hc->ctl[1] = hc->vsync_fd = hc->release_fd = -1;
+	wl_list_init(&hc->surfaces);
+	wl_list_init(&hc->releases);
+	pthread_mutex_init(&hc->stats_lock, NULL);
+
+	if (!(hc->display = wl_display_create()))
+		goto error;
+	hc->loop = wl_display_get_event_loop(hc->display);
+
+	if (!wl_global_create(hc->display, &wl_compositor_interface, 4, hc, hc_compositor_bind))
+		goto error;
+	if (config->enable_wl_kms &&
+	    !wl_global_create(hc->display, &wl_kms_interface, 2, hc, hc_kms_bind))
+		goto error;
+	if (config->enable_dmabuf &&
+	    !wl_global_create(hc->display, &zwp_linux_dmabuf_v1_interface,
+			      HC_DMABUF_VERSION, hc, hc_dmabuf_bind))
+		goto error;
+	if (config->enable_dmabuf && config->enable_explicit_sync &&
+	    !wl_global_create(hc->display, &zwp_linux_explicit_synchronization_v1_interface,
+			      1, hc, hc_explicit_sync_bind))
+		goto error;
+	if (config->enable_presentation &&
+	    !wl_global_create(hc->display, &wp_presentation_interface, 1, hc, hc_presentation_bind))
+		goto error;
+
+	if (pipe2(hc->ctl, O_CLOEXEC) < 0)
+		goto error;
+	if (!wl_event_loop_add_fd(hc->loop, hc->ctl[0], WL_EVENT_READABLE, hc_handle_ctl, hc))
+		goto error;
+
+	if ((hc->release_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) < 0)
+		goto error;
+	if (!wl_event_loop_add_fd(hc->loop, hc->release_fd, WL_EVENT_READABLE,
+				  hc_handle_release_timer, hc))
+		goto error;
+
+	if (config->refresh_us) {
+		struct itimerspec its;
+
+		if ((hc->vsync_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) < 0)
+			goto error;
+
+		its.it_interval.tv_sec = config->refresh_us / 1000000;
+		its.it_interval.tv_nsec = (config->refresh_us % 1000000) * 1000;
+		its.it_value = its.it_interval;
+		if (timerfd_settime(hc->vsync_fd, 0, &its, NULL) < 0)
+			goto error;
+		if (!wl_event_loop_add_fd(hc->loop, hc->vsync_fd, WL_EVENT_READABLE,
+					  hc_handle_vsync_timer, hc))
+			goto error;
+	}
+
+	hc->running = 1;
+	if (pthread_create(&hc->thread, NULL, hc_thread, hc)) {
+		hc->running = 0;
+		goto error;
+	}
+
+	return hc;
+
+error:
+	headless_compositor_destroy(hc);
+	return NULL;
+}
+
+void headless_compositor_destroy(struct headless_compositor *hc)
+{
+	if (!hc)
+		return;
+
+	if (hc->running) {
+		hc_send_op(hc, HC_OP_QUIT, -1);
+		pthread_join(hc->thread, NULL);
+	}
+
+	if (hc->display) {
+		wl_display_destroy_clients(hc->display);
+		wl_display_destroy(hc->display);
+	}
+
+	if (hc->vsync_fd >= 0)
+		close(hc->vsync_fd);
+	if (hc->release_fd >= 0)
+		close(hc->release_fd);
+	if (hc->ctl[0] >= 0)
+		close(hc->ctl[0]);
+	if (hc->ctl[1] >= 0)
+		close(hc->ctl[1]);
+
+	pthread_mutex_destroy(&hc->stats_lock);
+	free(hc);
+}
+
+struct wl_display *headless_compositor_connect(struct headless_compositor *hc)
+{
+	struct wl_display *display;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+		return NULL;
+
+	if (!(display = wl_display_connect_to_fd(sv[1]))) {
+		close(sv[0]);
+		close(sv[1]);
+		return NULL;
+	}
+
+	/* wl_client must be created on the compositor thread */
+	hc_send_op(hc, HC_OP_CONNECT, sv[0]);
+
+	return display;
+}
+
+void headless_compositor_vsync(struct headless_compositor *hc)
+{
+	hc_send_op(hc, HC_OP_VSYNC, -1);
+}
+
+void headless_compositor_set_hold(struct headless_compositor *hc, bool hold)
+{
+	hc->hold = hold;
+	if (!hold)
+		hc_send_op(hc, HC_OP_WAKE, -1);
+}
+
+void headless_compositor_get_stats(struct headless_compositor *hc, struct headless_stats *stats)
+{
+	pthread_mutex_lock(&hc->stats_lock);
+	*stats = hc->stats;
+	pthread_mutex_unlock(&hc->stats_lock);
+}
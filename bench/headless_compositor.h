@@ -0,0 +1,124 @@
+/*
+ * @File           headless_compositor.h
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __HEADLESS_COMPOSITOR_H__
+#define __HEADLESS_COMPOSITOR_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct wl_display;
+struct headless_compositor;
+
+/*
+ * In-process headless compositor for benchmarking the client backend.
+ *
+ * It runs its own thread and implements wl_compositor, wl_kms,
+ * zwp_linux_dmabuf_v1, zwp_linux_explicit_synchronization_v1 and
+ * wp_presentation. Buffers
+ * are never read; they are only latched on the first vsync following their
+ * commit on which their acquire fence has signalled, and released again
+ * once they are superseded, optionally after a delay. With a release
+ * object, the release fence is sent right away and expires after the delay.
+ * Presentation feedback reports the vsync a commit was latched on, or its
+ * being discarded if it was superseded before.
+ */
+
+struct headless_config {
+	/* vsync period. 0 for a manual clock driven by headless_compositor_vsync() */
+	unsigned int	refresh_us;
+
+	/* delay between a buffer being superseded and wl_buffer.release */
+	unsigned int	release_delay_us;
+
+	/* hold back every Nth frame callback for one extra vsync, 0 to disable */
+	unsigned int	defer_frame_callback_every;
+
+	/* advertise the globals */
+	bool		enable_wl_kms;
+	bool		enable_dmabuf;
+	bool		enable_explicit_sync;	/* only along with dmabuf */
+	bool		enable_presentation;
+
+	/* device node sent in wl_kms.device */
+	const char	*kms_device;
+};
+
+struct headless_stats {
+	uint64_t	vsyncs;
+	uint64_t	commits;
+	uint64_t	presented;		/* latched on a vsync */
+	uint64_t	replaced;		/* superseded before being latched */
+	uint64_t	releases;
+	uint64_t	buffers_created;
+	uint64_t	frame_callbacks;
+	uint64_t	frame_callbacks_deferred;
+	uint64_t	acquire_fences;
+	uint64_t	acquire_fence_waits;	/* vsyncs a latch waited for the fence */
+	uint64_t	fenced_releases;
+	uint64_t	feedback_presented;
+	uint64_t	feedback_discarded;
+	uint64_t	damage_rects;		/* damage and damage_buffer requests */
+
+	/* commit to latch */
+	uint64_t	present_latency_ns_total;
+	uint64_t	present_latency_ns_max;
+};
+
+/**
+ * Fill in the default configuration, i.e. 60Hz and all globals.
+ */
+extern void headless_compositor_default_config(struct headless_config *config);
+
+/**
+ * Start a compositor thread.
+ */
+extern struct headless_compositor *headless_compositor_create(const struct headless_config *config);
+
+/**
+ * Stop the compositor thread and free all resources.
+ */
+extern void headless_compositor_destroy(struct headless_compositor *hc);
+
+/**
+ * Connect a new client. The returned display is owned by the caller.
+ */
+extern struct wl_display *headless_compositor_connect(struct headless_compositor *hc);
+
+/**
+ * Trigger a vsync. Only meaningful with a manual clock.
+ */
+extern void headless_compositor_vsync(struct headless_compositor *hc);
+
+/**
+ * Stop (or resume) sending frame callbacks and buffer releases, as for a
+ * minimized surface.
+ */
+extern void headless_compositor_set_hold(struct headless_compositor *hc, bool hold);
+
+/**
+ * Get a snapshot of the statistics.
+ */
+extern void headless_compositor_get_stats(struct headless_compositor *hc, struct headless_stats *stats);
+
+#endif /* !__HEADLESS_COMPOSITOR_H__ */
@@ -0,0 +1,286 @@
+/*
+ * @File           kms_stub.c
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+ * User space stand-in for libkms and libdrm. See kms_stub.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <xf86drm.h>
+#include <libkms.h>
+
+#include "kms_stub.h"
+
+#define KMS_STUB_MAX_BOS	1024
+#define KMS_STUB_PITCH_ALIGN	64
+
+#define KMS_STUB_ALIGN(x, a)	(((x) + (a) - 1) & ~((a) - 1))
+
+struct kms_driver {
+	int		fd;
+};
+
+struct kms_bo {
+	struct kms_driver	*kms;
+	unsigned int		handle;
+	unsigned int		width;
+	unsigned int		height;
+	unsigned int		pitch;
+	size_t			size;
+	int			fd;		/* memfd */
+	void			*addr;
+};
+
+static struct {
+	pthread_mutex_t		lock;
+	struct kms_bo		*bos[KMS_STUB_MAX_BOS];	/* indexed by handle - 1 */
+	drm_magic_t		magic;
+	struct kms_stub_stats	stats;
+} stub = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+void kms_stub_get_stats(struct kms_stub_stats *stats)
+{
+	pthread_mutex_lock(&stub.lock);
+	*stats = stub.stats;
+	pthread_mutex_unlock(&stub.lock);
+}
+
+/*
+ * libkms
+ */
+
+int kms_create(int fd, struct kms_driver **out)
+{
+	struct kms_driver *kms;
+
+	if (!(kms = calloc(1, sizeof(*kms))))
+		return -ENOMEM;
+
+	kms->fd = fd;
+	*out = kms;
+	return 0;
+}
+
+int kms_get_prop(struct kms_driver *kms, unsigned key, unsigned *out)
+{
+	(void)kms;
+	(void)key;
+	(void)out;
+
+	return -EINVAL;
+}
+
+int kms_destroy(struct kms_driver **kms)
+{
+	free(*kms);
+	*kms = NULL;
+	return 0;
+}
+
+int kms_bo_create(struct kms_driver *kms, const unsigned *attr, struct kms_bo **out)
+{
+	struct kms_bo *bo;
+	unsigned int i;
+
+	if (!(bo = calloc(1, sizeof(*bo))))
+		return -ENOMEM;
+
+	for (i = 0; attr[i] != KMS_TERMINATE_PROP_LIST; i += 2) {
+		switch (attr[i]) {
+		case KMS_WIDTH:
+			bo->width = attr[i + 1];
+			break;
+		case KMS_HEIGHT:
+			bo->height = attr[i + 1];
+			break;
+		case KMS_BO_TYPE:
+			break;
+		default:
+			free(bo);
+			return -EINVAL;
+		}
+	}
+
+	if (!bo->width || !bo->height) {
+		free(bo);
+		return -EINVAL;
+	}
+
+	bo->kms = kms;
+	bo->pitch = KMS_STUB_ALIGN(bo->width * 4, KMS_STUB_PITCH_ALIGN);
+	bo->size = (size_t)bo->pitch * bo->height;
+
+	if ((bo->fd = memfd_create("kms_bo", MFD_CLOEXEC)) < 0)
+		goto error;
+	if (ftruncate(bo->fd, bo->size) < 0)
+		goto error_close;
+
+	pthread_mutex_lock(&stub.lock);
+	for (i = 0; i < KMS_STUB_MAX_BOS && stub.bos[i]; i++)
+		;
+	if (i < KMS_STUB_MAX_BOS) {
+		stub.bos[i] = bo;
+		bo->handle = i + 1;
+
+		stub.stats.bos_created++;
+		stub.stats.bos++;
+		stub.stats.bytes += bo->size;
+		if (stub.stats.bytes > stub.stats.bytes_peak)
+			stub.stats.bytes_peak = stub.stats.bytes;
+	}
+	pthread_mutex_unlock(&stub.lock);
+
+	if (!bo->handle) {
+		errno = ENOSPC;
+		goto error_close;
+	}
+
+	*out = bo;
+	return 0;
+
+error_close:
+	close(bo->fd);
+error:
+	free(bo);
+	return -errno;
+}
+
+int kms_bo_get_prop(struct kms_bo *bo, unsigned key, unsigned *out)
+{
+	switch (key) {
+	case KMS_WIDTH:
+		*out = bo->width;
+		break;
+	case KMS_HEIGHT:
+		*out = bo->height;
+		break;
+	case KMS_PITCH:
+		*out = bo->pitch;
+		break;
+	case KMS_HANDLE:
+		*out = bo->handle;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int kms_bo_map(struct kms_bo *bo, void **out)
+{
+	if (!bo->addr) {
+		void *addr = mmap(NULL, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED, bo->fd, 0);
+
+		if (addr == MAP_FAILED)
+			return -errno;
+		bo->addr = addr;
+	}
+
+	*out = bo->addr;
+	return 0;
+}
+
+int kms_bo_unmap(struct kms_bo *bo)
+{
+	if (bo->addr) {
+		munmap(bo->addr, bo->size);
+		bo->addr = NULL;
+	}
+
+	return 0;
+}
+
+int kms_bo_destroy(struct kms_bo **bo)
+{
+	struct kms_bo *b = *bo;
+
+	kms_bo_unmap(b);
+
+	pthread_mutex_lock(&stub.lock);
+	stub.bos[b->handle - 1] = NULL;
+	stub.stats.bos--;
+	stub.stats.bytes -= b->size;
+	pthread_mutex_unlock(&stub.lock);
+
+	close(b->fd);
+	free(b);
+	*bo = NULL;
+
+	return 0;
+}
+
+/*
+ * libdrm
+ */
+
+int drmOpenWithType(const char *name, const char *busid, int type)
+{
+	(void)name;
+	(void)busid;
+	(void)type;
+
+	return open("/dev/null", O_RDWR | O_CLOEXEC);
+}
+
+int drmGetMagic(int fd, drm_magic_t *magic)
+{
+	(void)fd;
+
+	pthread_mutex_lock(&stub.lock);
+	*magic = ++stub.magic;
+	pthread_mutex_unlock(&stub.lock);
+
+	return 0;
+}
+
+int drmPrimeHandleToFD(int fd, uint32_t handle, uint32_t flags, int *prime_fd)
+{
+	struct kms_bo *bo = NULL;
+	int ret = -EINVAL;
+	(void)fd;
+
+	pthread_mutex_lock(&stub.lock);
+	if (handle && handle <= KMS_STUB_MAX_BOS)
+		bo = stub.bos[handle - 1];
+	if (bo) {
+		*prime_fd = fcntl(bo->fd, (flags & DRM_CLOEXEC) ? F_DUPFD_CLOEXEC : F_DUPFD, 0);
+		ret = (*prime_fd < 0) ? -errno : 0;
+		if (!ret)
+			stub.stats.prime_exports++;
+	}
+	pthread_mutex_unlock(&stub.lock);
+
+	return ret;
+}
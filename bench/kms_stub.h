@@ -0,0 +1,51 @@
+/*
+ * @File           kms_stub.h
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __KMS_STUB_H__
+#define __KMS_STUB_H__
+
+#include <stdint.h>
+
+/*
+ * Stand-in for the parts of libkms and libdrm used by the client backend.
+ *
+ * Buffer objects are backed by memfd, so that their PRIME fds can be passed
+ * over the Wayland socket and imported by the libsrv_um stand-in like real
+ * dma-bufs. The symbols are meant to interpose the real libraries, i.e. the
+ * benchmark must be linked with -export-dynamic.
+ */
+
+struct kms_stub_stats {
+	uint64_t	bos_created;
+	uint64_t	prime_exports;
+	int		bos;		/* live */
+	uint64_t	bytes;		/* live */
+	uint64_t	bytes_peak;
+};
+
+/**
+ * Get a snapshot of the buffer object bookkeeping.
+ */
+extern void kms_stub_get_stats(struct kms_stub_stats *stats);
+
+#endif /* !__KMS_STUB_H__ */
@@ -0,0 +1,868 @@
+/*
+ * @File           pvrsrv_stub.c
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+ * User space stand-in for libsrv_um. See pvrsrv_stub.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "pvrsrv_stub.h"
+
+#define STUB_PAGE_SIZE		4096ULL
+#define STUB_HEAP_BASE		0x0000008000000000ULL
+#define STUB_MAX_FENCES		256
+
+#define STUB_ALIGN(x, a)	(((x) + (a) - 1) & ~((a) - 1))
+#define STUB_UNUSED(x)		(void)(x)
+
+typedef enum {
+	STUB_MEM_IMPORT,
+	STUB_MEM_WRAP,
+	STUB_MEM_ALLOC,
+} stub_mem_origin;
+
+struct PVRSRV_DEV_CONNECTION_TAG {
+	int			event_fd;
+};
+
+struct PVRSRV_DEVMEMCTX_TAG {
+	int			dummy;
+};
+
+struct RGX_DEVMEMCONTEXT_TAG {
+	int			dummy;
+};
+
+struct DEVMEM_HEAP_TAG {
+	uint64_t		next_vaddr;
+};
+
+struct DEVMEM_MEMDESC_TAG {
+	stub_mem_origin		origin;
+	IMG_DEVMEM_SIZE_T	size;
+	int			fd;		/* -1 for wrapped memory */
+
+	void			*cpu_addr;
+	int			cpu_map_count;
+	bool			cpu_mapped;	/* cpu_addr is mmap()ed by us */
+
+	IMG_DEV_VIRTADDR	vaddr;
+	bool			device_mapped;
+};
+
+static struct {
+	pthread_mutex_t			lock;
+	bool				initialized;
+
+	unsigned int			latency_us[PVRSRV_STUB_NUM_ENTRIES];
+	struct pvrsrv_stub_stats	stats;
+
+	struct PVRSRV_DEV_CONNECTION_TAG connection;
+	int				connection_count;
+	struct PVRSRV_DEVMEMCTX_TAG	devmem_context;
+	struct RGX_DEVMEMCONTEXT_TAG	rgx_devmem_context;
+	struct DEVMEM_HEAP_TAG		heap;
+
+	int				fences[STUB_MAX_FENCES];
+} stub = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.heap = { .next_vaddr = STUB_HEAP_BASE },
+};
+
+static const char *entry_names[PVRSRV_STUB_NUM_ENTRIES] = {
+	[PVRSRV_STUB_CONNECT]			= "Connect",
+	[PVRSRV_STUB_DISCONNECT]		= "Disconnect",
+	[PVRSRV_STUB_ACQUIRE_GLOBAL_EVENT_HANDLE] = "AcquireGlobalEventHandle",
+	[PVRSRV_STUB_RELEASE_GLOBAL_EVENT_HANDLE] = "ReleaseGlobalEventHandle",
+	[PVRSRV_STUB_EVENT_OBJECT_WAIT]		= "EventObjectWait",
+	[PVRSRV_STUB_FENCE_WAIT]		= "FenceWait",
+	[PVRSRV_STUB_FENCE_DUP]			= "FenceDup",
+	[PVRSRV_STUB_FENCE_DESTROY]		= "FenceDestroy",
+	[PVRSRV_STUB_CREATE_DEVICE_MEM_CONTEXT]	= "CreateDeviceMemContext",
+	[PVRSRV_STUB_RELEASE_DEVICE_MEM_CONTEXT] = "ReleaseDeviceMemContext",
+	[PVRSRV_STUB_FIND_HEAP]			= "FindHeap",
+	[PVRSRV_STUB_WRAP_EXT_MEM]		= "WrapExtMem",
+	[PVRSRV_STUB_DMABUF_EXPORT_DEV_MEM]	= "DmaBufExportDevMem",
+	[PVRSRV_STUB_DMABUF_IMPORT_DEV_MEM]	= "DmaBufImportDevMem",
+	[PVRSRV_STUB_FREE_DEVICE_MEM]		= "FreeDeviceMem",
+	[PVRSRV_STUB_DMABUF_ALLOC_DEV_MEM]	= "DMABufAllocDevMem",
+	[PVRSRV_STUB_DMABUF_RELEASE_DEV_MEM]	= "DMABufReleaseDevMem",
+	[PVRSRV_STUB_ACQUIRE_CPU_MAPPING]	= "AcquireCPUMapping",
+	[PVRSRV_STUB_RELEASE_CPU_MAPPING]	= "ReleaseCPUMapping",
+	[PVRSRV_STUB_MAP_TO_DEVICE]		= "MapToDevice",
+	[PVRSRV_STUB_RELEASE_DEVICE_MAPPING]	= "ReleaseDeviceMapping",
+	[PVRSRV_STUB_APP_HINT]			= "AppHint",
+};
+
+/*
+ * Configuration
+ */
+
+const char *pvrsrv_stub_entry_name(pvrsrv_stub_entry entry)
+{
+	if (entry >= PVRSRV_STUB_NUM_ENTRIES)
+		return "unknown";
+	return entry_names[entry];
+}
+
+static void stub_parse_latency(const char *config, bool defaults)
+{
+	char *buf, *token, *saveptr;
+	int i;
+
+	if (!(buf = strdup(config)))
+		return;
+
+	for (token = strtok_r(buf, ",", &saveptr); token;
+	     token = strtok_r(NULL, ",", &saveptr)) {
+		char *value = strchr(token, '=');
+		unsigned int usec;
+
+		if (!value)
+			continue;
+		*value++ = '\0';
+		usec = (unsigned int)strtoul(value, NULL, 0);
+
+		for (i = 0; i < PVRSRV_STUB_NUM_ENTRIES; i++) {
+			if (defaults ? !strcmp(token, "*") : !strcmp(token, entry_names[i]))
+				stub.latency_us[i] = usec;
+		}
+	}
+
+	free(buf);
+}
+
+/* must be called with stub.lock held */
+static void stub_init_locked(void)
+{
+	const char *config;
+	int i;
+
+	if (stub.initialized)
+		return;
+
+	for (i = 0; i < STUB_MAX_FENCES; i++)
+		stub.fences[i] = -1;
+	stub.connection.event_fd = -1;
+
+	/* "*=N" must not override explicit values, so apply it first */
+	if ((config = getenv("PVRSRV_STUB_LATENCY"))) {
+		stub_parse_latency(config, true);
+		stub_parse_latency(config, false);
+	}
+
+	stub.initialized = true;
+}
+
+void pvrsrv_stub_set_latency(pvrsrv_stub_entry entry, unsigned int usec)
+{
+	if (entry >= PVRSRV_STUB_NUM_ENTRIES)
+		return;
+
+	pthread_mutex_lock(&stub.lock);
+	stub_init_locked();
+	stub.latency_us[entry] = usec;
+	pthread_mutex_unlock(&stub.lock);
+}
+
+void pvrsrv_stub_get_stats(struct pvrsrv_stub_stats *stats)
+{
+	pthread_mutex_lock(&stub.lock);
+	*stats = stub.stats;
+	pthread_mutex_unlock(&stub.lock);
+}
+
+void pvrsrv_stub_reset_stats(void)
+{
+	pthread_mutex_lock(&stub.lock);
+	memset(stub.stats.calls, 0, sizeof(stub.stats.calls));
+	memset(stub.stats.injected_ns, 0, sizeof(stub.stats.injected_ns));
+	stub.stats.errors = 0;
+	pthread_mutex_unlock(&stub.lock);
+}
+
+/*
+ * Latency injection. Called on entry of every PVRSRV*Ext function.
+ */
+
+static uint64_t stub_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void stub_enter(pvrsrv_stub_entry entry)
+{
+	unsigned int usec;
+	uint64_t start;
+	struct timespec ts;
+
+	pthread_mutex_lock(&stub.lock);
+	stub_init_locked();
+	stub.stats.calls[entry]++;
+	usec = stub.latency_us[entry];
+	pthread_mutex_unlock(&stub.lock);
+
+	if (!usec)
+		return;
+
+	/* sleep outside of the lock, the kernel doesn't serialize us either */
+	start = stub_now_ns();
+	ts.tv_sec = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+		;
+
+	pthread_mutex_lock(&stub.lock);
+	stub.stats.injected_ns[entry] += stub_now_ns() - start;
+	pthread_mutex_unlock(&stub.lock);
+}
+
+static int stub_dup(int fd)
+{
+	return fcntl(fd, F_DUPFD_CLOEXEC, 0);
+}
+
+static void stub_error(const char *func, const char *msg)
+{
+	pthread_mutex_lock(&stub.lock);
+	stub.stats.errors++;
+	pthread_mutex_unlock(&stub.lock);
+
+	fprintf(stderr, "pvrsrv_stub: %s: %s\n", func, msg);
+}
+
+/*
+ * Fence bookkeeping. A fence is a file descriptor that becomes readable
+ * when signalled, like a sync_file.
+ */
+
+static bool stub_fence_track(int fd)
+{
+	int i;
+
+	pthread_mutex_lock(&stub.lock);
+	for (i = 0; i < STUB_MAX_FENCES; i++) {
+		if (stub.fences[i] < 0) {
+			stub.fences[i] = fd;
+			stub.stats.fences++;
+			pthread_mutex_unlock(&stub.lock);
+			return true;
+		}
+	}
+	pthread_mutex_unlock(&stub.lock);
+
+	return false;
+}
+
+static bool stub_fence_untrack(int fd)
+{
+	int i;
+
+	pthread_mutex_lock(&stub.lock);
+	for (i = 0; i < STUB_MAX_FENCES; i++) {
+		if (stub.fences[i] == fd) {
+			stub.fences[i] = -1;
+			stub.stats.fences--;
+			pthread_mutex_unlock(&stub.lock);
+			return true;
+		}
+	}
+	pthread_mutex_unlock(&stub.lock);
+
+	return false;
+}
+
+PVRSRV_FENCE pvrsrv_stub_fence_create(unsigned int delay_us)
+{
+	struct itimerspec its;
+	int fd;
+
+	if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) < 0)
+		return PVRSRV_NO_FENCE;
+
+	/* a zero it_value disarms the timer, so use 1ns for "already signalled" */
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = delay_us / 1000000;
+	its.it_value.tv_nsec = delay_us ? (delay_us % 1000000) * 1000 : 1;
+	if (timerfd_settime(fd, 0, &its, NULL) < 0 || !stub_fence_track(fd)) {
+		close(fd);
+		return PVRSRV_NO_FENCE;
+	}
+
+	return (PVRSRV_FENCE)fd;
+}
+
+/*
+ * SERVICES
+ */
+
+bool PVRSRVConnectExt(PVRSRV_DEV_CONNECTION **ppsDevConnection)
+{
+	stub_enter(PVRSRV_STUB_CONNECT);
+
+	pthread_mutex_lock(&stub.lock);
+	if (stub.connection_count++ == 0)
+		stub.connection.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	*ppsDevConnection = &stub.connection;
+	pthread_mutex_unlock(&stub.lock);
+
+	return true;
+}
+
+bool PVRSRVDisconnectExt(PVRSRV_DEV_CONNECTION *psDevConnection)
+{
+	stub_enter(PVRSRV_STUB_DISCONNECT);
+
+	if (psDevConnection != &stub.connection || stub.connection_count <= 0) {
+		stub_error(__func__, "invalid connection");
+		return false;
+	}
+
+	pthread_mutex_lock(&stub.lock);
+	if (--stub.connection_count == 0) {
+		close(stub.connection.event_fd);
+		stub.connection.event_fd = -1;
+		if (stub.stats.memdescs || stub.stats.fences)
+			fprintf(stderr, "pvrsrv_stub: %s: leaking %d memdescs, %d fences\n",
+				__func__, stub.stats.memdescs, stub.stats.fences);
+	}
+	pthread_mutex_unlock(&stub.lock);
+
+	return true;
+}
+
+bool PVRSRVAcquireGlobalEventHandleExt(const PVRSRV_DEV_CONNECTION *psDevConnection,
+				       void **ppvEvent)
+{
+	stub_enter(PVRSRV_STUB_ACQUIRE_GLOBAL_EVENT_HANDLE);
+
+	*ppvEvent = (void*)&psDevConnection->event_fd;
+	return true;
+}
+
+bool PVRSRVReleaseGlobalEventHandleExt(const PVRSRV_DEV_CONNECTION *psDevConnection,
+				       void *pvEvent)
+{
+	stub_enter(PVRSRV_STUB_RELEASE_GLOBAL_EVENT_HANDLE);
+
+	return pvEvent == (void*)&psDevConnection->event_fd;
+}
+
+bool PVRSRVEventObjectWaitTimeoutExt(const PVRSRV_DEV_CONNECTION *psDevConnection,
+				     void *pvEvent,
+				     uint64_t ui64Timeoutus,
+				     bool *pbSignalled)
+{
+	struct pollfd pfd = { .fd = *(int*)pvEvent, .events = POLLIN };
+	uint64_t value;
+	STUB_UNUSED(psDevConnection);
+
+	stub_enter(PVRSRV_STUB_EVENT_OBJECT_WAIT);
+
+	*pbSignalled = poll(&pfd, 1, (int)(ui64Timeoutus / 1000)) > 0;
+	if (*pbSignalled && read(pfd.fd, &value, sizeof(value)) < 0)
+		*pbSignalled = false;
+
+	return true;
+}
+
+bool PVRSRVEventObjectWaitExt(const PVRSRV_DEV_CONNECTION *psDevConnection,
+			      void *pvEvent,
+			      bool *pbSignalled)
+{
+	/* the real thing times out after 100ms as well */
+	return PVRSRVEventObjectWaitTimeoutExt(psDevConnection, pvEvent, 100000, pbSignalled);
+}
+
+/*
+ * PVRSRV_SYNC_UM
+ */
+
+bool PVRSRVFenceWaitExt(PVRSRV_DEV_CONNECTION *psDevConnection,
+			PVRSRV_FENCE hFence,
+			uint32_t ui32TimeoutInMs,
+			bool *pbFenceMet)
+{
+	struct pollfd pfd = { .fd = hFence, .events = POLLIN };
+	STUB_UNUSED(psDevConnection);
+
+	stub_enter(PVRSRV_STUB_FENCE_WAIT);
+
+	if (hFence == PVRSRV_NO_FENCE) {
+		*pbFenceMet = true;
+		return true;
+	}
+
+	*pbFenceMet = poll(&pfd, 1, (int)ui32TimeoutInMs) > 0;
+	return true;
+}
+
+bool PVRSRVFenceDupExt(PVRSRV_DEV_CONNECTION *psDevConnection,
+		       PVRSRV_FENCE hSourceFence,
+		       PVRSRV_FENCE *phOutputFence)
+{
+	int fd;
+	STUB_UNUSED(psDevConnection);
+
+	stub_enter(PVRSRV_STUB_FENCE_DUP);
+
+	if (hSourceFence == PVRSRV_NO_FENCE) {
+		*phOutputFence = PVRSRV_NO_FENCE;
+		return true;
+	}
+
+	if ((fd = stub_dup(hSourceFence)) < 0 || !stub_fence_track(fd)) {
+		if (fd >= 0)
+			close(fd);
+		stub_error(__func__, "cannot duplicate fence");
+		return false;
+	}
+
+	*phOutputFence = (PVRSRV_FENCE)fd;
+	return true;
+}
+
+bool PVRSRVFenceDestroyExt(PVRSRV_DEV_CONNECTION *psDevConnection,
+			   PVRSRV_FENCE hFence)
+{
+	STUB_UNUSED(psDevConnection);
+
+	stub_enter(PVRSRV_STUB_FENCE_DESTROY);
+
+	if (hFence == PVRSRV_NO_FENCE)
+		return true;
+
+	if (!stub_fence_untrack(hFence)) {
+		stub_error(__func__, "unknown or already destroyed fence");
+		return false;
+	}
+
+	close(hFence);
+	return true;
+}
+
+/*
+ * PVRSRV_DEVMEM
+ */
+
+bool PVRSRVCreateDeviceMemContextExt(PVRSRV_DEV_CONNECTION *psDevConnection,
+				     PRGX_DEVMEMCONTEXT *phRGXDevMemCtxOut,
+				     PVRSRV_DEVMEMCTX *phDevMemCtxOut)
+{
+	STUB_UNUSED(psDevConnection);
+
+	stub_enter(PVRSRV_STUB_CREATE_DEVICE_MEM_CONTEXT);
+
+	*phRGXDevMemCtxOut = &stub.rgx_devmem_context;
+	*phDevMemCtxOut = &stub.devmem_context;
+	return true;
+}
+
+void PVRSRVReleaseDeviceMemContextExt(PRGX_DEVMEMCONTEXT hRGXDevMemCtx,
+				      PVRSRV_DEVMEMCTX hDevMemCtx)
+{
+	STUB_UNUSED(hRGXDevMemCtx);
+	STUB_UNUSED(hDevMemCtx);
+
+	stub_enter(PVRSRV_STUB_RELEASE_DEVICE_MEM_CONTEXT);
+}
+
+bool PVRSRVFindHeapExt(PVRSRV_DEVMEMCTX hCtx, PVRSRV_HEAP *phHeapOut)
+{
+	STUB_UNUSED(hCtx);
+
+	stub_enter(PVRSRV_STUB_FIND_HEAP);
+
+	*phHeapOut = &stub.heap;
+	return true;
+}
+
+static PVRSRV_MEMDESC stub_memdesc_create(stub_mem_origin origin,
+					  IMG_DEVMEM_SIZE_T size, int fd, void *addr)
+{
+	PVRSRV_MEMDESC memdesc;
+
+	if (!(memdesc = calloc(1, sizeof(*memdesc))))
+		return NULL;
+
+	memdesc->origin = origin;
+	memdesc->size = size;
+	memdesc->fd = fd;
+	memdesc->cpu_addr = addr;
+
+	pthread_mutex_lock(&stub.lock);
+	stub.stats.memdescs++;
+	switch (origin) {
+	case STUB_MEM_IMPORT:
+		stub.stats.bytes_imported += size;
+		break;
+	case STUB_MEM_WRAP:
+		stub.stats.bytes_wrapped += size;
+		break;
+	case STUB_MEM_ALLOC:
+		stub.stats.bytes_allocated += size;
+		break;
+	}
+	pthread_mutex_unlock(&stub.lock);
+
+	return memdesc;
+}
+
+static void stub_memdesc_destroy(PVRSRV_MEMDESC memdesc)
+{
+	if (memdesc->device_mapped)
+		stub_error(__func__, "freeing memory still mapped to the device");
+	if (memdesc->cpu_map_count)
+		stub_error(__func__, "freeing memory still mapped to the CPU");
+
+	if (memdesc->cpu_mapped)
+		munmap(memdesc->cpu_addr, memdesc->size);
+	if (memdesc->fd >= 0)
+		close(memdesc->fd);
+
+	pthread_mutex_lock(&stub.lock);
+	stub.stats.memdescs--;
+	if (memdesc->cpu_map_count)
+		stub.stats.cpu_mappings--;
+	if (memdesc->device_mapped)
+		stub.stats.device_mappings--;
+	switch (memdesc->origin) {
+	case STUB_MEM_IMPORT:
+		stub.stats.bytes_imported -= memdesc->size;
+		break;
+	case STUB_MEM_WRAP:
+		stub.stats.bytes_wrapped -= memdesc->size;
+		break;
+	case STUB_MEM_ALLOC:
+		stub.stats.bytes_allocated -= memdesc->size;
+		break;
+	}
+	pthread_mutex_unlock(&stub.lock);
+
+	free(memdesc);
+}
+
+/*
+ * PVRSRV_DEVMEM_EXTMEM
+ */
+
+bool PVRSRVWrapExtMemExt(const PVRSRV_DEVMEMCTX psDevMemCtx,
+			 IMG_DEVMEM_SIZE_T uiSize,
+			 IMG_CPU_VIRTADDR pvCpuVAddr,
+			 IMG_DEVMEM_ALIGN_T uiAlign,
+			 char *pszText,
+			 PVRSRV_MEMDESC *hMemDesc)
+{
+	STUB_UNUSED(psDevMemCtx);
+	STUB_UNUSED(pszText);
+
+	stub_enter(PVRSRV_STUB_WRAP_EXT_MEM);
+
+	if (!pvCpuVAddr || !uiSize || (uiAlign && ((uintptr_t)pvCpuVAddr & 0xf))) {
+		stub_error(__func__, "invalid memory to wrap");
+		return false;
+	}
+
+	return (*hMemDesc = stub_memdesc_create(STUB_MEM_WRAP, uiSize, -1, pvCpuVAddr)) != NULL;
+}
+
+/*
+ * PVRSRV_DEVMEM_DMABUF
+ */
+
+static IMG_DEVMEM_SIZE_T stub_dmabuf_size(int fd)
+{
+	off_t size = lseek(fd, 0, SEEK_END);
+
+	if (size < 0)
+		return 0;
+	lseek(fd, 0, SEEK_SET);
+
+	return (IMG_DEVMEM_SIZE_T)size;
+}
+
+bool PVRSRVDmaBufExportDevMemExt(PVRSRV_MEMDESC hMemDesc, int *piFd)
+{
+	stub_enter(PVRSRV_STUB_DMABUF_EXPORT_DEV_MEM);
+
+	if (!hMemDesc || hMemDesc->fd < 0)
+		return false;
+
+	return (*piFd = stub_dup(hMemDesc->fd)) >= 0;
+}
+
+bool PVRSRVDmaBufImportDevMemExt(const PVRSRV_DEV_CONNECTION *psDevConnection,
+				 int fd,
+				 PVRSRV_MEMDESC *phMemDescPtr,
+				 IMG_DEVMEM_SIZE_T *puiSizePtr,
+				 const char *pszName)
+{
+	IMG_DEVMEM_SIZE_T size;
+	int import_fd;
+	STUB_UNUSED(psDevConnection);
+	STUB_UNUSED(pszName);
+
+	stub_enter(PVRSRV_STUB_DMABUF_IMPORT_DEV_MEM);
+
+	if (!(size = stub_dmabuf_size(fd))) {
+		stub_error(__func__, "cannot determine the size of the dmabuf");
+		return false;
+	}
+
+	/* the import holds its own reference on the dmabuf */
+	if ((import_fd = stub_dup(fd)) < 0)
+		return false;
+
+	if (!(*phMemDescPtr = stub_memdesc_create(STUB_MEM_IMPORT, size, import_fd, NULL))) {
+		close(import_fd);
+		return false;
+	}
+	*puiSizePtr = size;
+
+	return true;
+}
+
+bool PVRSRVFreeDeviceMemExt(const PVRSRV_DEV_CONNECTION *psDevConnection,
+			    PVRSRV_MEMDESC hMemDesc)
+{
+	STUB_UNUSED(psDevConnection);
+
+	stub_enter(PVRSRV_STUB_FREE_DEVICE_MEM);
+
+	if (!hMemDesc) {
+		stub_error(__func__, "NULL memdesc");
+		return false;
+	}
+
+	stub_memdesc_destroy(hMemDesc);
+	return true;
+}
+
+void PVRSRVFreeDeviceMemExtREL(PVRSRV_MEMDESC hMemDesc)
+{
+	PVRSRVFreeDeviceMemExt(&stub.connection, hMemDesc);
+}
+
+bool PVRSRVDMABufAllocDevMemExt(const PVRSRV_DEV_CONNECTION *psDevConnection,
+				IMG_DEVMEM_SIZE_T uiSize,
+				IMG_DEVMEM_LOG2ALIGN_T uiLog2Align,
+				char *pszName,
+				int *fd,
+				PVRSRV_MEMDESC *phMemDescPtr)
+{
+	int memfd;
+	STUB_UNUSED(psDevConnection);
+	STUB_UNUSED(uiLog2Align);
+
+	stub_enter(PVRSRV_STUB_DMABUF_ALLOC_DEV_MEM);
+
+	uiSize = STUB_ALIGN(uiSize, STUB_PAGE_SIZE);
+	if ((memfd = memfd_create(pszName ? pszName : "pvrsrv_stub", MFD_CLOEXEC)) < 0)
+		return false;
+	if (ftruncate(memfd, (off_t)uiSize) < 0)
+		goto error;
+	if ((*fd = stub_dup(memfd)) < 0)
+		goto error;
+
+	if (!(*phMemDescPtr = stub_memdesc_create(STUB_MEM_ALLOC, uiSize, memfd, NULL))) {
+		close(*fd);
+		goto error;
+	}
+
+	return true;
+
+error:
+	close(memfd);
+	return false;
+}
+
+bool PVRSRVDMABufReleaseDevMemExt(const PVRSRV_DEV_CONNECTION *psDevConnection,
+				  PVRSRV_MEMDESC hMemDesc,
+				  int fd)
+{
+	STUB_UNUSED(psDevConnection);
+
+	stub_enter(PVRSRV_STUB_DMABUF_RELEASE_DEV_MEM);
+
+	if (fd >= 0)
+		close(fd);
+	if (hMemDesc)
+		stub_memdesc_destroy(hMemDesc);
+
+	return true;
+}
+
+bool PVRSRVAcquireCPUMappingExt(PVRSRV_MEMDESC hMemDesc, void **ppvCpuVirtAddrOut)
+{
+	stub_enter(PVRSRV_STUB_ACQUIRE_CPU_MAPPING);
+
+	if (!hMemDesc)
+		return false;
+
+	if (!hMemDesc->cpu_addr) {
+		void *addr = mmap(NULL, hMemDesc->size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED, hMemDesc->fd, 0);
+		if (addr == MAP_FAILED) {
+			stub_error(__func__, strerror(errno));
+			return false;
+		}
+		hMemDesc->cpu_addr = addr;
+		hMemDesc->cpu_mapped = true;
+	}
+
+	if (hMemDesc->cpu_map_count++ == 0) {
+		pthread_mutex_lock(&stub.lock);
+		stub.stats.cpu_mappings++;
+		pthread_mutex_unlock(&stub.lock);
+	}
+
+	*ppvCpuVirtAddrOut = hMemDesc->cpu_addr;
+	return true;
+}
+
+void PVRSRVReleaseCPUMappingExt(PVRSRV_MEMDESC hMemDesc)
+{
+	stub_enter(PVRSRV_STUB_RELEASE_CPU_MAPPING);
+
+	if (!hMemDesc || hMemDesc->cpu_map_count <= 0) {
+		stub_error(__func__, "unbalanced CPU mapping release");
+		return;
+	}
+
+	if (--hMemDesc->cpu_map_count == 0) {
+		pthread_mutex_lock(&stub.lock);
+		stub.stats.cpu_mappings--;
+		pthread_mutex_unlock(&stub.lock);
+	}
+}
+
+bool PVRSRVMapToDeviceExt(PVRSRV_MEMDESC hMemDesc,
+			  PVRSRV_HEAP hHeap,
+			  IMG_DEV_VIRTADDR *psDevVirtAddrOut)
+{
+	stub_enter(PVRSRV_STUB_MAP_TO_DEVICE);
+
+	if (!hMemDesc || !hHeap)
+		return false;
+
+	if (hMemDesc->device_mapped) {
+		stub_error(__func__, "memory already mapped to the device");
+		return false;
+	}
+
+	/* never reuse device VAs, so that stale addresses are easy to spot */
+	pthread_mutex_lock(&stub.lock);
+	hMemDesc->vaddr.uiAddr = hHeap->next_vaddr;
+	hHeap->next_vaddr += STUB_ALIGN(hMemDesc->size, STUB_PAGE_SIZE) + STUB_PAGE_SIZE;
+	stub.stats.device_mappings++;
+	pthread_mutex_unlock(&stub.lock);
+
+	hMemDesc->device_mapped = true;
+	*psDevVirtAddrOut = hMemDesc->vaddr;
+
+	return true;
+}
+
+void PVRSRVReleaseDeviceMappingExt(PVRSRV_MEMDESC hMemDesc)
+{
+	stub_enter(PVRSRV_STUB_RELEASE_DEVICE_MAPPING);
+
+	if (!hMemDesc || !hMemDesc->device_mapped) {
+		stub_error(__func__, "memory is not mapped to the device");
+		return;
+	}
+
+	hMemDesc->device_mapped = false;
+
+	pthread_mutex_lock(&stub.lock);
+	stub.stats.device_mappings--;
+	pthread_mutex_unlock(&stub.lock);
+}
+
+/*
+ * AppHints. There's no powervr.ini, so the WSEGL falls back to the
+ * environment variables.
+ */
+
+void PVRSRVCreateAppHintStateExt(const char *pszAppName, void **ppvState)
+{
+	STUB_UNUSED(pszAppName);
+
+	stub_enter(PVRSRV_STUB_APP_HINT);
+	*ppvState = NULL;
+}
+
+void PVRSRVFreeAppHintStateExt(void *pvHintState)
+{
+	STUB_UNUSED(pvHintState);
+}
+
+bool PVRSRVGetAppHintUintExt(void *pvHintState,
+			     const char *pszHintName,
+			     const void *pvDefault,
+			     void *pvReturn)
+{
+	STUB_UNUSED(pvHintState);
+	STUB_UNUSED(pszHintName);
+
+	*(uint32_t*)pvReturn = *(const uint32_t*)pvDefault;
+	return false;
+}
+
+bool PVRSRVGetAppHintStringExt(void *pvHintState,
+			       const char *pszHintName,
+			       const void *pvDefault,
+			       void *pvReturn)
+{
+	STUB_UNUSED(pvHintState);
+	STUB_UNUSED(pszHintName);
+	STUB_UNUSED(pvDefault);
+	STUB_UNUSED(pvReturn);
+
+	return false;
+}
+
+bool PVRSRVCreateTransferContextExt(PVRSRV_DEVMEMCTX hDevMemContext,
+				    void *hTransferContext)
+{
+	STUB_UNUSED(hDevMemContext);
+	STUB_UNUSED(hTransferContext);
+
+	return false;
+}
@@ -0,0 +1,122 @@
+/*
+ * @File           pvrsrv_stub.h
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __PVRSRV_STUB_H__
+#define __PVRSRV_STUB_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "powervr/services_ext.h"
+
+/*
+ * Stand-in for libsrv_um.
+ *
+ * Implements the PVRSRV*Ext entry points from services_ext.h in user space,
+ * so that libpvrWAYLAND_WSEGL can be run and profiled without a Rogue GPU.
+ * Memory descriptors, device virtual addresses and fences are tracked for
+ * real; every entry point may be delayed by a configurable latency to mimic
+ * the cost of the kernel round trip.
+ *
+ * Latencies are configured with PVRSRV_STUB_LATENCY, a comma separated list
+ * of "<entry>=<usec>" pairs, where <entry> is the function name without the
+ * "PVRSRV" prefix and "Ext" suffix, e.g.
+ *
+ *	PVRSRV_STUB_LATENCY="DmaBufImportDevMem=150,MapToDevice=40,*=2"
+ *
+ * "*" sets the default for all entries not listed explicitly.
+ */
+
+typedef enum {
+	PVRSRV_STUB_CONNECT,
+	PVRSRV_STUB_DISCONNECT,
+	PVRSRV_STUB_ACQUIRE_GLOBAL_EVENT_HANDLE,
+	PVRSRV_STUB_RELEASE_GLOBAL_EVENT_HANDLE,
+	PVRSRV_STUB_EVENT_OBJECT_WAIT,
+	PVRSRV_STUB_FENCE_WAIT,
+	PVRSRV_STUB_FENCE_DUP,
+	PVRSRV_STUB_FENCE_DESTROY,
+	PVRSRV_STUB_CREATE_DEVICE_MEM_CONTEXT,
+	PVRSRV_STUB_RELEASE_DEVICE_MEM_CONTEXT,
+	PVRSRV_STUB_FIND_HEAP,
+	PVRSRV_STUB_WRAP_EXT_MEM,
+	PVRSRV_STUB_DMABUF_EXPORT_DEV_MEM,
+	PVRSRV_STUB_DMABUF_IMPORT_DEV_MEM,
+	PVRSRV_STUB_FREE_DEVICE_MEM,
+	PVRSRV_STUB_DMABUF_ALLOC_DEV_MEM,
+	PVRSRV_STUB_DMABUF_RELEASE_DEV_MEM,
+	PVRSRV_STUB_ACQUIRE_CPU_MAPPING,
+	PVRSRV_STUB_RELEASE_CPU_MAPPING,
+	PVRSRV_STUB_MAP_TO_DEVICE,
+	PVRSRV_STUB_RELEASE_DEVICE_MAPPING,
+	PVRSRV_STUB_APP_HINT,
+	PVRSRV_STUB_NUM_ENTRIES
+} pvrsrv_stub_entry;
+
+struct pvrsrv_stub_stats {
+	/* number of calls and time spent in injected latency per entry */
+	uint64_t	calls[PVRSRV_STUB_NUM_ENTRIES];
+	uint64_t	injected_ns[PVRSRV_STUB_NUM_ENTRIES];
+
+	/* live objects */
+	int		memdescs;
+	int		device_mappings;
+	int		cpu_mappings;
+	int		fences;
+
+	/* live bytes by origin */
+	uint64_t	bytes_imported;
+	uint64_t	bytes_wrapped;
+	uint64_t	bytes_allocated;
+
+	/* API misuse detected, e.g. double free or unknown fence */
+	uint64_t	errors;
+};
+
+/**
+ * Set the latency injected into an entry point. Overrides PVRSRV_STUB_LATENCY.
+ */
+extern void pvrsrv_stub_set_latency(pvrsrv_stub_entry entry, unsigned int usec);
+
+/**
+ * Get a snapshot of the call counters and live object bookkeeping.
+ */
+extern void pvrsrv_stub_get_stats(struct pvrsrv_stub_stats *stats);
+
+/**
+ * Reset the call counters. Live object bookkeeping is left untouched.
+ */
+extern void pvrsrv_stub_reset_stats(void);
+
+/**
+ * Name of an entry point as used in PVRSRV_STUB_LATENCY.
+ */
+extern const char *pvrsrv_stub_entry_name(pvrsrv_stub_entry entry);
+
+/**
+ * Create a fence as the GPU would return it at the end of a render.
+ * The fence is signalled after delay_us microseconds, or immediately if 0.
+ */
+extern PVRSRV_FENCE pvrsrv_stub_fence_create(unsigned int delay_us);
+
+#endif /* !__PVRSRV_STUB_H__ */
@@ -0,0 +1,2029 @@
+/*
+ * @File           wsegl_bench.c
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+ * Benchmark driver for libpvrWAYLAND_WSEGL.
+ *
+ * The library is dlopen()ed and driven through WSEGL_GetFunctionTablePointer()
+ * the same way the IMG EGL does. Each scenario exercises either the client
+ * table, against the headless compositor, or the server table, against a
+ * GBM device or a fake one with a scripted front buffer lock schedule.
+ * Every call through the function table is timed, and latency percentiles
+ * are reported per function pointer.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
+
+#include <gbm.h>
+
+#include "wayland-client.h"
+#include "wayland-egl.h"
+
+#include "powervr/wsegl.h"
+#include "EGL/eglext_REL.h"
+
+#include "waylandws_priv.h"
+
+#include "waylandws_profile.h"
+#include "waylandws_memory.h"
+#include "waylandws_damage.h"
+
+#include "headless_compositor.h"
+#include "fake_gbm.h"
+#include "pvrsrv_stub.h"
+#if defined(PVRSRV_STUB)
+#include "kms_stub.h"
+#endif
+
+#define BENCH_DEFAULT_LIBRARY	"libpvrWAYLAND_WSEGL.so"
+
+/*
+ * Function table entries we time
+ */
+#define BENCH_ENTRIES(X)		\
+	X(IsDisplayValid)		\
+	X(InitialiseDisplay)		\
+	X(CloseDisplay)			\
+	X(CreateWindowDrawable)		\
+	X(CreatePixmapDrawable)		\
+	X(DeleteDrawable)		\
+	X(SwapDrawableWithDamage)	\
+	X(SwapControlInterval)		\
+	X(WaitNative)			\
+	X(GetDrawableParameters)	\
+	X(GetImageParameters)		\
+	X(ConnectDrawable)		\
+	X(DisconnectDrawable)
+
+#define BENCH_ENTRY_ENUM(name)	BENCH_ENTRY_##name,
+#define BENCH_ENTRY_NAME(name)	"pfnWSEGL_" #name,
+
+enum {
+	BENCH_ENTRIES(BENCH_ENTRY_ENUM)
+	BENCH_NUM_ENTRIES
+};
+
+static const char *const bench_entry_names[] = {
+	BENCH_ENTRIES(BENCH_ENTRY_NAME)
+};
+
+enum {
+	BENCH_CLIENT,
+	BENCH_SERVER,
+	BENCH_NUM_SIDES
+};
+
+static const char *const bench_side_names[] = {
+	"client", "server"
+};
+
+struct bench_samples {
+	uint64_t	*ns;
+	size_t		count;
+	size_t		alloc;
+};
+
+struct bench_options {
+	const char		*library;
+	const char		*scenarios;
+	const char		*gbm_device;
+	const char		*resolutions;
+	const char		*rates;
+	unsigned int		iterations;
+	unsigned int		frames;
+	int			width;
+	int			height;
+	int			interval;
+	unsigned int		render_us;
+	unsigned int		resize_step;
+	unsigned int		damage_rects;
+	unsigned int		windows;
+	unsigned int		threads;
+	bool			serialise;
+	struct headless_config	config;
+	struct fake_gbm_schedule schedule;
+};
+
+struct bench_client {
+	struct wl_display	*display;
+	struct wl_registry	*registry;
+	struct wl_compositor	*compositor;
+	struct wl_surface	*surface;
+	struct wl_egl_window	*window;
+};
+
+struct bench {
+	struct bench_options		opts;
+
+	void				*lib;
+	const WSEGL_FunctionTable	*func;
+	PVRSRV_FENCE			(*fence_create)(unsigned int delay_us);
+	bool				(*fence_destroy)(PVRSRV_DEV_CONNECTION *connection,
+							 PVRSRV_FENCE fence);
+	bool				(*get_startup_profile)(WLWSStartupProfile *profile);
+	void				(*get_stub_stats)(struct pvrsrv_stub_stats *stats);
+	bool				(*get_memory_stats)(void *handle, WLWSMemoryStats *stats);
+
+	int				side;
+	struct bench_samples		samples[BENCH_NUM_SIDES][BENCH_NUM_ENTRIES];
+	pthread_mutex_t			record_lock;
+
+	/* taken around each swap with -L, as an EGL with a global lock would */
+	pthread_mutex_t			call_lock;
+
+	/* client side */
+	struct headless_compositor	*hc;
+	struct bench_client		client;
+
+	/* server side, a fake device unless -g is given */
+	int				gbm_fd;
+	struct gbm_device		*gbm;
+	bool				fake_gbm;
+
+	/* current display */
+	WSEGLDisplayHandle		display;
+	WSEGLConfig			*configs;
+};
+
+struct bench_scenario {
+	const char	*name;
+	int		side;
+	int		(*run)(struct bench *b);
+	const char	*description;
+};
+
+static uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_samples_add(struct bench_samples *s, uint64_t ns)
+{
+	if (s->count == s->alloc) {
+		size_t alloc = s->alloc ? s->alloc * 2 : 1024;
+		uint64_t *ns_new = realloc(s->ns, alloc * sizeof(*ns_new));
+
+		if (!ns_new)
+			return;
+		s->ns = ns_new;
+		s->alloc = alloc;
+	}
+	s->ns[s->count++] = ns;
+}
+
+static void bench_record(struct bench *b, int entry, uint64_t ns)
+{
+	pthread_mutex_lock(&b->record_lock);
+	bench_samples_add(&b->samples[b->side][entry], ns);
+	pthread_mutex_unlock(&b->record_lock);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile_us(const struct bench_samples *s, unsigned int pct)
+{
+	size_t idx = (s->count * pct + 99) / 100;
+
+	return s->ns[idx ? idx - 1 : 0] / 1e3;
+}
+
+/*
+ * Call through the function table and record the time spent
+ */
+#define BENCH_CALL(b, entry, ...)						\
+	({									\
+		uint64_t __start = bench_now_ns();				\
+		WSEGLError __err = (b)->func->pfnWSEGL_##entry(__VA_ARGS__);	\
+		bench_record((b), BENCH_ENTRY_##entry, bench_now_ns() - __start);	\
+		__err;								\
+	})
+
+/*
+ * Stand in for the GPU. The render starts once the dependency fence of the
+ * render target has signalled; its own fence signals render_us later.
+ */
+static PVRSRV_FENCE bench_render(struct bench *b, const WSEGLDrawableParams *render)
+{
+	unsigned int wait_us = 0;
+	PVRSRV_FENCE dependency = render->sBase.hFence;
+
+	if (dependency != PVRSRV_NO_FENCE) {
+		struct itimerspec its;
+
+		/* the fences of the stand-ins are timerfds */
+		if (!timerfd_gettime(dependency, &its))
+			wait_us = its.it_value.tv_sec * 1000000 + its.it_value.tv_nsec / 1000;
+
+		/* we own it, as the GL driver does */
+		if (b->fence_destroy)
+			b->fence_destroy(NULL, dependency);
+		else
+			close(dependency);
+	}
+
+	if (b->fence_create)
+		return b->fence_create(wait_us + b->opts.render_us);
+
+	if (wait_us + b->opts.render_us)
+		usleep(wait_us + b->opts.render_us);
+	return PVRSRV_NO_FENCE;
+}
+
+/*
+ * Client connection to the headless compositor
+ */
+
+static void registry_handle_global(void *data, struct wl_registry *registry,
+				   uint32_t name, const char *interface, uint32_t version)
+{
+	struct bench_client *client = data;
+
+	if (!strcmp(interface, "wl_compositor"))
+		client->compositor = wl_registry_bind(registry, name, &wl_compositor_interface,
+						      version < 4 ? version : 4);
+}
+
+static void registry_handle_global_remove(void *data, struct wl_registry *registry,
+					  uint32_t name)
+{
+	(void)data;
+	(void)registry;
+	(void)name;
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static int bench_client_init(struct bench *b)
+{
+	struct bench_client *client = &b->client;
+
+	memset(client, 0, sizeof(*client));
+
+	if (!(b->hc = headless_compositor_create(&b->opts.config)))
+		return -1;
+
+	if (!(client->display = headless_compositor_connect(b->hc)))
+		return -1;
+
+	client->registry = wl_display_get_registry(client->display);
+	wl_registry_add_listener(client->registry, &registry_listener, client);
+	wl_display_roundtrip(client->display);
+
+	if (!client->compositor)
+		return -1;
+
+	client->surface = wl_compositor_create_surface(client->compositor);
+	if (!(client->window = wl_egl_window_create(client->surface, b->opts.width, b->opts.height)))
+		return -1;
+
+	return 0;
+}
+
+static void bench_client_fini(struct bench *b)
+{
+	struct bench_client *client = &b->client;
+
+	if (client->window)
+		wl_egl_window_destroy(client->window);
+	if (client->surface)
+		wl_surface_destroy(client->surface);
+	if (client->compositor)
+		wl_compositor_destroy(client->compositor);
+	if (client->registry)
+		wl_registry_destroy(client->registry);
+	if (client->display)
+		wl_display_disconnect(client->display);
+	memset(client, 0, sizeof(*client));
+
+	headless_compositor_destroy(b->hc);
+	b->hc = NULL;
+}
+
+/*
+ * Server side GBM device
+ */
+
+static int bench_server_init(struct bench *b)
+{
+	if (!b->opts.gbm_device) {
+		b->fake_gbm = true;
+		return (b->gbm = fake_gbm_device_create()) ? 0 : -1;
+	}
+
+	if ((b->gbm_fd = open(b->opts.gbm_device, O_RDWR | O_CLOEXEC)) < 0)
+		return -1;
+
+	if (!(b->gbm = gbm_create_device(b->gbm_fd))) {
+		close(b->gbm_fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void bench_server_fini(struct bench *b)
+{
+	if (b->gbm) {
+		if (b->fake_gbm) {
+			fake_gbm_device_destroy(b->gbm);
+		} else {
+			gbm_device_destroy(b->gbm);
+			close(b->gbm_fd);
+		}
+	}
+	b->gbm = NULL;
+	b->fake_gbm = false;
+}
+
+static EGLNativeDisplayType bench_native_display(struct bench *b)
+{
+	if (b->side == BENCH_SERVER)
+		return (EGLNativeDisplayType)b->gbm;
+	return (EGLNativeDisplayType)b->client.display;
+}
+
+static int bench_open_display(struct bench *b)
+{
+	const WSEGLCaps *caps;
+	PVRSRV_DEV_CONNECTION *connection;
+
+	if (BENCH_CALL(b, IsDisplayValid, bench_native_display(b)) != WSEGL_SUCCESS)
+		return -1;
+
+	if (BENCH_CALL(b, InitialiseDisplay, bench_native_display(b), &b->display,
+		       &caps, &b->configs, &connection) != WSEGL_SUCCESS) {
+		fprintf(stderr, "%s: WSEGL_InitialiseDisplay failed\n", bench_side_names[b->side]);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void bench_close_display(struct bench *b)
+{
+	BENCH_CALL(b, CloseDisplay, b->display);
+	b->display = NULL;
+}
+
+/*
+ * Common helpers
+ */
+
+static int bench_swap(struct bench *b, WSEGLDrawableHandle drawable)
+{
+	WSEGLDrawableParams source, render;
+	WSEGLError err;
+
+	if ((err = BENCH_CALL(b, GetDrawableParameters, drawable, &source, &render)) != WSEGL_SUCCESS)
+		return err;
+
+	return BENCH_CALL(b, SwapDrawableWithDamage, drawable, NULL, 0, bench_render(b, &render));
+}
+
+static int bench_create_window(struct bench *b, EGLNativeWindowType window,
+			       WSEGLDrawableHandle *drawable)
+{
+	IMG_ROTATION rotation;
+
+	if (BENCH_CALL(b, CreateWindowDrawable, b->display, &b->configs[0], drawable,
+		       window, &rotation, 0, false) != WSEGL_SUCCESS) {
+		fprintf(stderr, "%s: WSEGL_CreateWindowDrawable failed\n", bench_side_names[b->side]);
+		return -1;
+	}
+
+	BENCH_CALL(b, ConnectDrawable, *drawable);
+	BENCH_CALL(b, SwapControlInterval, *drawable, b->opts.interval);
+
+	return 0;
+}
+
+static void bench_delete_window(struct bench *b, WSEGLDrawableHandle drawable)
+{
+	BENCH_CALL(b, DisconnectDrawable, drawable);
+	BENCH_CALL(b, DeleteDrawable, drawable);
+}
+
+/*
+ * Client scenarios
+ */
+
+static void bench_print_startup_profile(struct bench *b)
+{
+	static const char *const names[WLWS_STARTUP_NUM_PHASES] = {
+		"queue", "globals", "drm-open", "kms-auth", "formats", "kms-create", "pvr-connect"
+	};
+	WLWSStartupProfile profile;
+	int i;
+
+	if (!b->get_startup_profile || !b->get_startup_profile(&profile))
+		return;
+
+	printf("last startup: %.3f ms, %u round trips\n", profile.total_ns / 1e6, profile.roundtrips);
+	for (i = 0; i < WLWS_STARTUP_NUM_PHASES; i++) {
+		if (profile.phases[i].done)
+			printf("  %-12s @%8.3f ms %8.3f ms  rt %u\n", names[i],
+			       profile.phases[i].start_ns / 1e6, profile.phases[i].wall_ns / 1e6,
+			       profile.phases[i].roundtrips);
+	}
+}
+
+static int scenario_client_init(struct bench *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->opts.iterations; i++) {
+		if (bench_open_display(b))
+			return -1;
+		bench_close_display(b);
+	}
+
+	bench_print_startup_profile(b);
+
+	return 0;
+}
+
+static int scenario_client_window(struct bench *b)
+{
+	WSEGLDrawableHandle drawable;
+	unsigned int i;
+	int ret = -1;
+
+	if (bench_open_display(b))
+		return -1;
+
+	for (i = 0; i < b->opts.iterations; i++) {
+		if (bench_create_window(b, (EGLNativeWindowType)b->client.window, &drawable))
+			goto out;
+
+		/* a short-lived surface, e.g. a splash screen */
+		if (bench_swap(b, drawable) || bench_swap(b, drawable)) {
+			bench_delete_window(b, drawable);
+			goto out;
+		}
+
+		bench_delete_window(b, drawable);
+	}
+
+	ret = 0;
+out:
+	bench_close_display(b);
+	return ret;
+}
+
+static int scenario_client_swap(struct bench *b)
+{
+	struct headless_stats before, after;
+	WSEGLDrawableHandle drawable;
+	unsigned int i;
+	int ret = -1;
+
+	if (bench_open_display(b))
+		return -1;
+
+	if (bench_create_window(b, (EGLNativeWindowType)b->client.window, &drawable))
+		goto out;
+
+	headless_compositor_get_stats(b->hc, &before);
+	for (i = 0; i < b->opts.frames; i++) {
+		if (bench_swap(b, drawable)) {
+			fprintf(stderr, "client: swap failed at frame %u\n", i);
+			goto out_drawable;
+		}
+	}
+	headless_compositor_get_stats(b->hc, &after);
+
+	/* with swap interval N, one frame should be presented every N vsyncs */
+	printf("%u frames in %llu vsyncs: %llu presented, %llu replaced\n", i,
+	       (unsigned long long)(after.vsyncs - before.vsyncs),
+	       (unsigned long long)(after.presented - before.presented),
+	       (unsigned long long)(after.replaced - before.replaced));
+
+	ret = 0;
+out_drawable:
+	bench_delete_window(b, drawable);
+out:
+	bench_close_display(b);
+	return ret;
+}
+
+/*
+ * Damage storm, as a text view reflowing: half of the rectangles are glyph
+ * cells in runs along a few lines, the others small spots all over the
+ * window, with eglSwapBuffersWithDamage()
+ */
+
+static void bench_damage_rects(struct bench *b, unsigned int frame, EGLint *rects)
+{
+	unsigned int i, runs = b->opts.damage_rects / 2;
+	uint32_t seed = frame * 2654435761u + 1;
+
+	for (i = 0; i < b->opts.damage_rects; i++) {
+		EGLint *rect = &rects[i * 4];
+
+		seed = seed * 1103515245 + 12345;
+		if (i < runs) {
+			/* 8x16 cells, 64 to a line */
+			rect[0] = (i % 64) * 8;
+			rect[1] = b->opts.height - 16 * (1 + i / 64 + frame % 8);
+			rect[2] = 8;
+			rect[3] = 16;
+		} else {
+			rect[0] = (seed >> 8) % (b->opts.width - 4);
+			rect[1] = (seed >> 16) % (b->opts.height - 4);
+			rect[2] = 4;
+			rect[3] = 4;
+		}
+	}
+}
+
+/*
+ * Check the damage processing of the backend, which is built into the
+ * bench as well, against a raster of the buffer: what it returns has to
+ * lie within the buffer, keep to the cap, and cover every pixel that the
+ * EGL rectangles, clipped and flipped to a top left origin, cover.
+ */
+static int bench_damage_covers(const char *name, const EGLint *rects, int num_rects,
+			       int width, int height, int max_rects,
+			       int expect, const WLWSDamageRect *expect_rect)
+{
+	WLWSDamageRect out[WLWS_DAMAGE_MAX_RECTS];
+	unsigned char *raster;
+	int n, i, x, y, ret = -1;
+
+	n = wlws_damage_process(rects, num_rects, width, height, max_rects, out);
+	if (expect != -2 && n != expect) {
+		fprintf(stderr, "damage check %s: %d rects returned, %d expected\n", name, n, expect);
+		return -1;
+	}
+	if (expect_rect && (n < 1 || memcmp(&out[0], expect_rect, sizeof(*expect_rect)))) {
+		fprintf(stderr, "damage check %s: got %d,%d %dx%d, expected %d,%d %dx%d\n", name,
+			out[0].x, out[0].y, out[0].width, out[0].height, expect_rect->x,
+			expect_rect->y, expect_rect->width, expect_rect->height);
+		return -1;
+	}
+	if (n == WLWS_DAMAGE_FULL)
+		return 0;
+	if (n < 0 || n > max_rects) {
+		fprintf(stderr, "damage check %s: %d rects returned, cap %d\n", name, n, max_rects);
+		return -1;
+	}
+
+	if (!(raster = calloc((size_t)width * height, 1)))
+		return -1;
+
+	for (i = 0; i < num_rects; i++) {
+		const EGLint *r = &rects[i * 4];
+		int x1 = (r[0] < 0) ? 0 : r[0];
+		int x2 = (r[0] + r[2] > width) ? width : r[0] + r[2];
+		int y1 = (height - r[1] - r[3] < 0) ? 0 : height - r[1] - r[3];
+		int y2 = (height - r[1] > height) ? height : height - r[1];
+
+		for (y = y1; y < y2; y++)
+			for (x = x1; x < x2; x++)
+				raster[y * width + x] = 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (out[i].x < 0 || out[i].y < 0 || out[i].width <= 0 || out[i].height <= 0 ||
+		    out[i].x + out[i].width > width || out[i].y + out[i].height > height) {
+			fprintf(stderr, "damage check %s: rect %d (%d,%d %dx%d) outside %dx%d\n",
+				name, i, out[i].x, out[i].y, out[i].width, out[i].height,
+				width, height);
+			goto out;
+		}
+		for (y = out[i].y; y < out[i].y + out[i].height; y++)
+			for (x = out[i].x; x < out[i].x + out[i].width; x++)
+				raster[y * width + x] = 2;
+	}
+
+	for (i = 0; i < width * height; i++) {
+		if (raster[i] == 1) {
+			fprintf(stderr, "damage check %s: pixel %d,%d damaged but not sent\n",
+				name, i % width, i / width);
+			goto out;
+		}
+	}
+
+	ret = 0;
+out:
+	free(raster);
+	return ret;
+}
+
+static int bench_check_damage(struct bench *b, EGLint *rects)
+{
+	/* on a 64x48 buffer; EGL rectangles have their origin at the bottom left */
+	static const struct {
+		const char	*name;
+		int		num_rects;
+		EGLint		rects[8 * 4];
+		int		max_rects;
+		int		expect;
+		WLWSDamageRect	rect;
+	} cases[] = {
+		{ "flip", 1, { 0, 0, 10, 5 }, 16, 1, { 0, 43, 10, 5 } },
+		{ "clip", 1, { -5, -5, 20, 10 }, 16, 1, { 0, 43, 15, 5 } },
+		{ "outside", 1, { 100, 100, 10, 10 }, 16, 0, { 0 } },
+		{ "full", 1, { -1, -1, 70, 50 }, 16, WLWS_DAMAGE_FULL, { 0 } },
+		{ "full-halves", 2, { 0, 0, 64, 24, 0, 24, 64, 24 }, 16, WLWS_DAMAGE_FULL, { 0 } },
+		{ "strip", 8, { 0, 32, 8, 16, 8, 32, 8, 16, 16, 32, 8, 16, 24, 32, 8, 16,
+				32, 32, 8, 16, 40, 32, 8, 16, 48, 32, 8, 16, 56, 32, 8, 16 },
+		  16, 1, { 0, 0, 64, 16 } },
+		{ "overflow", 4, { 0, 0, 2, 2, 60, 0, 2, 2, 0, 40, 2, 2, 60, 40, 2, 2 },
+		  2, 1, { 0, 6, 62, 42 } },
+		{ "scattered", 4, { 0, 0, 2, 2, 60, 0, 2, 2, 0, 40, 2, 2, 60, 40, 2, 2 },
+		  16, 4, { 0 } },
+	};
+	static const int caps[] = { 1, 16, WLWS_DAMAGE_MAX_RECTS };
+	unsigned int i, j, frame;
+	char name[32];
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		if (bench_damage_covers(cases[i].name, cases[i].rects, cases[i].num_rects, 64, 48,
+					cases[i].max_rects, cases[i].expect,
+					(cases[i].expect > 0 && cases[i].rect.width) ?
+					&cases[i].rect : NULL))
+			return -1;
+	}
+
+	/* the damage of the first frames of the scenario, with any cap */
+	for (frame = 0; frame < 8; frame++) {
+		bench_damage_rects(b, frame, rects);
+		for (j = 0; j < sizeof(caps) / sizeof(caps[0]); j++) {
+			snprintf(name, sizeof(name), "frame %u cap %d", frame, caps[j]);
+			if (bench_damage_covers(name, rects, b->opts.damage_rects,
+						b->opts.width, b->opts.height, caps[j], -2, NULL))
+				return -1;
+		}
+	}
+
+	printf("damage check: %u cases and %u frames passed\n",
+	       (unsigned int)(sizeof(cases) / sizeof(cases[0])), frame);
+	return 0;
+}
+
+static int scenario_client_damage(struct bench *b)
+{
+	struct headless_stats before, after;
+	WSEGLDrawableParams source, render;
+	WSEGLDrawableHandle drawable;
+	EGLint *rects;
+	unsigned int i;
+	int ret = -1;
+
+	if (!(rects = calloc(b->opts.damage_rects, 4 * sizeof(EGLint))))
+		return -1;
+
+	if (bench_check_damage(b, rects))
+		goto out_free;
+
+	if (bench_open_display(b))
+		goto out_free;
+
+	if (bench_create_window(b, (EGLNativeWindowType)b->client.window, &drawable))
+		goto out;
+
+	headless_compositor_get_stats(b->hc, &before);
+	for (i = 0; i < b->opts.frames; i++) {
+		bench_damage_rects(b, i, rects);
+		if (BENCH_CALL(b, GetDrawableParameters, drawable, &source, &render) != WSEGL_SUCCESS ||
+		    BENCH_CALL(b, SwapDrawableWithDamage, drawable, rects, b->opts.damage_rects,
+			       bench_render(b, &render)) != WSEGL_SUCCESS) {
+			fprintf(stderr, "client: swap failed at frame %u\n", i);
+			goto out_drawable;
+		}
+	}
+	headless_compositor_get_stats(b->hc, &after);
+
+	printf("%u frames with %u damage rects: %.1f damage requests per commit\n",
+	       i, b->opts.damage_rects,
+	       (double)(after.damage_rects - before.damage_rects) /
+	       (after.commits - before.commits ? after.commits - before.commits : 1));
+
+	ret = 0;
+out_drawable:
+	bench_delete_window(b, drawable);
+out:
+	bench_close_display(b);
+out_free:
+	free(rects);
+	return ret;
+}
+
+static int scenario_client_pixmap(struct bench *b)
+{
+	EGLNativePixmapTypeREL pixmap;
+	WSEGLDrawableHandle drawable;
+	WSEGLImageParams params;
+	WSEGLDrawableParams source, render;
+	IMG_ROTATION rotation;
+	unsigned int i;
+	int ret = -1;
+
+	memset(&pixmap, 0, sizeof(pixmap));
+	pixmap.width = b->opts.width;
+	pixmap.height = b->opts.height;
+	pixmap.stride = b->opts.width;
+	pixmap.format = EGL_NATIVE_PIXFORMAT_ARGB8888_REL;
+	if (posix_memalign(&pixmap.pixelData, 4096, (size_t)pixmap.stride * pixmap.height * 4))
+		return -1;
+
+	if (bench_open_display(b))
+		goto out_free;
+
+	for (i = 0; i < b->opts.iterations; i++) {
+		if (BENCH_CALL(b, CreatePixmapDrawable, b->display, &b->configs[0], &drawable,
+			       (EGLNativePixmapType)&pixmap, &rotation, 0, false) != WSEGL_SUCCESS) {
+			fprintf(stderr, "client: WSEGL_CreatePixmapDrawable failed\n");
+			goto out;
+		}
+
+		BENCH_CALL(b, GetImageParameters, drawable, &params, 0);
+
+		/* the GL driver asks for these when rendering to the pixmap */
+		if (BENCH_CALL(b, GetDrawableParameters, drawable, &source,
+			       &render) != WSEGL_SUCCESS) {
+			fprintf(stderr, "client: WSEGL_GetDrawableParameters failed on a pixmap\n");
+			BENCH_CALL(b, DeleteDrawable, drawable);
+			goto out;
+		}
+
+		BENCH_CALL(b, DeleteDrawable, drawable);
+	}
+
+	ret = 0;
+out:
+	bench_close_display(b);
+out_free:
+	free(pixmap.pixelData);
+	return ret;
+}
+
+/*
+ * Resize storm, as an animated window resize: the size follows a triangle
+ * wave between half and full size, moving by -z pixels on every frame
+ */
+
+struct bench_alloc_counts {
+	uint64_t	bos_created;
+	uint64_t	prime_exports;
+	uint64_t	imports;
+	uint64_t	allocs;
+	uint64_t	device_maps;
+	uint64_t	live_bytes;
+};
+
+static void bench_get_alloc_counts(struct bench *b, struct bench_alloc_counts *counts)
+{
+	struct pvrsrv_stub_stats stats;
+
+	memset(counts, 0, sizeof(*counts));
+
+#if defined(PVRSRV_STUB)
+	{
+		struct kms_stub_stats kms;
+
+		kms_stub_get_stats(&kms);
+		counts->bos_created = kms.bos_created;
+		counts->prime_exports = kms.prime_exports;
+		counts->live_bytes = kms.bytes;
+	}
+#endif
+
+	if (b->get_stub_stats) {
+		b->get_stub_stats(&stats);
+		counts->imports = stats.calls[PVRSRV_STUB_DMABUF_IMPORT_DEV_MEM];
+		counts->allocs = stats.calls[PVRSRV_STUB_DMABUF_ALLOC_DEV_MEM];
+		counts->device_maps = stats.calls[PVRSRV_STUB_MAP_TO_DEVICE];
+	}
+}
+
+static void bench_resize_size(struct bench *b, unsigned int frame, int *width, int *height)
+{
+	int range = b->opts.width / 2;
+	int step = (int)((frame * b->opts.resize_step) % (2 * range));
+	int offset = step < range ? step : 2 * range - step;
+
+	*width = b->opts.width - offset;
+	*height = b->opts.height - offset * b->opts.height / b->opts.width;
+}
+
+static int scenario_client_resize(struct bench *b)
+{
+	struct bench_alloc_counts before, after, now;
+	struct bench_samples frame_times;
+	WLWSMemoryStats memory;
+	WSEGLDrawableHandle drawable;
+	struct rusage usage;
+	uint64_t peak_bytes = 0;
+	unsigned int i, recreated = 0;
+	int ret = -1;
+
+	memset(&frame_times, 0, sizeof(frame_times));
+
+	if (bench_open_display(b))
+		return -1;
+
+	if (bench_create_window(b, (EGLNativeWindowType)b->client.window, &drawable))
+		goto out;
+
+	bench_get_alloc_counts(b, &before);
+
+	for (i = 0; i < b->opts.frames; i++) {
+		uint64_t start = bench_now_ns();
+		int width, height;
+		WSEGLError err;
+
+		bench_resize_size(b, i + 1, &width, &height);
+		wl_egl_window_resize(b->client.window, width, height, 0, 0);
+
+		/* recreate the drawable on BAD_DRAWABLE as the IMG EGL does */
+		if ((err = bench_swap(b, drawable)) == WSEGL_BAD_DRAWABLE) {
+			bench_delete_window(b, drawable);
+			if (bench_create_window(b, (EGLNativeWindowType)b->client.window, &drawable))
+				goto out;
+			err = bench_swap(b, drawable);
+			recreated++;
+		}
+
+		if (err != WSEGL_SUCCESS) {
+			fprintf(stderr, "client: swap failed after resize %u\n", i);
+			goto out_drawable;
+		}
+
+		bench_samples_add(&frame_times, bench_now_ns() - start);
+
+		bench_get_alloc_counts(b, &now);
+		if (now.live_bytes > peak_bytes)
+			peak_bytes = now.live_bytes;
+	}
+
+	bench_get_alloc_counts(b, &after);
+
+	qsort(frame_times.ns, frame_times.count, sizeof(*frame_times.ns), compare_u64);
+	printf("%u resized frames, %u drawables recreated: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+	       i, recreated, percentile_us(&frame_times, 50), percentile_us(&frame_times, 99),
+	       frame_times.ns[frame_times.count - 1] / 1e3);
+	printf("per frame: %.2f kms bos, %.2f prime exports, %.2f imports, %.2f allocs, %.2f device maps\n",
+	       (double)(after.bos_created - before.bos_created) / i,
+	       (double)(after.prime_exports - before.prime_exports) / i,
+	       (double)(after.imports - before.imports) / i,
+	       (double)(after.allocs - before.allocs) / i,
+	       (double)(after.device_maps - before.device_maps) / i);
+
+	getrusage(RUSAGE_SELF, &usage);
+	printf("peak: %llu kms bytes, %ld KiB resident\n",
+	       (unsigned long long)peak_bytes, usage.ru_maxrss);
+
+	if (b->get_memory_stats && b->get_memory_stats(b->display, &memory)) {
+		printf("display: %llu bytes, %llu bytes peak\n",
+		       (unsigned long long)memory.total_bytes,
+		       (unsigned long long)memory.peak_bytes);
+
+#if defined(PVRSRV_STUB)
+		/* every live BO, once, whether a window or the pool holds it */
+		if (memory.total_bytes != after.live_bytes) {
+			fprintf(stderr, "client: display accounts %llu bytes, %llu bytes of BOs live\n",
+				(unsigned long long)memory.total_bytes,
+				(unsigned long long)after.live_bytes);
+			goto out_drawable;
+		}
+#endif
+	}
+
+	ret = 0;
+out_drawable:
+	bench_delete_window(b, drawable);
+out:
+	wl_egl_window_resize(b->client.window, b->opts.width, b->opts.height, 0, 0);
+	bench_close_display(b);
+	free(frame_times.ns);
+	return ret;
+}
+
+/*
+ * A window resized to half its size and back, as a popup would be closed
+ * and opened again: the buffers of the full size have to come out of the
+ * pool of the display on the way back.
+ */
+#define BENCH_RESIZE_BACK_ROUNDS	4
+
+static int bench_swap_frames(struct bench *b, WSEGLDrawableHandle drawable)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->opts.frames; i++) {
+		if (bench_swap(b, drawable) != WSEGL_SUCCESS) {
+			fprintf(stderr, "client: swap failed at frame %u\n", i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int scenario_client_resize_back(struct bench *b)
+{
+	struct bench_alloc_counts before, after;
+	WSEGLDrawableHandle drawable;
+	uint64_t first_bos, back_bos = 0;
+	unsigned int round;
+	int ret = -1;
+
+	if (bench_open_display(b))
+		return -1;
+
+	bench_get_alloc_counts(b, &before);
+	if (bench_create_window(b, (EGLNativeWindowType)b->client.window, &drawable))
+		goto out;
+	if (bench_swap_frames(b, drawable))
+		goto out_drawable;
+	bench_get_alloc_counts(b, &after);
+	first_bos = after.bos_created - before.bos_created;
+
+	for (round = 0; round < BENCH_RESIZE_BACK_ROUNDS; round++) {
+		wl_egl_window_resize(b->client.window, b->opts.width / 2, b->opts.height / 2, 0, 0);
+		if (bench_swap_frames(b, drawable))
+			goto out_drawable;
+
+		bench_get_alloc_counts(b, &before);
+		wl_egl_window_resize(b->client.window, b->opts.width, b->opts.height, 0, 0);
+		if (bench_swap_frames(b, drawable))
+			goto out_drawable;
+		bench_get_alloc_counts(b, &after);
+		back_bos += after.bos_created - before.bos_created;
+	}
+
+	printf("%u rounds: %llu BOs at first, %llu BOs allocated on the way back, "
+	       "%.1f per round\n", round, (unsigned long long)first_bos,
+	       (unsigned long long)back_bos, (double)back_bos / round);
+
+#if defined(PVRSRV_STUB)
+	/* without the pool, every round allocates as many as the first time */
+	if (!getenv("WSEGL_POOL_SIZE") && back_bos >= first_bos * round) {
+		fprintf(stderr, "client: no buffer taken from the pool on resizing back\n");
+		goto out_drawable;
+	}
+#endif
+
+	ret = 0;
+out_drawable:
+	bench_delete_window(b, drawable);
+out:
+	wl_egl_window_resize(b->client.window, b->opts.width, b->opts.height, 0, 0);
+	bench_close_display(b);
+	return ret;
+}
+
+/*
+ * Several windows of one display swapping from several threads. All windows
+ * share the display event queue, so the time each thread spends blocked in
+ * wl_display_dispatch_queue() is measured by interposing it.
+ */
+
+static __thread uint64_t bench_dispatch_ns;
+static __thread uint64_t bench_dispatch_calls;
+
+int wl_display_dispatch_queue(struct wl_display *display, struct wl_event_queue *queue)
+{
+	static int (*dispatch_queue)(struct wl_display *display, struct wl_event_queue *queue);
+	uint64_t start;
+	int ret;
+
+	if (!dispatch_queue)
+		dispatch_queue = dlsym(RTLD_NEXT, "wl_display_dispatch_queue");
+
+	start = bench_now_ns();
+	ret = dispatch_queue(display, queue);
+	bench_dispatch_ns += bench_now_ns() - start;
+	bench_dispatch_calls++;
+
+	return ret;
+}
+
+struct bench_window {
+	struct wl_surface	*surface;
+	struct wl_egl_window	*window;
+	WSEGLDrawableHandle	drawable;
+	struct bench_samples	frame_times;
+};
+
+struct bench_worker {
+	struct bench		*b;
+	pthread_t		thread;
+	unsigned int		index;
+	struct bench_window	*windows;
+	uint64_t		frames;
+	uint64_t		dispatch_ns;
+	uint64_t		dispatch_calls;
+	int			ret;
+};
+
+static void *bench_worker_main(void *data)
+{
+	struct bench_worker *worker = data;
+	struct bench *b = worker->b;
+	uint64_t *last;
+	unsigned int i, w;
+
+	if (!(last = calloc(b->opts.windows, sizeof(*last)))) {
+		worker->ret = -1;
+		return NULL;
+	}
+
+	for (i = 0; i < b->opts.frames; i++) {
+		/* the windows are dealt out to the threads round robin */
+		for (w = worker->index; w < b->opts.windows; w += b->opts.threads) {
+			struct bench_window *window = &worker->windows[w];
+			uint64_t now;
+			int err;
+
+			if (b->opts.serialise)
+				pthread_mutex_lock(&b->call_lock);
+			err = bench_swap(b, window->drawable);
+			if (b->opts.serialise)
+				pthread_mutex_unlock(&b->call_lock);
+
+			if (err) {
+				fprintf(stderr, "client: swap failed on window %u at frame %u\n", w, i);
+				worker->ret = -1;
+				goto out;
+			}
+
+			now = bench_now_ns();
+			if (last[w])
+				bench_samples_add(&window->frame_times, now - last[w]);
+			last[w] = now;
+			worker->frames++;
+		}
+	}
+
+out:
+	worker->dispatch_ns = bench_dispatch_ns;
+	worker->dispatch_calls = bench_dispatch_calls;
+	free(last);
+	return NULL;
+}
+
+static int scenario_client_multi(struct bench *b)
+{
+	struct bench_window *windows;
+	struct bench_worker *workers;
+	uint64_t start, wall_ns, frames = 0;
+	unsigned int i, created = 0, started = 0;
+	int ret = -1;
+
+	windows = calloc(b->opts.windows, sizeof(*windows));
+	workers = calloc(b->opts.threads, sizeof(*workers));
+	if (!windows || !workers)
+		goto out_free;
+
+	if (bench_open_display(b))
+		goto out_free;
+
+	for (created = 0; created < b->opts.windows; created++) {
+		struct bench_window *window = &windows[created];
+
+		window->surface = wl_compositor_create_surface(b->client.compositor);
+		if (!(window->window = wl_egl_window_create(window->surface, b->opts.width,
+							    b->opts.height))) {
+			wl_surface_destroy(window->surface);
+			goto out;
+		}
+
+		if (bench_create_window(b, (EGLNativeWindowType)window->window, &window->drawable)) {
+			wl_egl_window_destroy(window->window);
+			wl_surface_destroy(window->surface);
+			goto out;
+		}
+	}
+
+	start = bench_now_ns();
+	for (started = 0; started < b->opts.threads; started++) {
+		struct bench_worker *worker = &workers[started];
+
+		worker->b = b;
+		worker->index = started;
+		worker->windows = windows;
+		if (pthread_create(&worker->thread, NULL, bench_worker_main, worker))
+			break;
+	}
+
+	ret = (started == b->opts.threads) ? 0 : -1;
+	for (i = 0; i < started; i++) {
+		pthread_join(workers[i].thread, NULL);
+		frames += workers[i].frames;
+		if (workers[i].ret)
+			ret = -1;
+	}
+	wall_ns = bench_now_ns() - start;
+
+	printf("%u windows, %u threads%s: %llu frames in %.3f ms, %.1f frames/s\n",
+	       b->opts.windows, started, b->opts.serialise ? " (serialised)" : "",
+	       (unsigned long long)frames, wall_ns / 1e6, frames * 1e9 / wall_ns);
+
+	printf("%-8s %8s %10s %10s %10s %10s\n",
+	       "window", "frames", "p50(us)", "p99(us)", "max(us)", "jitter(us)");
+	for (i = 0; i < b->opts.windows; i++) {
+		struct bench_samples *s = &windows[i].frame_times;
+
+		if (!s->count)
+			continue;
+
+		qsort(s->ns, s->count, sizeof(*s->ns), compare_u64);
+		printf("%-8u %8zu %10.1f %10.1f %10.1f %10.1f\n", i, s->count + 1,
+		       percentile_us(s, 50), percentile_us(s, 99), s->ns[s->count - 1] / 1e3,
+		       percentile_us(s, 99) - percentile_us(s, 50));
+	}
+
+	printf("%-8s %8s %10s %10s %10s\n",
+	       "thread", "frames", "dispatch", "blocked(ms)", "of wall");
+	for (i = 0; i < started; i++) {
+		printf("%-8u %8llu %10llu %10.3f %9.1f%%\n", i,
+		       (unsigned long long)workers[i].frames,
+		       (unsigned long long)workers[i].dispatch_calls,
+		       workers[i].dispatch_ns / 1e6, workers[i].dispatch_ns * 100.0 / wall_ns);
+	}
+
+out:
+	for (i = 0; i < created; i++) {
+		bench_delete_window(b, windows[i].drawable);
+		wl_egl_window_destroy(windows[i].window);
+		wl_surface_destroy(windows[i].surface);
+		free(windows[i].frame_times.ns);
+	}
+	bench_close_display(b);
+out_free:
+	free(windows);
+	free(workers);
+	return ret;
+}
+
+/*
+ * Pixmap import churn, as a camera or video pipeline wrapping every frame in
+ * an EGLImage and destroying it again a few frames later
+ */
+
+#define BENCH_CHURN_DEPTH	4	/* images in flight */
+
+struct bench_pixmap_format {
+	const char	*name;
+	int		format;
+	int		bpp;
+};
+
+static const struct bench_pixmap_format bench_pixmap_formats[] = {
+	{ "RGB565",	EGL_NATIVE_PIXFORMAT_RGB565_REL,	16 },
+	{ "ARGB1555",	EGL_NATIVE_PIXFORMAT_ARGB1555_REL,	16 },
+	{ "ARGB4444",	EGL_NATIVE_PIXFORMAT_ARGB4444_REL,	16 },
+	{ "ARGB8888",	EGL_NATIVE_PIXFORMAT_ARGB8888_REL,	32 },
+	{ "YUYV",	EGL_NATIVE_PIXFORMAT_YUYV_REL,		16 },
+	{ "UYVY",	EGL_NATIVE_PIXFORMAT_UYVY_REL,		16 },
+	{ "VYUY",	EGL_NATIVE_PIXFORMAT_VYUY_REL,		16 },
+	{ "YVYU",	EGL_NATIVE_PIXFORMAT_YVYU_REL,		16 },
+	{ "NV12",	EGL_NATIVE_PIXFORMAT_NV12_REL,		12 },
+	{ "NV21",	EGL_NATIVE_PIXFORMAT_NV21_REL,		12 },
+	{ "I420",	EGL_NATIVE_PIXFORMAT_I420_REL,		12 },
+	{ "YV12",	EGL_NATIVE_PIXFORMAT_YV12_REL,		12 },
+	{ "NV16",	EGL_NATIVE_PIXFORMAT_NV16_REL,		16 },
+};
+
+#define BENCH_NUM_PIXMAP_FORMATS	(sizeof(bench_pixmap_formats) / sizeof(bench_pixmap_formats[0]))
+
+/* live memory descriptors and device mappings, only known with the stub */
+static int bench_live_mappings(struct bench *b, int *memdescs, int *device_mappings)
+{
+	struct pvrsrv_stub_stats stats;
+
+	if (!b->get_stub_stats)
+		return -1;
+
+	b->get_stub_stats(&stats);
+	*memdescs = stats.memdescs;
+	*device_mappings = stats.device_mappings;
+	return 0;
+}
+
+static const char *bench_next_item(const char *list)
+{
+	const char *comma = strchr(list, ',');
+
+	return comma ? comma + 1 : NULL;
+}
+
+static int bench_churn_one(struct bench *b, const struct bench_pixmap_format *fmt,
+			   int width, int height, unsigned int fps)
+{
+	EGLNativePixmapTypeREL pixmaps[BENCH_CHURN_DEPTH];
+	WSEGLDrawableHandle live[BENCH_CHURN_DEPTH];
+	struct bench_samples import, release;
+	WSEGLImageParams params;
+	IMG_ROTATION rotation;
+	struct timespec deadline;
+	uint64_t next, period = 1000000000ULL / fps;
+	size_t size = (size_t)width * height * fmt->bpp / 8;
+	int base_memdescs = 0, base_mappings = 0, memdescs, mappings;
+	int max_memdescs = 0, max_mappings = 0;
+	unsigned int i, slot;
+	int ret = -1;
+
+	memset(pixmaps, 0, sizeof(pixmaps));
+	memset(live, 0, sizeof(live));
+	memset(&import, 0, sizeof(import));
+	memset(&release, 0, sizeof(release));
+
+	/* the pipeline recycles a small pool of frame buffers */
+	for (slot = 0; slot < BENCH_CHURN_DEPTH; slot++) {
+		pixmaps[slot].width = width;
+		pixmaps[slot].height = height;
+		pixmaps[slot].stride = width;
+		pixmaps[slot].format = fmt->format;
+		if (posix_memalign(&pixmaps[slot].pixelData, 4096, size)) {
+			pixmaps[slot].pixelData = NULL;
+			goto out;
+		}
+	}
+
+	bench_live_mappings(b, &base_memdescs, &base_mappings);
+
+	next = bench_now_ns();
+	for (i = 0; i < b->opts.iterations; i++) {
+		uint64_t start;
+
+		slot = i % BENCH_CHURN_DEPTH;
+
+		if (live[slot]) {
+			start = bench_now_ns();
+			BENCH_CALL(b, DeleteDrawable, live[slot]);
+			bench_samples_add(&release, bench_now_ns() - start);
+			live[slot] = NULL;
+		}
+
+		start = bench_now_ns();
+		if (BENCH_CALL(b, CreatePixmapDrawable, b->display, &b->configs[0], &live[slot],
+			       (EGLNativePixmapType)&pixmaps[slot], &rotation, 0, false) != WSEGL_SUCCESS) {
+			fprintf(stderr, "client: WSEGL_CreatePixmapDrawable failed for %s %dx%d\n",
+				fmt->name, width, height);
+			live[slot] = NULL;
+			goto out;
+		}
+		BENCH_CALL(b, GetImageParameters, live[slot], &params, 0);
+		bench_samples_add(&import, bench_now_ns() - start);
+
+		if (!bench_live_mappings(b, &memdescs, &mappings)) {
+			if (memdescs - base_memdescs > max_memdescs)
+				max_memdescs = memdescs - base_memdescs;
+			if (mappings - base_mappings > max_mappings)
+				max_mappings = mappings - base_mappings;
+		}
+
+		next += period;
+		deadline.tv_sec = next / 1000000000ULL;
+		deadline.tv_nsec = next % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+	}
+
+	ret = 0;
+out:
+	for (slot = 0; slot < BENCH_CHURN_DEPTH; slot++) {
+		if (live[slot])
+			BENCH_CALL(b, DeleteDrawable, live[slot]);
+		free(pixmaps[slot].pixelData);
+	}
+
+	if (!ret && import.count) {
+		qsort(import.ns, import.count, sizeof(*import.ns), compare_u64);
+		if (release.count)
+			qsort(release.ns, release.count, sizeof(*release.ns), compare_u64);
+
+		printf("%-9s %5dx%-5d %4u %10.1f %10.1f %10.1f",
+		       fmt->name, width, height, fps,
+		       percentile_us(&import, 50), percentile_us(&import, 99),
+		       release.count ? percentile_us(&release, 50) : 0.0);
+
+		/* whatever is still live once all images are gone has leaked */
+		if (!bench_live_mappings(b, &memdescs, &mappings))
+			printf(" %6d %6d %6d\n", max_memdescs, max_mappings, memdescs - base_memdescs);
+		else
+			printf(" %6s %6s %6s\n", "-", "-", "-");
+	}
+
+	free(import.ns);
+	free(release.ns);
+	return ret;
+}
+
+static int scenario_client_pixmap_churn(struct bench *b)
+{
+	const char *res, *rate;
+	unsigned int i;
+	int ret = 0;
+
+	if (bench_open_display(b))
+		return -1;
+
+	printf("%-9s %11s %4s %10s %10s %10s %6s %6s %6s\n",
+	       "format", "size", "fps", "p50(us)", "p99(us)", "del(us)", "mdesc", "dmap", "leak");
+
+	for (i = 0; i < BENCH_NUM_PIXMAP_FORMATS; i++) {
+		for (res = b->opts.resolutions; res; res = bench_next_item(res)) {
+			int width, height;
+
+			if (sscanf(res, "%dx%d", &width, &height) != 2) {
+				fprintf(stderr, "client: bad pixmap size '%s'\n", res);
+				ret = -1;
+				goto out;
+			}
+
+			for (rate = b->opts.rates; rate; rate = bench_next_item(rate)) {
+				unsigned int fps = strtoul(rate, NULL, 0);
+
+				if (!fps)
+					continue;
+				if (bench_churn_one(b, &bench_pixmap_formats[i], width, height, fps))
+					ret = -1;
+			}
+		}
+	}
+
+out:
+	bench_close_display(b);
+	return ret;
+}
+
+/*
+ * The compositor stops releasing buffers and sending frame callbacks, as
+ * for a minimized surface, until the backend gives up with WSEGL_RETRY.
+ * Unless set otherwise, the dequeue timeout is 50ms.
+ */
+static int scenario_client_hold(struct bench *b)
+{
+	WSEGLDrawableHandle drawable;
+	uint64_t start, held = 0, retry_ns = 0;
+	unsigned int i, retries = 0;
+	WSEGLError err;
+	int ret = -1;
+
+	setenv("WSEGL_DEQUEUE_TIMEOUT", "50", 0);
+
+	if (bench_open_display(b))
+		return -1;
+
+	if (bench_create_window(b, (EGLNativeWindowType)b->client.window, &drawable))
+		goto out;
+
+	for (i = 0; i < 10; i++) {
+		if (bench_swap(b, drawable))
+			goto out_drawable;
+	}
+
+	headless_compositor_set_hold(b->hc, true);
+	start = bench_now_ns();
+	for (i = 0; i < b->opts.frames; i++) {
+		uint64_t t = bench_now_ns();
+
+		if ((err = bench_swap(b, drawable)) == WSEGL_RETRY) {
+			retry_ns = bench_now_ns() - t;
+			held = bench_now_ns() - start;
+			break;
+		}
+		if (err != WSEGL_SUCCESS)
+			break;
+	}
+	headless_compositor_set_hold(b->hc, false);
+
+	if (!retry_ns) {
+		fprintf(stderr, "client: no WSEGL_RETRY after %u held frames\n", i);
+		goto out_drawable;
+	}
+
+	/* the render loop carries on once the compositor releases again */
+	while ((err = bench_swap(b, drawable)) == WSEGL_RETRY)
+		retries++;
+	if (err != WSEGL_SUCCESS) {
+		fprintf(stderr, "client: swap failed after the hold\n");
+		goto out_drawable;
+	}
+
+	printf("WSEGL_RETRY after %u held frames in %.1f ms, the failing call took %.1f ms, "
+	       "%u retries to recover\n", i, held / 1e6, retry_ns / 1e6, retries);
+
+	ret = 0;
+out_drawable:
+	bench_delete_window(b, drawable);
+out:
+	bench_close_display(b);
+	return ret;
+}
+
+/*
+ * Server scenarios
+ */
+
+static struct gbm_surface *bench_gbm_surface_create(struct bench *b, int width, int height)
+{
+	if (b->fake_gbm)
+		return fake_gbm_surface_create(b->gbm, width, height, GBM_FORMAT_ARGB8888,
+					       &b->opts.schedule);
+
+	return gbm_surface_create(b->gbm, width, height, GBM_FORMAT_ARGB8888,
+				  GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+}
+
+static void bench_gbm_surface_destroy(struct bench *b, struct gbm_surface *surface,
+				      struct gbm_bo *locked)
+{
+	if (b->fake_gbm) {
+		fake_gbm_surface_destroy(surface);
+		return;
+	}
+
+	if (locked)
+		gbm_surface_release_buffer(surface, locked);
+	gbm_surface_destroy(surface);
+}
+
+/*
+ * Swap, then do what a compositor does after queueing a page flip
+ */
+static int bench_server_swap(struct bench *b, struct gbm_surface *surface,
+			     WSEGLDrawableHandle drawable, struct gbm_bo **locked)
+{
+	struct gbm_bo *bo;
+	int err;
+
+	if (b->fake_gbm)
+		fake_gbm_surface_tick(surface);
+
+	if ((err = bench_swap(b, drawable)))
+		return err;
+
+	if (b->fake_gbm) {
+		fake_gbm_surface_page_flip(surface);
+		return 0;
+	}
+
+	bo = gbm_surface_lock_front_buffer(surface);
+	if (*locked)
+		gbm_surface_release_buffer(surface, *locked);
+	*locked = bo;
+
+	return 0;
+}
+
+static int scenario_server_init(struct bench *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->opts.iterations; i++) {
+		if (bench_open_display(b))
+			return -1;
+		bench_close_display(b);
+	}
+
+	return 0;
+}
+
+static int scenario_server_swap(struct bench *b)
+{
+	struct gbm_surface *surface;
+	struct gbm_bo *locked = NULL;
+	WSEGLDrawableHandle drawable;
+	unsigned int i;
+	int ret = -1;
+
+	if (bench_open_display(b))
+		return -1;
+
+	if (!(surface = bench_gbm_surface_create(b, b->opts.width, b->opts.height)))
+		goto out;
+
+	if (bench_create_window(b, (EGLNativeWindowType)surface, &drawable))
+		goto out_surface;
+
+	for (i = 0; i < b->opts.frames; i++) {
+		if (bench_server_swap(b, surface, drawable, &locked)) {
+			fprintf(stderr, "server: swap failed at frame %u\n", i);
+			goto out_drawable;
+		}
+	}
+
+	ret = 0;
+out_drawable:
+	bench_delete_window(b, drawable);
+out_surface:
+	bench_gbm_surface_destroy(b, surface, locked);
+out:
+	bench_close_display(b);
+	return ret;
+}
+
+/*
+ * Index of the BO the server backend hands out for rendering
+ */
+struct bench_bo_cache {
+	PVRSRV_MEMDESC	memdesc;
+	int		index;
+};
+
+static int bench_render_bo_index(struct bench *b, WSEGLDrawableHandle drawable,
+				 PVRSRV_MEMDESC memdesc, struct bench_bo_cache *cache, int size)
+{
+	void *addr;
+	int i, index;
+
+	for (i = 0; i < size && cache[i].memdesc; i++) {
+		if (cache[i].memdesc == memdesc)
+			return cache[i].index;
+	}
+
+	/* not timed, this is only done once per BO */
+	if (b->func->pfnWSEGL_AcquireCPUMapping(drawable, memdesc, &addr) != WSEGL_SUCCESS)
+		return -1;
+	index = fake_gbm_bo_index(addr);
+	b->func->pfnWSEGL_ReleaseCPUMapping(drawable, memdesc);
+
+	if (i < size) {
+		cache[i].memdesc = memdesc;
+		cache[i].index = index;
+	}
+
+	return index;
+}
+
+static int scenario_server_lock(struct bench *b)
+{
+	struct bench_bo_cache cache[4];
+	struct gbm_surface *surface;
+	struct gbm_kms_surface *kms_surface;
+	struct fake_gbm_stats stats;
+	WSEGLDrawableHandle drawable;
+	WSEGLDrawableParams source, render;
+	unsigned int i, locked_renders = 0, front_renders = 0;
+	int ret = -1;
+
+	if (!b->fake_gbm) {
+		printf("server-lock needs the fake GBM device, i.e. no -g\n");
+		return 0;
+	}
+
+	memset(cache, 0, sizeof(cache));
+
+	if (bench_open_display(b))
+		return -1;
+
+	if (!(surface = bench_gbm_surface_create(b, b->opts.width, b->opts.height)))
+		goto out;
+	kms_surface = gbm_kms_surface(surface);
+
+	if (bench_create_window(b, (EGLNativeWindowType)surface, &drawable))
+		goto out_surface;
+
+	for (i = 0; i < b->opts.frames; i++) {
+		int index;
+
+		fake_gbm_surface_tick(surface);
+
+		if (BENCH_CALL(b, GetDrawableParameters, drawable, &source, &render) != WSEGL_SUCCESS)
+			goto out_drawable;
+
+		index = bench_render_bo_index(b, drawable, render.sBase.ahMemDesc[0], cache, 4);
+		if (index < 0) {
+			fprintf(stderr, "server: can't identify the render target\n");
+			goto out_drawable;
+		}
+		if (fake_gbm_surface_is_locked(surface, index))
+			locked_renders++;
+		if (gbm_kms_get_front(kms_surface) == index)
+			front_renders++;
+
+		if (BENCH_CALL(b, SwapDrawableWithDamage, drawable, NULL, 0, bench_render(b, &render)) != WSEGL_SUCCESS)
+			goto out_drawable;
+
+		fake_gbm_surface_page_flip(surface);
+	}
+
+	fake_gbm_surface_get_stats(surface, &stats);
+	printf("server-lock: %u frames, flip %u us, v4l2 every %u: "
+	       "%u renders into a locked BO, %u into the front BO "
+	       "(%llu flips, %llu v4l2 frames)\n",
+	       b->opts.frames, b->opts.schedule.flip_us, b->opts.schedule.v4l2_every,
+	       locked_renders, front_renders,
+	       (unsigned long long)stats.flips, (unsigned long long)stats.v4l2_frames);
+
+	ret = 0;
+out_drawable:
+	bench_delete_window(b, drawable);
+out_surface:
+	bench_gbm_surface_destroy(b, surface, NULL);
+out:
+	bench_close_display(b);
+	return ret;
+}
+
+static int scenario_server_resize(struct bench *b)
+{
+	unsigned int i;
+
+	if (bench_open_display(b))
+		return -1;
+
+	/* a compositor output mode change: new gbm_surface, new drawable */
+	for (i = 0; i < b->opts.iterations; i++) {
+		int shrink = (i & 1) ? 0 : 16;
+		struct gbm_surface *surface;
+		struct gbm_bo *locked = NULL;
+		WSEGLDrawableHandle drawable;
+		int err;
+
+		if (!(surface = bench_gbm_surface_create(b, b->opts.width - shrink,
+							 b->opts.height - shrink)))
+			break;
+
+		if (bench_create_window(b, (EGLNativeWindowType)surface, &drawable)) {
+			bench_gbm_surface_destroy(b, surface, NULL);
+			break;
+		}
+
+		err = bench_server_swap(b, surface, drawable, &locked);
+
+		bench_delete_window(b, drawable);
+		bench_gbm_surface_destroy(b, surface, locked);
+
+		if (err)
+			break;
+	}
+
+	bench_close_display(b);
+	return (i == b->opts.iterations) ? 0 : -1;
+}
+
+static const struct bench_scenario bench_scenarios[] = {
+	{ "init",		BENCH_CLIENT, scenario_client_init,
+	  "InitialiseDisplay/CloseDisplay" },
+	{ "window",		BENCH_CLIENT, scenario_client_window,
+	  "CreateWindowDrawable, two swaps, DeleteDrawable" },
+	{ "swap",		BENCH_CLIENT, scenario_client_swap,
+	  "swap loop of -f frames" },
+	{ "damage",		BENCH_CLIENT, scenario_client_damage,
+	  "swap -f frames with -a damage rectangles each" },
+	{ "pixmap",		BENCH_CLIENT, scenario_client_pixmap,
+	  "CreatePixmapDrawable/GetImageParameters/GetDrawableParameters/DeleteDrawable" },
+	{ "resize",		BENCH_CLIENT, scenario_client_resize,
+	  "resize the window on every frame, by -z pixels, for -f frames" },
+	{ "resize-back",	BENCH_CLIENT, scenario_client_resize_back,
+	  "resize the window to half size and back, -f frames at each" },
+	{ "multi",		BENCH_CLIENT, scenario_client_multi,
+	  "-w windows swapping -f frames each from -j threads" },
+	{ "pixmap-churn",	BENCH_CLIENT, scenario_client_pixmap_churn,
+	  "one pixmap per frame for all REL formats, -R sizes and -p rates" },
+	{ "hold",		BENCH_CLIENT, scenario_client_hold,
+	  "swap into a compositor holding all buffers until WSEGL_RETRY" },
+	{ "server-init",	BENCH_SERVER, scenario_server_init,
+	  "InitialiseDisplay/CloseDisplay" },
+	{ "server-swap",	BENCH_SERVER, scenario_server_swap,
+	  "swap loop of -f frames on a gbm_surface" },
+	{ "server-lock",	BENCH_SERVER, scenario_server_lock,
+	  "swap loop against the front buffer lock schedule of -F/-V" },
+	{ "server-resize",	BENCH_SERVER, scenario_server_resize,
+	  "recreate the gbm_surface on every frame" },
+};
+
+#define BENCH_NUM_SCENARIOS	(sizeof(bench_scenarios) / sizeof(bench_scenarios[0]))
+
+static int bench_scenario_selected(struct bench *b, const char *name)
+{
+	const char *p = b->opts.scenarios;
+	size_t len = strlen(name);
+
+	if (!p)
+		return 1;
+
+	while (*p) {
+		if (!strncmp(p, name, len) && (p[len] == ',' || p[len] == '\0'))
+			return 1;
+		if (!(p = strchr(p, ',')))
+			break;
+		p++;
+	}
+
+	return 0;
+}
+
+/*
+ * Report
+ */
+
+static void bench_report(struct bench *b)
+{
+	int side, entry;
+
+	printf("%-6s %-30s %10s %10s %10s %10s %10s\n",
+	       "side", "entry", "calls", "p50(us)", "p99(us)", "max(us)", "avg(us)");
+
+	for (side = 0; side < BENCH_NUM_SIDES; side++) {
+		for (entry = 0; entry < BENCH_NUM_ENTRIES; entry++) {
+			struct bench_samples *s = &b->samples[side][entry];
+			uint64_t total = 0;
+			size_t i;
+
+			if (!s->count)
+				continue;
+
+			qsort(s->ns, s->count, sizeof(*s->ns), compare_u64);
+			for (i = 0; i < s->count; i++)
+				total += s->ns[i];
+
+			printf("%-6s %-30s %10zu %10.1f %10.1f %10.1f %10.1f\n",
+			       bench_side_names[side], bench_entry_names[entry], s->count,
+			       percentile_us(s, 50), percentile_us(s, 99),
+			       s->ns[s->count - 1] / 1e3, total / 1e3 / s->count);
+		}
+	}
+
+#if defined(PVRSRV_STUB)
+	{
+		struct kms_stub_stats kms;
+
+		kms_stub_get_stats(&kms);
+		printf("\nkms bos: %llu created, %d live, %llu bytes peak\n",
+		       (unsigned long long)kms.bos_created, kms.bos,
+		       (unsigned long long)kms.bytes_peak);
+	}
+#endif
+}
+
+static int bench_load(struct bench *b)
+{
+	const WSEGL_FunctionTable *(*get_table)(void);
+
+	if (!(b->lib = dlopen(b->opts.library, RTLD_NOW | RTLD_LOCAL))) {
+		fprintf(stderr, "%s\n", dlerror());
+		return -1;
+	}
+
+	if (!(get_table = dlsym(b->lib, "WSEGL_GetFunctionTablePointer"))) {
+		fprintf(stderr, "%s\n", dlerror());
+		return -1;
+	}
+
+	if (!(b->func = get_table()) || b->func->ui32WSEGLVersion != WSEGL_VERSION) {
+		fprintf(stderr, "%s: WSEGL version mismatch\n", b->opts.library);
+		return -1;
+	}
+
+	/* only present if linked against the libsrv_um stand-in */
+	b->fence_create = dlsym(b->lib, "pvrsrv_stub_fence_create");
+	b->fence_destroy = dlsym(b->lib, "PVRSRVFenceDestroyExt");
+
+	b->get_startup_profile = dlsym(b->lib, "WSEGL_GetStartupProfile");
+	b->get_stub_stats = dlsym(b->lib, "pvrsrv_stub_get_stats");
+	b->get_memory_stats = dlsym(b->lib, "WSEGL_GetMemoryStats");
+
+	return 0;
+}
+
+static int bench_run(struct bench *b)
+{
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; i < BENCH_NUM_SCENARIOS; i++) {
+		const struct bench_scenario *scenario = &bench_scenarios[i];
+		uint64_t start;
+		int err;
+
+		if (!bench_scenario_selected(b, scenario->name))
+			continue;
+
+		b->side = scenario->side;
+
+		if (b->side == BENCH_SERVER) {
+			if (bench_server_init(b)) {
+				fprintf(stderr, "%s: can't open the GBM device\n", scenario->name);
+				ret = -1;
+				continue;
+			}
+		} else if (bench_client_init(b)) {
+			fprintf(stderr, "%s: can't connect to the compositor\n", scenario->name);
+			bench_client_fini(b);
+			ret = -1;
+			continue;
+		}
+
+		start = bench_now_ns();
+		err = scenario->run(b);
+		printf("%-14s %s in %.3f ms\n", scenario->name,
+		       err ? "FAILED" : "done", (bench_now_ns() - start) / 1e6);
+		if (err)
+			ret = -1;
+
+		if (b->side == BENCH_SERVER)
+			bench_server_fini(b);
+		else
+			bench_client_fini(b);
+	}
+
+	printf("\n");
+	bench_report(b);
+
+	return ret;
+}
+
+static void usage(const char *name)
+{
+	unsigned int i;
+
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -l <path>       WSEGL library (default " BENCH_DEFAULT_LIBRARY ")\n"
+		"  -S <list>       comma separated scenarios (default all)\n"
+		"  -g <device>     DRM device for the server scenarios (default fake GBM)\n"
+		"  -F <usec>       fake GBM: page flip time, i.e. lock to release (default 0)\n"
+		"  -V <n>          fake GBM: v4l2-renderer composes every n-th frame\n"
+		"  -n <count>      iterations for create/delete scenarios (default 100)\n"
+		"  -R <list>       pixmap-churn sizes (default 640x480,1280x720,1920x1080)\n"
+		"  -p <list>       pixmap-churn frame rates (default 30,60,120)\n"
+		"  -f <frames>     frames for swap loops (default 600)\n"
+		"  -s <w>x<h>      window size (default 1920x1080)\n"
+		"  -i <interval>   swap interval (default 1)\n"
+		"  -t <usec>       simulated render time (default 0)\n"
+		"  -z <pixels>     resize: size change per frame (default 8)\n"
+		"  -a <n>          damage: rectangles per frame (default 256)\n"
+		"  -w <n>          multi: number of windows (default 4)\n"
+		"  -j <n>          multi: number of threads (default 2)\n"
+		"  -L              multi: serialise the swaps with a global lock\n"
+		"  -r <usec>       vsync period, 0 for no vsync (default 16667)\n"
+		"  -d <usec>       buffer release delay (default 0)\n"
+		"  -D <n>          defer every n-th frame callback by one vsync\n"
+		"  -k              advertise wl_kms only\n"
+		"  -b              advertise zwp_linux_dmabuf_v1 only\n"
+		"  -P              do not advertise wp_presentation\n"
+		"\nScenarios:\n",
+		name);
+
+	for (i = 0; i < BENCH_NUM_SCENARIOS; i++)
+		fprintf(stderr, "  %-14s %s\n", bench_scenarios[i].name, bench_scenarios[i].description);
+}
+
+int main(int argc, char **argv)
+{
+	static struct bench b;
+	int c, ret;
+
+	b.opts.library = BENCH_DEFAULT_LIBRARY;
+	b.opts.iterations = 100;
+	b.opts.resolutions = "640x480,1280x720,1920x1080";
+	b.opts.rates = "30,60,120";
+	b.opts.frames = 600;
+	b.opts.width = 1920;
+	b.opts.height = 1080;
+	b.opts.interval = 1;
+	b.opts.resize_step = 8;
+	b.opts.damage_rects = 256;
+	b.opts.windows = 4;
+	b.opts.threads = 2;
+	headless_compositor_default_config(&b.opts.config);
+
+	while ((c = getopt(argc, argv, "l:S:g:F:V:n:R:p:f:s:i:t:z:a:w:j:Lr:d:D:kbPh")) != -1) {
+		switch (c) {
+		case 'l':
+			b.opts.library = optarg;
+			break;
+		case 'S':
+			b.opts.scenarios = optarg;
+			break;
+		case 'g':
+			b.opts.gbm_device = optarg;
+			break;
+		case 'F':
+			b.opts.schedule.flip_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'V':
+			b.opts.schedule.v4l2_every = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			b.opts.iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'R':
+			b.opts.resolutions = optarg;
+			break;
+		case 'p':
+			b.opts.rates = optarg;
+			break;
+		case 'f':
+			b.opts.frames = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			if (sscanf(optarg, "%dx%d", &b.opts.width, &b.opts.height) != 2) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'i':
+			b.opts.interval = strtol(optarg, NULL, 0);
+			break;
+		case 't':
+			b.opts.render_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			b.opts.resize_step = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			b.opts.damage_rects = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			b.opts.windows = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			b.opts.threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'L':
+			b.opts.serialise = true;
+			break;
+		case 'r':
+			b.opts.config.refresh_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			b.opts.config.release_delay_us = strtoul(optarg, NULL, 0);
+			break;
+		case 'D':
+			b.opts.config.defer_frame_callback_every = strtoul(optarg, NULL, 0);
+			break;
+		case 'k':
+			b.opts.config.enable_dmabuf = false;
+			break;
+		case 'b':
+			b.opts.config.enable_wl_kms = false;
+			break;
+		case 'P':
+			b.opts.config.enable_presentation = false;
+			break;
+		default:
+			usage(argv[0]);
+			return (c == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!b.opts.iterations || !b.opts.frames || !b.opts.resize_step ||
+	    !b.opts.damage_rects || !b.opts.windows || !b.opts.threads ||
+	    b.opts.width <= 32 || b.opts.height <= 32) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	pthread_mutex_init(&b.record_lock, NULL);
+	pthread_mutex_init(&b.call_lock, NULL);
+
+	if (bench_load(&b))
+		return EXIT_FAILURE;
+
+	ret = bench_run(&b);
+
+	dlclose(b.lib);
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
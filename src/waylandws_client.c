@@ -33,6 +33,8 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include <xf86drm.h>
 #include <drm_fourcc.h>
@@ -50,8 +52,15 @@
 #include "wayland-kms.h"
 
 #include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "linux-explicit-synchronization-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
 
 #include "waylandws_pvr.h"
+#include "waylandws_profile.h"
+#include "waylandws_memory.h"
+#include "waylandws_timeline.h"
+#include "waylandws_damage.h"
+#include "waylandws_trace.h"
 
 #include "EGL/egl.h"
 #include "EGL/eglext_REL.h"
@@ -73,6 +82,104 @@ const char *PVRCONF_NUM_BUFFERS = "WseglNumBuffers";
 const char *ENV_ENABLE_AGGRESSIVE_SYNC = "WSEGL_ENABLE_AGGRESSIVE_SYNC";
 const char *PVRCONF_ENABLE_AGGRESSIVE_SYNC = "WseglEnableAggressiveSync";
 
+/* Set to non-zero to log the startup profile of WSEGL_InitialiseDisplay(). */
+const char *ENV_PROFILE_STARTUP = "WSEGL_PROFILE_STARTUP";
+const char *PVRCONF_PROFILE_STARTUP = "WseglProfileStartup";
+
+/*
+ * Set to zero not to pass the render fence to the compositor, even if it
+ * supports zwp_linux_explicit_synchronization_v1, i.e. to rely on the
+ * implicit synchronization of the dma-buf.
+ */
+const char *ENV_EXPLICIT_SYNC = "WSEGL_EXPLICIT_SYNC";
+const char *PVRCONF_EXPLICIT_SYNC = "WseglExplicitSync";
+
+/*
+ * Set to zero not to ask for release fences with explicit synchronization,
+ * i.e. to wait for wl_buffer.release before reusing a buffer.
+ */
+const char *ENV_RELEASE_FENCE = "WSEGL_RELEASE_FENCE";
+const char *PVRCONF_RELEASE_FENCE = "WseglReleaseFence";
+
+/*
+ * Maximum time in milliseconds to wait for the compositor to release a
+ * buffer. On expiry, WSEGL_GetDrawableParameters() returns WSEGL_RETRY
+ * instead of blocking the render thread. Zero waits forever.
+ */
+const char *ENV_DEQUEUE_TIMEOUT = "WSEGL_DEQUEUE_TIMEOUT";
+const char *PVRCONF_DEQUEUE_TIMEOUT = "WseglDequeueTimeout";
+
+/*
+ * Set to one to hold back the newest frame with swap interval 0 until the
+ * compositor has taken the last, rather than committing every frame. Off
+ * by default: a frame held back is only committed on the next call into
+ * the window.
+ */
+const char *ENV_MAILBOX = "WSEGL_MAILBOX";
+const char *PVRCONF_MAILBOX = "WseglMailbox";
+
+/*
+ * Set to zero not to ask for wp_presentation feedback, i.e. to pace swap
+ * intervals over 1 by frame callbacks only.
+ */
+const char *ENV_PRESENTATION = "WSEGL_PRESENTATION";
+const char *PVRCONF_PRESENTATION = "WseglPresentation";
+
+/*
+ * Set to non-zero to hold GetDrawableParameters back until just before the
+ * predicted repaint deadline of the compositor with swap interval 1, so
+ * that the application renders as late as possible. The margin kept before
+ * the deadline, on top of the recent render times, is in microseconds.
+ */
+const char *ENV_LATENCY_MODE = "WSEGL_LATENCY_MODE";
+const char *PVRCONF_LATENCY_MODE = "WseglLatencyMode";
+const char *ENV_LATENCY_MARGIN = "WSEGL_LATENCY_MARGIN";
+const char *PVRCONF_LATENCY_MARGIN = "WseglLatencyMargin";
+
+#define DEFAULT_LATENCY_MARGIN_US	2000
+
+/*
+ * Buffers of closed or resized windows are kept by the display, mapped and
+ * with their wl_buffer, for windows of the same size to take over. The
+ * size of the pool is in KiB, 0 to disable it; buffers idle for longer
+ * than the timeout in milliseconds are freed on the next call into any
+ * drawable, and all of them once the last window is gone.
+ */
+const char *ENV_POOL_SIZE = "WSEGL_POOL_SIZE";
+const char *PVRCONF_POOL_SIZE = "WseglPoolSize";
+const char *ENV_POOL_TIMEOUT = "WSEGL_POOL_TIMEOUT";
+const char *PVRCONF_POOL_TIMEOUT = "WseglPoolTimeout";
+
+#define DEFAULT_POOL_SIZE_KB		32768
+#define DEFAULT_POOL_TIMEOUT_MS		2000
+
+/*
+ * Set to zero to give every window WSEGL_NUM_BUFFERS buffers up front.
+ * Otherwise windows start with the minimum, get another buffer when they
+ * keep finding all of them held by the compositor, up to WSEGL_NUM_BUFFERS
+ * if set or MAX_BACK_BUFFERS, and give one back after the idle timeout in
+ * milliseconds without running short. An idle timeout of zero or less
+ * keeps the buffers once grown; shorter ones are raised to the one second
+ * window in which stalls are counted, so as not to give back a buffer
+ * right after taking it.
+ */
+const char *ENV_ADAPTIVE_BUFFERS = "WSEGL_ADAPTIVE_BUFFERS";
+const char *PVRCONF_ADAPTIVE_BUFFERS = "WseglAdaptiveBuffers";
+const char *ENV_BUFFER_IDLE_TIMEOUT = "WSEGL_BUFFER_IDLE_TIMEOUT";
+const char *PVRCONF_BUFFER_IDLE_TIMEOUT = "WseglBufferIdleTimeout";
+
+#define DEFAULT_BUFFER_IDLE_TIMEOUT_MS	3000
+#define MIN_BUFFER_IDLE_TIMEOUT_MS	1000
+
+/*
+ * Most damage rectangles sent per commit, after merging; beyond that the
+ * bounding box of the damage is sent. At most WLWS_DAMAGE_MAX_RECTS.
+ */
+const char *ENV_MAX_DAMAGE_RECTS = "WSEGL_MAX_DAMAGE_RECTS";
+const char *PVRCONF_MAX_DAMAGE_RECTS = "WseglMaxDamageRects";
+
+#define DEFAULT_MAX_DAMAGE_RECTS	16
+
 /* enable formats */
 enum {
 	ENABLE_FORMAT_ARGB8888 = 1 << 0,
@@ -82,12 +189,14 @@ enum {
 /*
  * Capabilities of the wayland window system
  */
+#define MAX_SWAP_INTERVAL 4
+
 static const WSEGLCaps WLWSEGL_Caps[] =
 {
 	{ WSEGL_CAP_WINDOWS_USE_HW_SYNC, 1 },
 	{ WSEGL_CAP_PIXMAPS_USE_HW_SYNC, 1 },
 	{ WSEGL_CAP_MIN_SWAP_INTERVAL, 0 },
-	{ WSEGL_CAP_MAX_SWAP_INTERVAL, 1 },
+	{ WSEGL_CAP_MAX_SWAP_INTERVAL, MAX_SWAP_INTERVAL },
         { WSEGL_CAP_IMAGE_EXTERNAL_SUPPORT, 1 },
 	{ WSEGL_NO_CAPS, 0 }
 };
@@ -98,17 +207,25 @@ static const WSEGLCaps WLWSEGL_Caps[] =
 
 typedef struct WaylandWS_Client_Display_TAG
 {
-        /* For Wayland display */
+        /* For Wayland display; the queue is for the globals only */
         struct wl_display       *wl_display;
         struct wl_event_queue   *wl_queue;
         struct wl_registry      *wl_registry;
         struct wl_kms           *wl_kms;
         struct zwp_linux_dmabuf_v1      *zlinux_dmabuf;
+	struct zwp_linux_explicit_synchronization_v1	*explicit_sync;
+	int			release_fences;
+	int			dequeue_timeout;	/* ms, 0 for none */
+	int			mailbox;		/* with swap interval 0 */
+	struct wp_presentation	*presentation;
+	clockid_t		presentation_clock;
+	int			latency_mode;
+	int			latency_margin_us;
+	int			adaptive_buffers;
+	uint64_t		buffer_idle_ns;
+	int			max_damage_rects;
 	int			display_connected;
 
-        /* for sync/frame events */
-        struct wl_callback      *callback;
-
         /* For KMS used in the client */
         int                     fd;
         struct kms_driver       *kms;
@@ -126,6 +243,24 @@ typedef struct WaylandWS_Client_Display_TAG
 	/* drm modifier */
 	uint32_t		modifier_lo;
 	uint32_t		modifier_hi;
+
+	/* startup profile, only while initialising */
+	WLWSStartupRecorder	*startup;
+
+	/* memory of all drawables */
+	WLWSMemoryAccount	memory;
+
+	/* buffers freed by windows, for reuse; see kms_pool_put() */
+	struct {
+		pthread_mutex_t		lock;
+		struct wl_list		entries;	/* most recently freed first */
+		struct wl_event_queue	*wl_queue;	/* of the idle wl_buffers, drained on trim */
+		int			windows;	/* window drawables left to expire it */
+		uint64_t		bytes;
+		uint64_t		max_bytes;
+		uint64_t		timeout_ns;
+		WLWSMemoryAccount	memory;
+	} pool;
 } WLWSClientDisplay;
 
 /* Do not change the following number. */
@@ -137,6 +272,8 @@ typedef struct WaylandWS_Client_Display_TAG
 enum {
 	KMS_BUFFER_FLAG_LOCKED	= 1,
 	KMS_BUFFER_FLAG_TYPE_BO	= 2,
+	KMS_BUFFER_FLAG_FENCED	= 4,	/* release_fence is valid */
+	KMS_BUFFER_FLAG_STALE	= 8,	/* of the size before a resize */
 };
 
 struct kms_buffer {
@@ -146,17 +283,32 @@ struct kms_buffer {
         void                    *addr;
         struct wl_buffer        *wl_buffer;
         int                     prime_fd;
+	uint64_t		size;		/* of the BO, as charged */
+	int			width;
+	int			height;
 
         int                     buffer_age;
 
+        /* last frame committed with this buffer */
+        uint32_t                frame;
+
         /* PVR memory map */
         struct pvr_map          *map;
 
+        /* release of the last commit, and the fence it came with */
+        struct zwp_linux_buffer_release_v1      *release;
+        PVRSRV_FENCE            release_fence;
+
+        /* presentation feedback of the last commit */
+        struct wp_presentation_feedback         *feedback;
+
         /* pointing back to the drawable */
         void *drawable;
 };
 
 #define IS_KMS_BUFFER_LOCKED(b)	((b)->flag & KMS_BUFFER_FLAG_LOCKED)
+#define IS_KMS_BUFFER_FENCED(b)	((b)->flag & KMS_BUFFER_FLAG_FENCED)
+#define IS_KMS_BUFFER_STALE(b)	((b)->flag & KMS_BUFFER_FLAG_STALE)
 
 #ifdef HAVE_WAYLAND_EGL_18_1_0
 #define GET_EGL_WINDOW_PRIVATE(window)		window->driver_private
@@ -178,6 +330,9 @@ typedef enum {
 typedef struct {
         int                     interval;
         struct wl_callback      *frame_sync;
+
+	/* only one per wl_surface, so kept across resizing */
+	struct zwp_linux_surface_synchronization_v1	*surface_sync;
 } WLWSClientSurface;
 
 struct queue {
@@ -205,6 +360,49 @@ typedef struct WaylandWS_Client_Drawable_TAG
 
         WLWSClientDisplay       *display;
 
+	/* events of this window only, so that windows do not wait on each other */
+	struct wl_event_queue	*wl_queue;
+
+	/* proxies creating their children on wl_queue, for race free requests */
+	struct wl_display	*wl_display_wrapper;
+	struct wl_surface	*wl_surface_wrapper;
+	struct wp_presentation	*presentation_wrapper;
+
+	/* what the presentation feedback told so far */
+	struct {
+		uint64_t	last_ns;	/* last frame shown, presentation clock */
+		uint32_t	refresh_ns;	/* of its output, 0 if unknown */
+		uint32_t	committed;	/* frame of the last commit */
+		bool		pending;	/* its feedback is still to come */
+
+		/* frame callbacks, CLOCK_MONOTONIC */
+		uint64_t	callback_ns;	/* arrival of the last one */
+		uint64_t	callback_period_ns;	/* average between them */
+		uint32_t	callback_samples;	/* that went into it */
+		bool		callback_paced;	/* the one to come is for a paced commit */
+	} present;
+
+	/* latency mode: when the render began, and how long it takes */
+	uint64_t		render_begin_ns;
+	uint64_t		render_ns;
+
+	/* adaptive buffer count, see wayland_adapt_buffers() */
+	struct {
+		int		max_bufs;	/* to grow to */
+		uint64_t	stall_ns;	/* last dequeue short of a buffer */
+		uint64_t	change_ns;	/* last stall or change of num_bufs */
+	} adapt;
+
+	/* for sync events */
+	struct wl_callback	*callback;
+
+	/* newest frame held back in mailbox mode, with its render fence */
+	struct kms_buffer	*mailbox;
+	PVRSRV_FENCE		mailbox_fence;
+
+	/* serialises the entry points of a window; only with wl_queue */
+	pthread_mutex_t		lock;
+
         int                     ref_count;
 
         struct wl_listener      kms_buffer_destroy_listener;
@@ -213,6 +411,9 @@ typedef struct WaylandWS_Client_Drawable_TAG
         int                     resized;        /* set when window is resized */
 
         WLWSClientSurface       *surface;
+
+	WLWSMemoryAccount	memory;
+	WLWSTimeline		timeline;
 } WLWSClientDrawable;
 
 /*
@@ -237,17 +438,121 @@ static const struct wl_callback_listener wayland_sync_listener = {
 	.done = wayland_sync_callback
 };
 
+/*
+ * Thread safe equivalent of wl_display_dispatch_queue(). Any number of
+ * threads may wait for the events of their own queue on one wl_display;
+ * whoever reads the socket queues the events for the others, following
+ * the wl_display_prepare_read_queue() protocol. Waits at most timeout
+ * milliseconds for an event of this queue, or forever if negative; events
+ * read for other queues, e.g. input on the default queue of the
+ * application, do not end the wait. Returns the number of dispatched
+ * events, 0 on timeout, or -1 on error.
+ */
+static int wayland_dispatch_queue_timeout(struct wl_display *wl_display,
+					  struct wl_event_queue *queue, int timeout)
+{
+	uint64_t deadline = 0, now;
+	struct pollfd pfd;
+	int ret, wait;
+
+	if (timeout > 0)
+		deadline = wlws_timeline_now() + (uint64_t)timeout * 1000000;
+
+	pfd.fd = wl_display_get_fd(wl_display);
+	pfd.events = POLLIN;
+
+	for (;;) {
+		while (wl_display_prepare_read_queue(wl_display, queue) != 0) {
+			if ((ret = wl_display_dispatch_queue_pending(wl_display, queue)) != 0)
+				return ret;
+		}
+
+		/* the socket being full is fine, we only need the events */
+		if (wl_display_flush(wl_display) < 0 && errno != EAGAIN) {
+			wl_display_cancel_read(wl_display);
+			return -1;
+		}
+
+		wait = timeout;
+		if (timeout > 0) {
+			now = wlws_timeline_now();
+			wait = (now < deadline) ? (int)((deadline - now + 999999) / 1000000) : 0;
+		}
+
+		do {
+			ret = poll(&pfd, 1, wait);
+		} while (ret < 0 && errno == EINTR);
+
+		if (ret <= 0) {
+			wl_display_cancel_read(wl_display);
+			return ret;
+		}
+
+		if (wl_display_read_events(wl_display) < 0)
+			return -1;
+
+		if ((ret = wl_display_dispatch_queue_pending(wl_display, queue)) != 0)
+			return ret;
+
+		/* only events for other queues; wait on unless out of time */
+		if (timeout == 0 || (timeout > 0 && wlws_timeline_now() >= deadline))
+			return 0;
+	}
+}
+
+static inline int wayland_dispatch_queue(struct wl_display *wl_display, struct wl_event_queue *queue)
+{
+	return wayland_dispatch_queue_timeout(wl_display, queue, -1);
+}
+
+/*
+ * Dispatch the events of a window, waiting until the dequeue timeout of
+ * the display has elapsed since start at most. Returns 0 once it has.
+ */
+static int wayland_dispatch_drawable(WLWSClientDrawable *drawable, uint64_t start)
+{
+	WLWSClientDisplay *display = drawable->display;
+	uint64_t deadline, now;
+
+	if (!display->dequeue_timeout)
+		return wayland_dispatch_queue(display->wl_display, drawable->wl_queue);
+
+	deadline = start + (uint64_t)display->dequeue_timeout * 1000000;
+
+	/* never before the output has refreshed twice, however slow it is */
+	if (deadline < start + 2 * (uint64_t)drawable->present.refresh_ns)
+		deadline = start + 2 * (uint64_t)drawable->present.refresh_ns;
+
+	if ((now = wlws_timeline_now()) >= deadline)
+		return 0;
+
+	return wayland_dispatch_queue_timeout(display->wl_display, drawable->wl_queue,
+					      (deadline - now + 999999) / 1000000);
+}
+
+static inline void drawable_lock(WLWSClientDrawable *drawable)
+{
+	if (drawable->wl_queue)
+		pthread_mutex_lock(&drawable->lock);
+}
+
+static inline void drawable_unlock(WLWSClientDrawable *drawable)
+{
+	if (drawable->wl_queue)
+		pthread_mutex_unlock(&drawable->lock);
+}
+
 /*
  * Wayland callback setting
  */
-static void wayland_set_callback(WLWSClientDisplay *display,
+static void wayland_set_callback(WLWSClientDrawable *drawable,
 				 struct wl_callback *callback,
 				 struct wl_callback **flag, const char *name)
 {
-	struct wl_event_queue *queue = display->wl_queue;
+	struct wl_event_queue *queue = drawable->wl_queue;
 
 	if (!flag)
-		flag = &display->callback;
+		flag = &drawable->callback;
 #if defined(DEBUG)
        WSEGL_DEBUG("%s: %s: callback=%s(%p)\n", __FILE__, __func__, name, callback);
 #else
@@ -268,6 +573,203 @@ quit:
 	WSEGL_DEBUG("%s: %s: done\n", __FILE__, __func__);
 }
 
+static const struct wl_callback_listener wayland_frame_listener;
+
+static void wayland_request_frame(WLWSClientDrawable *drawable)
+{
+	struct wl_callback *callback = wl_surface_frame(drawable->wl_surface_wrapper);
+
+	drawable->surface->frame_sync = callback;
+	wl_callback_add_listener(callback, &wayland_frame_listener, drawable);
+}
+
+/*
+ * The arrival of the frame callbacks tells the refresh period of the
+ * output, for intervals over 1 without wp_presentation.
+ */
+static void wayland_frame_callback(void *data, struct wl_callback *callback, uint32_t time)
+{
+	WLWSClientDrawable *drawable = data;
+	WLWSClientSurface *surface = drawable->surface;
+	uint64_t now = wlws_timeline_now();
+	uint64_t period = drawable->present.callback_period_ns;
+	WSEGL_UNREFERENCED_PARAMETER(time);
+
+	wl_callback_destroy(callback);
+	surface->frame_sync = NULL;
+
+	/*
+	 * The refresh period, as far as consecutive callbacks tell. A commit
+	 * held back for an interval over 1 says nothing about it. Quick to
+	 * come down, so that a slow first frame does not stick.
+	 */
+	if (drawable->present.callback_ns && !drawable->present.callback_paced) {
+		uint64_t delta = now - drawable->present.callback_ns;
+
+		if (!period)
+			drawable->present.callback_period_ns = delta;
+		else if (delta < period)
+			drawable->present.callback_period_ns = (period + delta * 3) / 4;
+		else if (delta < period * 3 / 2)
+			drawable->present.callback_period_ns = (period * 7 + delta) / 8;
+		drawable->present.callback_samples++;
+	}
+	drawable->present.callback_ns = now;
+	drawable->present.callback_paced = false;
+}
+
+static const struct wl_callback_listener wayland_frame_listener = {
+	.done = wayland_frame_callback
+};
+
+/*
+ * wp_presentation_feedback listeners
+ */
+static void presentation_feedback_done(struct kms_buffer *kms_buffer)
+{
+	WLWSClientDrawable *drawable = kms_buffer->drawable;
+
+	if (kms_buffer->frame == drawable->present.committed)
+		drawable->present.pending = false;
+
+	wp_presentation_feedback_destroy(kms_buffer->feedback);
+	kms_buffer->feedback = NULL;
+}
+
+static void presentation_feedback_sync_output(void *data,
+					      struct wp_presentation_feedback *feedback,
+					      struct wl_output *output)
+{
+	WSEGL_UNREFERENCED_PARAMETER(data);
+	WSEGL_UNREFERENCED_PARAMETER(feedback);
+	WSEGL_UNREFERENCED_PARAMETER(output);
+}
+
+static void presentation_feedback_presented(void *data,
+					    struct wp_presentation_feedback *feedback,
+					    uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+					    uint32_t tv_nsec, uint32_t refresh,
+					    uint32_t seq_hi, uint32_t seq_lo, uint32_t flags)
+{
+	struct kms_buffer *kms_buffer = data;
+	WLWSClientDrawable *drawable = kms_buffer->drawable;
+	uint64_t ns = (((uint64_t)tv_sec_hi << 32) | tv_sec_lo) * 1000000000ULL + tv_nsec;
+	WSEGL_UNREFERENCED_PARAMETER(feedback);
+	WSEGL_UNREFERENCED_PARAMETER(seq_hi);
+	WSEGL_UNREFERENCED_PARAMETER(seq_lo);
+	WSEGL_UNREFERENCED_PARAMETER(flags);
+
+	WSEGL_DEBUG("%s: %s: frame %u at %llu, refresh %u\n", __FILE__, __func__,
+		    kms_buffer->frame, (unsigned long long)ns, refresh);
+
+	drawable->present.last_ns = ns;
+	drawable->present.refresh_ns = refresh;
+	if (drawable->display->presentation_clock == CLOCK_MONOTONIC)
+		WLWS_TIMELINE_SET(&drawable->timeline, kms_buffer->frame, present_ns, ns);
+	WLWS_TRACE_EVENT("presented", drawable, kms_buffer - drawable->buffers);
+
+	presentation_feedback_done(kms_buffer);
+}
+
+static void presentation_feedback_discarded(void *data,
+					    struct wp_presentation_feedback *feedback)
+{
+	struct kms_buffer *kms_buffer = data;
+	WSEGL_UNREFERENCED_PARAMETER(feedback);
+
+	WLWS_TRACE_EVENT("discarded", kms_buffer->drawable,
+			 kms_buffer - ((WLWSClientDrawable*)kms_buffer->drawable)->buffers);
+	presentation_feedback_done(kms_buffer);
+}
+
+static const struct wp_presentation_feedback_listener presentation_feedback_listener = {
+	presentation_feedback_sync_output,
+	presentation_feedback_presented,
+	presentation_feedback_discarded
+};
+
+/*
+ * Intervals over 1 are paced by the presentation times, once the refresh
+ * rate of the output is known, rather than by the arrival of frame callbacks.
+ */
+static inline bool wayland_presentation_paced(WLWSClientDrawable *drawable)
+{
+	return drawable->presentation_wrapper && drawable->present.refresh_ns;
+}
+
+static inline uint64_t wayland_presentation_now(WLWSClientDisplay *display)
+{
+	struct timespec ts;
+
+	clock_gettime(display->presentation_clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Wait for the slot of the next frame with a swap interval over 1: a
+ * quarter of a refresh into the period after which the last frame shown
+ * has been up for interval - 1 refreshes, so that the compositor latches
+ * it for the interval-th refresh, whatever the refresh rate of the output.
+ */
+static void wayland_wait_present_slot(WLWSClientDrawable *drawable, int interval, uint64_t start)
+{
+	WLWSClientDisplay *display = drawable->display;
+	uint64_t target, now;
+
+	/* the feedback of the last frame comes along with its frame callback */
+	while (drawable->present.pending) {
+		if (wayland_dispatch_drawable(drawable, start) <= 0)
+			return;
+	}
+
+	if (!drawable->present.last_ns)
+		return;
+
+	target = drawable->present.last_ns +
+		 (uint64_t)(interval - 1) * drawable->present.refresh_ns +
+		 drawable->present.refresh_ns / 4;
+
+	while ((now = wayland_presentation_now(display)) < target) {
+		if (wayland_dispatch_queue_timeout(display->wl_display, drawable->wl_queue,
+						   (target - now + 999999) / 1000000) < 0)
+			return;
+	}
+}
+
+/*
+ * Wait for the slot of the next frame with a swap interval over 1, by the
+ * frame callbacks alone: a quarter of a refresh into the period after
+ * which the last frame has been up for interval - 1 refreshes, counting
+ * from its frame callback. Compositors only send frame callbacks when they
+ * repaint, so rather than asking for more with empty commits, which would
+ * apply whatever state the application has pending on its wl_surface, the
+ * time is told from the period measured between them. Until a few have
+ * been measured, frames are paced as with an interval of 1. Returns true
+ * if the commit has been held back.
+ */
+#define MIN_CALLBACK_SAMPLES	4
+
+static bool wayland_wait_callback_slot(WLWSClientDrawable *drawable, int interval)
+{
+	WLWSClientDisplay *display = drawable->display;
+	uint64_t period = drawable->present.callback_period_ns;
+	uint64_t target, now;
+
+	if (drawable->present.callback_samples < MIN_CALLBACK_SAMPLES ||
+	    !drawable->present.callback_ns)
+		return false;
+
+	target = drawable->present.callback_ns + (uint64_t)(interval - 1) * period + period / 4;
+
+	while ((now = wlws_timeline_now()) < target) {
+		if (wayland_dispatch_queue_timeout(display->wl_display, drawable->wl_queue,
+						   (target - now + 999999) / 1000000) < 0)
+			break;
+	}
+
+	return true;
+}
+
 /*
  * wl_kms notification listeners
  */
@@ -355,6 +857,22 @@ static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
 	dmabuf_modifiers
 };
 
+/*
+ * wp_presentation notification listeners
+ */
+
+static void presentation_clock_id(void *data, struct wp_presentation *presentation, uint32_t clk_id)
+{
+	WLWSClientDisplay *display = data;
+	WSEGL_UNREFERENCED_PARAMETER(presentation);
+
+	display->presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
 /*
  * registry routines to the server global objects
  */
@@ -374,6 +892,17 @@ static void wayland_registry_handle_global(void *data, struct wl_registry *regis
 		display->zlinux_dmabuf =
 			wl_registry_bind(registry, name, &zwp_linux_dmabuf_v1_interface, version);
 		zwp_linux_dmabuf_v1_add_listener (display->zlinux_dmabuf, &dmabuf_listener, display);
+#if defined(SUPPORT_NATIVE_FENCE_SYNC)
+	} else if (!strcmp(interface, "zwp_linux_explicit_synchronization_v1")) {
+		/* the render fences are sync_file fds only with native fence sync */
+		display->explicit_sync =
+			wl_registry_bind(registry, name,
+					 &zwp_linux_explicit_synchronization_v1_interface, 1);
+#endif
+	} else if (!strcmp(interface, "wp_presentation")) {
+		display->presentation =
+			wl_registry_bind(registry, name, &wp_presentation_interface, 1);
+		wp_presentation_add_listener(display->presentation, &presentation_listener, display);
 	}
 }
 
@@ -420,20 +949,92 @@ static inline void put_free_buffer(WLWSClientDrawable *drawable, struct kms_buff
 	drawable->free_buffer = item;
 }
 
+static inline void drop_release_fence(WLWSClientDrawable *drawable, struct kms_buffer *buffer)
+{
+	if (!IS_KMS_BUFFER_FENCED(buffer))
+		return;
+
+	PVRSRVFenceDestroyExt(drawable->display->context->connection, buffer->release_fence);
+	buffer->release_fence = PVRSRV_NO_FENCE;
+	buffer->flag &= ~KMS_BUFFER_FLAG_FENCED;
+}
+
 static inline struct kms_buffer* get_free_buffer(WLWSClientDrawable *drawable)
 {
+	struct queue **link, **pick = &drawable->free_buffer;
 	struct queue *item = drawable->free_buffer;
 	if (!item)
 		return NULL;
 
-	drawable->free_buffer = item->next;
+	/*
+	 * Prefer a buffer the compositor has finished reading. One whose
+	 * release fence is still pending is only taken if there is no other,
+	 * and then the GPU waits for the fence rather than us.
+	 */
+	for (link = &drawable->free_buffer; *link; link = &(*link)->next) {
+		struct kms_buffer *buffer = (*link)->buffer;
+
+		if (!IS_KMS_BUFFER_FENCED(buffer))
+			break;
+		if (pvr_fence_is_signalled(drawable->display->context, buffer->release_fence)) {
+			drop_release_fence(drawable, buffer);
+			break;
+		}
+	}
+	if (*link)
+		pick = link;
+
+	item = *pick;
+	*pick = item->next;
 	item->next = drawable->free_buffer_unused;
 	drawable->free_buffer_unused = item;
 
 	return item->buffer;
 }
 
+/*
+ * Rebuild the queue after the number of buffers has changed. Every buffer
+ * that is neither locked nor the current one is free.
+ */
+static void rebuild_free_buffer_queue(WLWSClientDrawable *drawable)
+{
+	struct queue *queue = drawable->free_buffer_queue;
+	int i;
+
+	drawable->free_buffer = drawable->free_buffer_unused = NULL;
+	for (i = drawable->num_bufs - 1; i >= 0; i--) {
+		struct kms_buffer *buffer = &drawable->buffers[i];
+
+		queue[i].buffer = buffer;
+		if (buffer == drawable->current || IS_KMS_BUFFER_LOCKED(buffer)) {
+			queue[i].next = drawable->free_buffer_unused;
+			drawable->free_buffer_unused = &queue[i];
+		} else {
+			queue[i].next = drawable->free_buffer;
+			drawable->free_buffer = &queue[i];
+		}
+	}
+}
+
 static void _kms_release_buffer(WLWSClientDrawable *drawable, struct kms_buffer *buffer);
+static void _kms_retire_buffer(WLWSClientDrawable *drawable, struct kms_buffer *buffer);
+static WSEGLError _kms_renew_buffer(WLWSClientDrawable *drawable, struct kms_buffer *buffer);
+static bool wayland_adapt_grow(WLWSClientDrawable *drawable);
+static void wayland_adapt_buffers(WLWSClientDrawable *drawable, uint64_t starved);
+
+static void wayland_buffer_released(WLWSClientDrawable *drawable, struct kms_buffer *kms_buffer)
+{
+	WLWS_TIMELINE_SET(&drawable->timeline, kms_buffer->frame,
+			  release_ns, wlws_timeline_now());
+	WLWS_TRACE_EVENT("release", drawable, kms_buffer - drawable->buffers);
+	kms_buffer->flag &= ~KMS_BUFFER_FLAG_LOCKED;
+
+	/* of the size before a resize, reallocated when next dequeued */
+	if (IS_KMS_BUFFER_STALE(kms_buffer))
+		_kms_retire_buffer(drawable, kms_buffer);
+
+	put_free_buffer(drawable, kms_buffer);
+}
 
 static void wayland_buffer_release(void *data, struct wl_buffer *buffer)
 {
@@ -441,12 +1042,21 @@ static void wayland_buffer_release(void *data, struct wl_buffer *buffer)
 	int i;
 
 	WSEGL_DEBUG("%s: %s\n", __FILE__, __func__);
+
+	/* queued before the buffer went to the pool of the display */
+	if (!drawable)
+		return;
+
 	for (i = 0; i < drawable->num_bufs; i++) {
 		struct kms_buffer *kms_buffer = &drawable->buffers[i];
 		if (kms_buffer->wl_buffer == buffer) {
 			WSEGL_DEBUG("%s: %s: buffer %d (%p) is released.\n", __FILE__, __func__, i, buffer);
-			kms_buffer->flag &= ~KMS_BUFFER_FLAG_LOCKED;
-			put_free_buffer(drawable, kms_buffer);
+			/*
+			 * With a release object, the compositor may still send
+			 * wl_buffer.release, even after the buffer was reused.
+			 */
+			if (IS_KMS_BUFFER_LOCKED(kms_buffer) && !kms_buffer->release)
+				wayland_buffer_released(drawable, kms_buffer);
 			goto done;
 		}
 	}
@@ -457,6 +1067,49 @@ done:
 	return;
 }
 
+/*
+ * zwp_linux_buffer_release_v1 listeners. Either event ends the release
+ * object of the commit. A fenced release comes as soon as the compositor
+ * has queued its last read of the buffer, i.e. usually a frame before
+ * wl_buffer.release.
+ */
+static void wayland_buffer_fenced_release(void *data, struct zwp_linux_buffer_release_v1 *release,
+					  int32_t fence)
+{
+	struct kms_buffer *kms_buffer = data;
+	WLWSClientDrawable *drawable = kms_buffer->drawable;
+
+	WSEGL_DEBUG("%s: %s: buffer %d, fence %d\n", __FILE__, __func__,
+		    (int)(kms_buffer - drawable->buffers), fence);
+
+	zwp_linux_buffer_release_v1_destroy(release);
+	kms_buffer->release = NULL;
+
+	drop_release_fence(drawable, kms_buffer);
+	kms_buffer->release_fence = pvr_import_fence(drawable->display->context, fence);
+	if (kms_buffer->release_fence != PVRSRV_NO_FENCE)
+		kms_buffer->flag |= KMS_BUFFER_FLAG_FENCED;
+
+	wayland_buffer_released(drawable, kms_buffer);
+}
+
+static void wayland_buffer_immediate_release(void *data, struct zwp_linux_buffer_release_v1 *release)
+{
+	struct kms_buffer *kms_buffer = data;
+
+	WSEGL_DEBUG("%s: %s\n", __FILE__, __func__);
+
+	zwp_linux_buffer_release_v1_destroy(release);
+	kms_buffer->release = NULL;
+
+	wayland_buffer_released(kms_buffer->drawable, kms_buffer);
+}
+
+static const struct zwp_linux_buffer_release_v1_listener wayland_buffer_release_listener = {
+	.fenced_release = wayland_buffer_fenced_release,
+	.immediate_release = wayland_buffer_immediate_release,
+};
+
 static const struct wl_buffer_listener wayland_buffer_listener = {
 	.release = wayland_buffer_release
 };
@@ -498,49 +1151,35 @@ static const struct zwp_linux_buffer_params_v1_listener buffer_params_listener =
 	zlinux_dmabuf_create_failed
 };
 
-static struct wl_buffer*
-wayland_get_wl_buffer_from_zlinux_dmabuf(WLWSClientDisplay *display,
-					 WLWSClientDrawable *drawable, int fd)
+static struct zwp_linux_buffer_params_v1*
+wayland_create_zlinux_dmabuf_params(WLWSClientDisplay *display,
+				    WLWSClientDrawable *drawable, int fd,
+				    uint32_t *pixelformat)
 {
-	uint32_t pixelformat;
 	struct zwp_linux_buffer_params_v1 *params;
-	struct dmabuf_params_result params_result = {NULL, 0};
-	int ret = 0;
 
 	/* check the pixelformat */
 	switch (drawable->info.pixelformat) {
 	case WLWSEGL_PIXFMT_ARGB8888:
 		if (!(display->enable_formats & ENABLE_FORMAT_ARGB8888))
 			goto err;
-		pixelformat = DRM_FORMAT_ARGB8888;
+		*pixelformat = DRM_FORMAT_ARGB8888;
 		break;
 	case WLWSEGL_PIXFMT_XRGB8888:
 		if (!(display->enable_formats & ENABLE_FORMAT_XRGB8888))
 			goto err;
-		pixelformat = DRM_FORMAT_XRGB8888;
+		*pixelformat = DRM_FORMAT_XRGB8888;
 		break;
 	default:
 		goto err;
 	}
 
 	params = zwp_linux_dmabuf_v1_create_params(display->zlinux_dmabuf);
-	wl_proxy_set_queue((struct wl_proxy*)params, display->wl_queue);
+	wl_proxy_set_queue((struct wl_proxy*)params, drawable->wl_queue);
 	zwp_linux_buffer_params_v1_add(params, fd, 0, 0, drawable->info.pitch,
 				       display->modifier_hi, display->modifier_lo);
-	zwp_linux_buffer_params_v1_add_listener(params,
-						&buffer_params_listener,
-						&params_result);
-	zwp_linux_buffer_params_v1_create(
-		params, drawable->info.width, drawable->info.height,
-		pixelformat, 0);
-	wl_display_flush(display->wl_display);
 
-	while (ret >= 0 && !params_result.done) {
-		ret = wl_display_dispatch_queue(display->wl_display,
-						display->wl_queue);
-	}
-
-	return params_result.wl_buffer;
+	return params;
 
 err:
 	WSEGL_DEBUG("%s: %s: %d: unexpected pixelformat %x passed.\n",
@@ -575,68 +1214,274 @@ wayland_get_wl_buffer_from_wl_kms(WLWSClientDisplay *display,
 				    drawable->info.pitch, pixelformat, 0);
 }
 
-static struct wl_buffer* wayland_get_wl_buffer(WLWSClientDisplay *display, struct kms_buffer *buffer)
+static void wayland_set_wl_buffer(WLWSClientDrawable *drawable, struct kms_buffer *buffer,
+				  struct wl_buffer *wl_buffer)
 {
-	WLWSClientDrawable *drawable = buffer->drawable;
+	if (!(buffer->wl_buffer = wl_buffer))
+		return;
+
+	WSEGL_DEBUG("%s: %s: %d: wl_buffer=%p\n", __FILE__, __func__, __LINE__, buffer->wl_buffer);
+
+	wl_proxy_set_queue((struct wl_proxy*)buffer->wl_buffer, drawable->wl_queue);
+	wl_buffer_add_listener(buffer->wl_buffer, &wayland_buffer_listener, drawable);
+}
+
+/*
+ * Create the wl_buffers of all the buffers of a window drawable at once,
+ * so that the first frames after creating or resizing the window do not
+ * pay a round trip each. With create_immed, i.e. zwp_linux_dmabuf_v1 v2 or
+ * later, there is no round trip at all, otherwise a single one.
+ */
+static void wayland_create_wl_buffers(WLWSClientDisplay *display, WLWSClientDrawable *drawable)
+{
+	struct dmabuf_params_result results[MAX_BACK_BUFFERS];
+	struct zwp_linux_buffer_params_v1 *params;
+	uint32_t pixelformat;
+	int i, pending = 0, ret = 0;
+	bool immed = display->zlinux_dmabuf &&
+		wl_proxy_get_version((struct wl_proxy*)display->zlinux_dmabuf) >=
+		ZWP_LINUX_BUFFER_PARAMS_V1_CREATE_IMMED_SINCE_VERSION;
 
 	WSEGL_DEBUG("%s: %s: %d\n", __FILE__, __func__, __LINE__);
-	if (buffer->wl_buffer)
-		goto done;
+	WLWS_TRACE_BEGIN("create-wl-buffers", drawable, -1);
 
-	if (display->zlinux_dmabuf) {
-		buffer->wl_buffer =
-			wayland_get_wl_buffer_from_zlinux_dmabuf(
-					display, drawable, buffer->prime_fd);
-	} else {
-		buffer->wl_buffer =
-			wayland_get_wl_buffer_from_wl_kms(display, drawable,
-							  buffer->prime_fd);
+	memset(results, 0, sizeof(results));
+	for (i = 0; i < drawable->num_bufs; i++) {
+		struct kms_buffer *buffer = &drawable->buffers[i];
+
+		results[i].done = 1;
+		if (buffer->wl_buffer || !buffer->bo)
+			continue;
+
+		if (!display->zlinux_dmabuf) {
+			wayland_set_wl_buffer(drawable, buffer,
+					      wayland_get_wl_buffer_from_wl_kms(display, drawable,
+										buffer->prime_fd));
+			continue;
+		}
+
+		if (!(params = wayland_create_zlinux_dmabuf_params(display, drawable,
+								   buffer->prime_fd, &pixelformat)))
+			break;
+
+		if (immed) {
+			wayland_set_wl_buffer(drawable, buffer,
+					      zwp_linux_buffer_params_v1_create_immed(
+							params, drawable->info.width,
+							drawable->info.height, pixelformat, 0));
+			zwp_linux_buffer_params_v1_destroy(params);
+			continue;
+		}
+
+		results[i].done = 0;
+		zwp_linux_buffer_params_v1_add_listener(params,
+							&buffer_params_listener,
+							&results[i]);
+		zwp_linux_buffer_params_v1_create(
+			params, drawable->info.width, drawable->info.height,
+			pixelformat, 0);
+		pending++;
 	}
 
-	if (!buffer->wl_buffer)
-		return NULL;
+	if (pending) {
+		wl_display_flush(display->wl_display);
+
+		for (i = 0; i < drawable->num_bufs; i++) {
+			while (ret >= 0 && !results[i].done) {
+				ret = wayland_dispatch_queue(display->wl_display,
+							     drawable->wl_queue);
+			}
+			if (results[i].wl_buffer)
+				wayland_set_wl_buffer(drawable, &drawable->buffers[i],
+						      results[i].wl_buffer);
+		}
+	}
 
-	WSEGL_DEBUG("%s: %s: %d: wl_buffer=%p\n", __FILE__, __func__, __LINE__, buffer->wl_buffer);
+	WLWS_TRACE_END();
+}
 
-	wl_proxy_set_queue((struct wl_proxy*)buffer->wl_buffer, display->wl_queue);
-	wl_buffer_add_listener(buffer->wl_buffer, &wayland_buffer_listener, drawable);
+static struct wl_buffer* wayland_get_wl_buffer(WLWSClientDisplay *display, struct kms_buffer *buffer)
+{
+	WSEGL_DEBUG("%s: %s: %d\n", __FILE__, __func__, __LINE__);
+
+	/* normally created along with the drawable already */
+	if (!buffer->wl_buffer)
+		wayland_create_wl_buffers(display, buffer->drawable);
 
-done:
 	return buffer->wl_buffer;
 }
 
-static void wayland_wait_for_buffer_release(WLWSClientDrawable *drawable)
+static void wayland_mailbox_drop(WLWSClientDrawable *drawable);
+static void wayland_mailbox_flush(WLWSClientDrawable *drawable);
+
+/*
+ * Take back the frame held in the mailbox, to render the next one over it.
+ */
+static struct kms_buffer* wayland_mailbox_reclaim(WLWSClientDrawable *drawable)
+{
+	struct kms_buffer *kms_buffer = drawable->mailbox;
+
+	WLWS_TRACE_EVENT("mailbox-reclaim", drawable, kms_buffer - drawable->buffers);
+	PVRSRVFenceDestroyExt(drawable->display->context->connection, drawable->mailbox_fence);
+	drawable->mailbox = NULL;
+	kms_buffer->flag &= ~KMS_BUFFER_FLAG_LOCKED;
+
+	return kms_buffer;
+}
+
+/*
+ * Latency mode. Rather than dequeuing as early as possible and blocking for
+ * the frame callback in the next swap, wait for the frame callback here,
+ * then hold the application back until the predicted repaint deadline of
+ * the compositor, i.e. a refresh after the last frame callback, less the
+ * recent render time and the margin. The application thus samples its
+ * input as late as it can and still makes the next refresh.
+ */
+static void wayland_wait_render_slot(WLWSClientDrawable *drawable)
+{
+	WLWSClientDisplay *display = drawable->display;
+	uint32_t frame = wlws_timeline_frame(&drawable->timeline);
+	uint64_t start = wlws_timeline_now();
+	uint64_t period, lead, target, now;
+
+	while (drawable->surface->frame_sync) {
+		if (wayland_dispatch_drawable(drawable, start) <= 0)
+			return;
+	}
+
+	period = drawable->present.refresh_ns ?
+		 drawable->present.refresh_ns : drawable->present.callback_period_ns;
+	if (!period || !drawable->present.callback_ns)
+		goto out;
+
+	/* past the deadline already, i.e. the compositor has been idle */
+	target = drawable->present.callback_ns + period;
+	if (target <= start)
+		goto out;
+
+	lead = drawable->render_ns + (uint64_t)display->latency_margin_us * 1000;
+	if (lead >= target - start)
+		goto out;
+	target -= lead;
+
+	WLWS_TRACE_BEGIN("late-dequeue", drawable, -1);
+	while ((now = wlws_timeline_now()) < target) {
+		/* sleep off the last fraction of a millisecond poll() can't */
+		if (target - now < 1000000) {
+			struct timespec ts = {
+				.tv_sec = target / 1000000000ULL,
+				.tv_nsec = target % 1000000000ULL
+			};
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			break;
+		}
+		if (wayland_dispatch_queue_timeout(display->wl_display, drawable->wl_queue,
+						   (target - now) / 1000000) < 0)
+			break;
+	}
+	WLWS_TRACE_END();
+
+out:
+	WLWS_TIMELINE_SET(&drawable->timeline, frame, throttle_ns, wlws_timeline_now() - start);
+}
+
+/*
+ * Wait until a buffer is free to render into. Returns WSEGL_RETRY if the
+ * compositor held all the buffers for longer than the dequeue timeout.
+ */
+static WSEGLError wayland_wait_for_buffer_release(WLWSClientDrawable *drawable)
 {
 	WLWSClientDisplay *display = drawable->display;
+	uint32_t frame = wlws_timeline_frame(&drawable->timeline);
+	uint64_t start = wlws_timeline_now();
+	uint64_t starved = 0;
+	WSEGLError err = WSEGL_SUCCESS;
+	int ret;
 
 	WSEGL_DEBUG("%s: %s\n", __FILE__, __func__);
 
-	wl_display_dispatch_queue_pending(display->wl_display, display->wl_queue);
+	/* pixmaps have the one buffer, and no queue to wait on */
+	if (!drawable->wl_queue)
+		return drawable->current ? WSEGL_SUCCESS : WSEGL_BAD_NATIVE_PIXMAP;
+
+	WLWS_TRACE_BEGIN("dequeue", drawable, -1);
+
+	wl_display_dispatch_queue_pending(display->wl_display, drawable->wl_queue);
 	if (!drawable->current)
 		drawable->current = get_free_buffer(drawable);
 	while (!drawable->current || IS_KMS_BUFFER_LOCKED(drawable->current)) {
 		WSEGL_DEBUG("%s: %s: current=%p, callback=%p\n", __FILE__, __func__,
-			    drawable->current, display->callback);
+			    drawable->current, drawable->callback);
+
+		/*
+		 * Rather than blocking, render over the frame waiting in the
+		 * mailbox, unless the compositor has just taken it.
+		 */
+		if (drawable->mailbox) {
+			wayland_mailbox_flush(drawable);
+			if (!(drawable->current = get_free_buffer(drawable)) && drawable->mailbox)
+				drawable->current = wayland_mailbox_reclaim(drawable);
+			continue;
+		}
+
+		/*
+		 * The compositor is ready for the next frame, but holds all the
+		 * buffers. Take another one rather than waiting, if this keeps
+		 * happening.
+		 */
+		if (!drawable->surface->frame_sync) {
+			if (!starved)
+				starved = wlws_timeline_now();
+			if (wayland_adapt_grow(drawable))
+				break;
+		}
 
 		if (display->aggressive_sync)
-			wayland_set_callback(display, wl_display_sync(display->wl_display),
+			wayland_set_callback(drawable, wl_display_sync(drawable->wl_display_wrapper),
 					     NULL, "wl_display_sync(2)");
 
-		if (wl_display_dispatch_queue(display->wl_display, display->wl_queue) < 0)
+		if (!(ret = wayland_dispatch_drawable(drawable, start))) {
+			WSEGL_DEBUG("%s: %s: no buffer released in %d ms\n", __FILE__, __func__,
+				    display->dequeue_timeout);
+			err = WSEGL_RETRY;
+			break;
+		}
+		if (ret < 0) {
+			err = WSEGL_BAD_NATIVE_WINDOW;
 			break;
+		}
 		drawable->current = get_free_buffer(drawable);
 	}
 
+	if (err == WSEGL_SUCCESS)
+		wayland_adapt_buffers(drawable, starved);
+
+	/* the first time round after a resize */
+	if (err == WSEGL_SUCCESS && IS_KMS_BUFFER_STALE(drawable->current))
+		err = _kms_renew_buffer(drawable, drawable->current);
+
 	/* we maybe in the wrong situation. wayland backend sometime drops the request. */
-	if (display->callback) {
+	if (drawable->callback) {
 		WSEGL_DEBUG("%s: %s: destroying callback. something went wrong.\n", __FILE__, __func__);
-		wl_callback_destroy(display->callback);
-		display->callback = NULL;
+		wl_callback_destroy(drawable->callback);
+		drawable->callback = NULL;
 	}
 
-	WSEGL_DEBUG("%s: %s: buffer unlocked\n", __FILE__, __func__);
+	if (err == WSEGL_SUCCESS)
+		WSEGL_DEBUG("%s: %s: buffer unlocked\n", __FILE__, __func__);
 
-	return;
+	WLWS_TIMELINE_SET(&drawable->timeline, frame, dequeue_ns, wlws_timeline_now() - start);
+	if (err == WSEGL_SUCCESS)
+		wlws_timeline_set_buffer(&drawable->timeline, frame,
+					 drawable->current - drawable->buffers);
+
+	WLWS_TRACE_END();
+	if (err == WSEGL_SUCCESS)
+		WLWS_TRACE_EVENT("dequeued", drawable, drawable->current - drawable->buffers);
+	else
+		WLWS_TRACE_EVENT("dequeue-failed", drawable, err);
+
+	return err;
 }
 
 static int get_env_value(const char *env, int default_value)
@@ -662,19 +1507,35 @@ static int get_config_value(const char *pvr_key, const char *env_key, int defaul
 	return get_env_value(env_key, default_value);
 }
 
+static void startup_phase(WLWSClientDisplay *display, WLWSStartupPhase phase)
+{
+	if (display->startup)
+		wlws_startup_phase(display->startup, phase);
+}
+
+static int wayland_roundtrip(WLWSClientDisplay *display)
+{
+	if (display->startup)
+		wlws_startup_roundtrip(display->startup);
+
+	return wl_display_roundtrip_queue(display->wl_display, display->wl_queue);
+}
+
 static bool authenticate_kms_device(WLWSClientDisplay *display)
 {
 	if (!display->wl_kms)
 		return false;
 
+	startup_phase(display, WLWS_STARTUP_KMS_AUTH);
+
 	wl_kms_add_listener(display->wl_kms, &wayland_kms_listener, display);
 
-	if (wl_display_roundtrip_queue(display->wl_display, display->wl_queue) < 0 || display->fd == -1) {
+	if (wayland_roundtrip(display) < 0 || display->fd == -1) {
 		// no DRM device given
 		return false;
 	}
 
-	if (wl_display_roundtrip_queue(display->wl_display, display->wl_queue) < 0 || !display->authenticated) {
+	if (wayland_roundtrip(display) < 0 || !display->authenticated) {
 		// Authentication failed...
 		return false;
 	}
@@ -685,11 +1546,14 @@ static bool setup_drm_device(WLWSClientDisplay *display)
 {
 	display->fd = -1;
 
-	if (wl_display_roundtrip_queue(display->wl_display, display->wl_queue) < 0)
+	startup_phase(display, WLWS_STARTUP_GLOBALS);
+	if (wayland_roundtrip(display) < 0)
 		return false;
 
-	if (display->zlinux_dmabuf)
+	if (display->zlinux_dmabuf) {
+		startup_phase(display, WLWS_STARTUP_DRM_OPEN);
 		display->fd = drmOpenWithType(RENDER_NODE_MODULE, NULL, DRM_NODE_RENDER);
+	}
 
 	if (display->fd >= 0)
 		return true;
@@ -698,17 +1562,282 @@ static bool setup_drm_device(WLWSClientDisplay *display)
 	return authenticate_kms_device(display);
 }
 
-static bool ensure_supported_dmabuf_formats(WLWSClientDisplay *display)
-{
-	if (!display->zlinux_dmabuf)
-		return true;
+static bool ensure_supported_dmabuf_formats(WLWSClientDisplay *display)
+{
+	if (!display->zlinux_dmabuf)
+		return true;
+
+	startup_phase(display, WLWS_STARTUP_FORMATS);
+	if (wayland_roundtrip(display) < 0 ||
+            !display->enable_formats) {
+		/* No supported dmabuf pixel formats */
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Display-wide buffer pool. A window buffer the compositor has released
+ * is kept on the display when its window goes away or is resized, still
+ * mapped and with its wl_buffer and release fence, and handed to the next
+ * window asking for a buffer of the same size, format and modifier. The
+ * least recently freed buffers go first when the pool is full, and
+ * buffers idle for longer than the timeout are freed.
+ */
+struct kms_pool_entry {
+	struct wl_list		link;
+
+	/* what a window has to ask for to get it */
+	int			width;
+	int			height;
+	WLWSEGL_PIXFMT		pixelformat;
+	uint64_t		modifier;
+
+	struct kms_bo		*bo;
+	int			prime_fd;
+	uint64_t		size;
+	struct pvr_map		*map;
+	struct wl_buffer	*wl_buffer;
+	PVRSRV_FENCE		release_fence;	/* the compositor may still be reading it */
+
+	uint64_t		freed_ns;
+};
+
+static inline uint64_t kms_pool_modifier(WLWSClientDisplay *display)
+{
+	return ((uint64_t)display->modifier_hi << 32) | display->modifier_lo;
+}
+
+static void kms_pool_init(WLWSClientDisplay *display)
+{
+	int size = get_config_value(PVRCONF_POOL_SIZE, ENV_POOL_SIZE, DEFAULT_POOL_SIZE_KB);
+	int timeout = get_config_value(PVRCONF_POOL_TIMEOUT, ENV_POOL_TIMEOUT, DEFAULT_POOL_TIMEOUT_MS);
+
+	pthread_mutex_init(&display->pool.lock, NULL);
+	wl_list_init(&display->pool.entries);
+	display->pool.max_bytes = (size > 0) ? (uint64_t)size * 1024 : 0;
+	display->pool.timeout_ns = (timeout > 0) ? (uint64_t)timeout * 1000000 : 0;
+
+	if (display->pool.max_bytes &&
+	    !(display->pool.wl_queue = wl_display_create_queue(display->wl_display)))
+		display->pool.max_bytes = 0;
+
+	wlws_memory_init(&display->pool.memory, &display->memory);
+	wlws_memory_register(&display->pool.memory, &display->pool, "pool");
+}
+
+static void kms_pool_free_entry(WLWSClientDisplay *display, struct kms_pool_entry *entry)
+{
+	wl_list_remove(&entry->link);
+	__atomic_sub_fetch(&display->pool.bytes, entry->size, __ATOMIC_RELAXED);
+
+	if (entry->wl_buffer)
+		wl_buffer_destroy(entry->wl_buffer);
+	if (entry->release_fence != PVRSRV_NO_FENCE)
+		PVRSRVFenceDestroyExt(display->context->connection, entry->release_fence);
+	pvr_unmap_memory(display->context, entry->map);
+	close(entry->prime_fd);
+	wlws_memory_uncharge(&display->pool.memory, WLWS_MEMORY_KMS_BO, entry->size);
+	kms_bo_destroy(&entry->bo);
+	free(entry);
+}
+
+/* with the pool locked */
+static void kms_pool_trim(WLWSClientDisplay *display, uint64_t now)
+{
+	struct kms_pool_entry *entry, *tmp;
+
+	/* releases of idle buffers, to be dropped */
+	if (display->pool.wl_queue)
+		wl_display_dispatch_queue_pending(display->wl_display, display->pool.wl_queue);
+
+	wl_list_for_each_reverse_safe(entry, tmp, &display->pool.entries, link) {
+		if (display->pool.bytes <= display->pool.max_bytes &&
+		    (!display->pool.timeout_ns || now - entry->freed_ns < display->pool.timeout_ns))
+			break;
+		WSEGL_DEBUG("%s: %s: %dx%d, %llu bytes\n", __FILE__, __func__,
+			    entry->width, entry->height, (unsigned long long)entry->size);
+		kms_pool_free_entry(display, entry);
+	}
+}
+
+/*
+ * Free the buffers idle for longer than the timeout. Cheap if the pool is
+ * empty, so that it can be called from every entry point of a drawable.
+ */
+static void kms_pool_expire(WLWSClientDisplay *display)
+{
+	if (!__atomic_load_n(&display->pool.bytes, __ATOMIC_RELAXED))
+		return;
+
+	pthread_mutex_lock(&display->pool.lock);
+	kms_pool_trim(display, wlws_timeline_now());
+	pthread_mutex_unlock(&display->pool.lock);
+}
+
+/*
+ * With no window left, nothing would call into the display to expire the
+ * pool, so it is emptied once the last window drawable is deleted.
+ */
+static void kms_pool_window_deleted(WLWSClientDisplay *display)
+{
+	struct kms_pool_entry *entry, *tmp;
+
+	if (__atomic_sub_fetch(&display->pool.windows, 1, __ATOMIC_ACQ_REL)) {
+		kms_pool_expire(display);
+		return;
+	}
+
+	pthread_mutex_lock(&display->pool.lock);
+	wl_list_for_each_safe(entry, tmp, &display->pool.entries, link)
+		kms_pool_free_entry(display, entry);
+	if (display->pool.wl_queue)
+		wl_display_dispatch_queue_pending(display->wl_display, display->pool.wl_queue);
+	pthread_mutex_unlock(&display->pool.lock);
+}
+
+static void kms_pool_destroy(WLWSClientDisplay *display)
+{
+	struct kms_pool_entry *entry, *tmp;
+
+	wl_list_for_each_safe(entry, tmp, &display->pool.entries, link)
+		kms_pool_free_entry(display, entry);
+	if (display->pool.wl_queue)
+		wl_event_queue_destroy(display->pool.wl_queue);
+
+	wlws_memory_unregister(&display->pool.memory);
+	pthread_mutex_destroy(&display->pool.lock);
+}
+
+/*
+ * Hand a window buffer over to the pool. Returns false if it cannot be
+ * kept, in which case it is up to the caller to release it.
+ */
+static bool kms_pool_put(WLWSClientDrawable *drawable, struct kms_buffer *buffer)
+{
+	WLWSClientDisplay *display = drawable->display;
+	struct kms_pool_entry *entry;
+
+	if (!display->pool.max_bytes || buffer->size > display->pool.max_bytes ||
+	    !(buffer->flag & KMS_BUFFER_FLAG_TYPE_BO) || !buffer->bo || !buffer->map ||
+	    IS_KMS_BUFFER_LOCKED(buffer) || buffer->release)
+		return false;
+
+	if (!(entry = calloc(1, sizeof(struct kms_pool_entry))))
+		return false;
+
+	if (buffer->feedback)
+		presentation_feedback_done(buffer);
+
+	entry->width = buffer->width;
+	entry->height = buffer->height;
+	entry->pixelformat = drawable->info.pixelformat;
+	entry->modifier = kms_pool_modifier(display);
+	entry->bo = buffer->bo;
+	entry->prime_fd = buffer->prime_fd;
+	entry->size = buffer->size;
+	entry->map = buffer->map;
+	entry->wl_buffer = buffer->wl_buffer;
+	entry->freed_ns = wlws_timeline_now();
+
+	/* the next user renders behind it, as with any fenced buffer */
+	entry->release_fence = PVRSRV_NO_FENCE;
+	if (IS_KMS_BUFFER_FENCED(buffer)) {
+		if (pvr_fence_is_signalled(display->context, buffer->release_fence))
+			drop_release_fence(drawable, buffer);
+		else
+			entry->release_fence = buffer->release_fence;
+		buffer->release_fence = PVRSRV_NO_FENCE;
+		buffer->flag &= ~KMS_BUFFER_FLAG_FENCED;
+	}
+
+	wlws_memory_uncharge(&drawable->memory, WLWS_MEMORY_KMS_BO, entry->size);
+	wlws_memory_charge(&display->pool.memory, WLWS_MEMORY_KMS_BO, entry->size);
+	pvr_map_set_account(entry->map, &display->pool.memory);
+
+	/* off the queue of the window, which may go away before the buffer */
+	if (entry->wl_buffer) {
+		wl_proxy_set_queue((struct wl_proxy*)entry->wl_buffer, display->pool.wl_queue);
+		wl_buffer_set_user_data(entry->wl_buffer, NULL);
+	}
+
+	WLWS_TRACE_EVENT("pool-put", drawable, buffer - drawable->buffers);
+
+	buffer->bo = NULL;
+	buffer->prime_fd = 0;
+	buffer->map = NULL;
+	buffer->wl_buffer = NULL;
+	buffer->size = 0;
+
+	pthread_mutex_lock(&display->pool.lock);
+	wl_list_insert(&display->pool.entries, &entry->link);
+	__atomic_add_fetch(&display->pool.bytes, entry->size, __ATOMIC_RELAXED);
+	kms_pool_trim(display, entry->freed_ns);
+	pthread_mutex_unlock(&display->pool.lock);
+
+	return true;
+}
+
+/*
+ * Take a buffer of the size and format of the drawable from the pool.
+ * Returns false if there is none.
+ */
+static bool kms_pool_take(WLWSClientDrawable *drawable, struct kms_buffer *buffer)
+{
+	WLWSClientDisplay *display = drawable->display;
+	struct kms_pool_entry *entry, *found = NULL;
+	uint64_t modifier = kms_pool_modifier(display);
+
+	if (!display->pool.max_bytes)
+		return false;
+
+	pthread_mutex_lock(&display->pool.lock);
+	kms_pool_trim(display, wlws_timeline_now());
+	wl_list_for_each(entry, &display->pool.entries, link) {
+		if (entry->width == drawable->info.width &&
+		    entry->height == drawable->info.height &&
+		    entry->pixelformat == drawable->info.pixelformat &&
+		    entry->modifier == modifier) {
+			found = entry;
+			break;
+		}
+	}
+	if (found) {
+		wl_list_remove(&found->link);
+		__atomic_sub_fetch(&display->pool.bytes, found->size, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&display->pool.lock);
 
-	if (wl_display_roundtrip_queue(display->wl_display, display->wl_queue) < 0 ||
-            !display->enable_formats) {
-		/* No supported dmabuf pixel formats */
+	if (!found)
 		return false;
+
+	buffer->bo = found->bo;
+	buffer->prime_fd = found->prime_fd;
+	buffer->size = found->size;
+	buffer->width = found->width;
+	buffer->height = found->height;
+	buffer->map = found->map;
+	buffer->wl_buffer = found->wl_buffer;
+	buffer->flag |= KMS_BUFFER_FLAG_TYPE_BO;
+	buffer->drawable = drawable;
+	if ((buffer->release_fence = found->release_fence) != PVRSRV_NO_FENCE)
+		buffer->flag |= KMS_BUFFER_FLAG_FENCED;
+	free(found);
+
+	wlws_memory_uncharge(&display->pool.memory, WLWS_MEMORY_KMS_BO, buffer->size);
+	wlws_memory_charge(&drawable->memory, WLWS_MEMORY_KMS_BO, buffer->size);
+	pvr_map_set_account(buffer->map, &drawable->memory);
+
+	if (buffer->wl_buffer) {
+		wl_proxy_set_queue((struct wl_proxy*)buffer->wl_buffer, drawable->wl_queue);
+		wl_buffer_set_user_data(buffer->wl_buffer, drawable);
 	}
 
+	kms_bo_get_prop(buffer->bo, KMS_PITCH, (unsigned int*)&drawable->info.pitch);
+	drawable->info.size = drawable->info.pitch * drawable->info.height;
+
+	WLWS_TRACE_EVENT("pool-take", drawable, buffer - drawable->buffers);
 	return true;
 }
 
@@ -726,12 +1855,19 @@ static WSEGLError WSEGLc_InitialiseDisplay(NativeDisplayType hNativeDisplay,
 					   PVRSRV_DEV_CONNECTION **ppsDevConnection)
 {
 	WLWSClientDisplay *display;
+	WLWSStartupRecorder startup;
 	WSEGLError err;
+	int idle_timeout;
 
 	WSEGL_DEBUG("%s: %s: %d\n", __FILE__, __func__, __LINE__);
 
+	wlws_startup_begin(&startup, get_config_value(PVRCONF_PROFILE_STARTUP, ENV_PROFILE_STARTUP, 0));
+
 	if (!(display = calloc(1, sizeof(WLWSClientDisplay))))
 		return WSEGL_OUT_OF_MEMORY;
+	display->startup = &startup;
+	startup_phase(display, WLWS_STARTUP_QUEUE);
+	wlws_memory_init(&display->memory, NULL);
 
 	/*
 	 * Extract display handles from hNativeDisplay
@@ -747,6 +1883,7 @@ static WSEGLError WSEGLc_InitialiseDisplay(NativeDisplayType hNativeDisplay,
 		display->wl_display = (struct wl_display*)hNativeDisplay;
 	}
 	display->fd = -1;
+	display->presentation_clock = CLOCK_MONOTONIC;
 
 	/*
 	 * Initialize modifier
@@ -776,20 +1913,68 @@ static WSEGLError WSEGLc_InitialiseDisplay(NativeDisplayType hNativeDisplay,
 	}
 
 	/* XXX: should we wrap this with wl_kms client code? */
+	startup_phase(display, WLWS_STARTUP_KMS_CREATE);
 	if (kms_create(display->fd, &display->kms)) {
 		err = WSEGL_BAD_NATIVE_DISPLAY;
 		goto fail;
 	}
 
 	/* Create a PVR context */
+	startup_phase(display, WLWS_STARTUP_PVR_CONNECT);
 	if (!(display->context = pvr_connect(ppsDevConnection))) {
 		err = WSEGL_CANNOT_INITIALISE;
 		goto fail;
 	}
 
+	wlws_startup_end(&startup, true);
+	display->startup = NULL;
+
+	wlws_timeline_setup();
+	wlws_trace_setup();
+
 	/* set sync mode */
 	display->aggressive_sync = get_config_value(PVRCONF_ENABLE_AGGRESSIVE_SYNC, ENV_ENABLE_AGGRESSIVE_SYNC, 0);
 
+	display->dequeue_timeout = get_config_value(PVRCONF_DEQUEUE_TIMEOUT, ENV_DEQUEUE_TIMEOUT, 0);
+	if (display->dequeue_timeout < 0)
+		display->dequeue_timeout = 0;
+	display->mailbox = get_config_value(PVRCONF_MAILBOX, ENV_MAILBOX, 0);
+	display->latency_mode = get_config_value(PVRCONF_LATENCY_MODE, ENV_LATENCY_MODE, 0);
+	display->latency_margin_us = get_config_value(PVRCONF_LATENCY_MARGIN, ENV_LATENCY_MARGIN,
+						      DEFAULT_LATENCY_MARGIN_US);
+	if (display->latency_margin_us < 0)
+		display->latency_margin_us = 0;
+	kms_pool_init(display);
+	display->adaptive_buffers = get_config_value(PVRCONF_ADAPTIVE_BUFFERS, ENV_ADAPTIVE_BUFFERS, 1);
+	idle_timeout = get_config_value(PVRCONF_BUFFER_IDLE_TIMEOUT, ENV_BUFFER_IDLE_TIMEOUT,
+					DEFAULT_BUFFER_IDLE_TIMEOUT_MS);
+	if (idle_timeout > 0 && idle_timeout < MIN_BUFFER_IDLE_TIMEOUT_MS)
+		idle_timeout = MIN_BUFFER_IDLE_TIMEOUT_MS;
+	display->buffer_idle_ns = (idle_timeout > 0) ? (uint64_t)idle_timeout * 1000000 : 0;
+	display->max_damage_rects = get_config_value(PVRCONF_MAX_DAMAGE_RECTS, ENV_MAX_DAMAGE_RECTS,
+						     DEFAULT_MAX_DAMAGE_RECTS);
+
+	/*
+	 * An acquire fence may only be set on a dma-buf based wl_buffer.
+	 * wl_kms buffers are synchronized implicitly.
+	 */
+	if (display->explicit_sync &&
+	    (!display->zlinux_dmabuf ||
+	     !get_config_value(PVRCONF_EXPLICIT_SYNC, ENV_EXPLICIT_SYNC, 1))) {
+		zwp_linux_explicit_synchronization_v1_destroy(display->explicit_sync);
+		display->explicit_sync = NULL;
+	}
+	if (display->explicit_sync)
+		display->release_fences = get_config_value(PVRCONF_RELEASE_FENCE, ENV_RELEASE_FENCE, 1);
+
+	if (display->presentation &&
+	    !get_config_value(PVRCONF_PRESENTATION, ENV_PRESENTATION, 1)) {
+		wp_presentation_destroy(display->presentation);
+		display->presentation = NULL;
+	}
+
+	wlws_memory_register(&display->memory, display, "display");
+
 	/* return the pointers to the caps, configs, and the display handle */
 	*psCapabilities = WLWSEGL_Caps;
 	*psConfigs	= WLWSEGL_Configs;
@@ -806,6 +1991,10 @@ fail:
 		wl_kms_destroy(display->wl_kms);
 	if (display->zlinux_dmabuf)
 		zwp_linux_dmabuf_v1_destroy(display->zlinux_dmabuf);
+	if (display->explicit_sync)
+		zwp_linux_explicit_synchronization_v1_destroy(display->explicit_sync);
+	if (display->presentation)
+		wp_presentation_destroy(display->presentation);
 	if (display->wl_registry)
 		wl_registry_destroy(display->wl_registry);
 	if (display->wl_queue)
@@ -813,6 +2002,7 @@ fail:
 	if (display->display_connected)
 		wl_display_disconnect(display->wl_display);
 	free(display);
+	wlws_startup_end(&startup, false);
 	return err;
 }
 
@@ -829,11 +2019,16 @@ static WSEGLError WSEGLc_CloseDisplay(WSEGLDisplayHandle hDisplay)
 	WLWSClientDisplay *display = (WLWSClientDisplay*)hDisplay;
 	WSEGL_DEBUG("%s: %s: %d\n", __FILE__, __func__, __LINE__);
 
+	kms_pool_destroy(display);
 	pvr_disconnect(display->context);
 
 	wl_kms_destroy(display->wl_kms);
 	if (display->zlinux_dmabuf)
 		zwp_linux_dmabuf_v1_destroy(display->zlinux_dmabuf);
+	if (display->explicit_sync)
+		zwp_linux_explicit_synchronization_v1_destroy(display->explicit_sync);
+	if (display->presentation)
+		wp_presentation_destroy(display->presentation);
 	wl_registry_destroy(display->wl_registry);
 	wl_event_queue_destroy(display->wl_queue);
 
@@ -844,11 +2039,21 @@ static WSEGLError WSEGLc_CloseDisplay(WSEGLDisplayHandle hDisplay)
 
 	if (display->display_connected)
 		wl_display_disconnect(display->wl_display);
+
+	wlws_memory_close_display(&display->memory);
 	free(display);
 
 	return WSEGL_SUCCESS;
 }
 
+static uint64_t _kms_bo_size(WLWSClientDrawable *drawable, struct kms_bo *bo)
+{
+	unsigned int pitch = 0;
+
+	kms_bo_get_prop(bo, KMS_PITCH, &pitch);
+	return (uint64_t)pitch * drawable->info.height;
+}
+
 static void _kms_release_buffer(WLWSClientDrawable *drawable, struct kms_buffer *buffer)
 {
 	WSEGL_DEBUG("%s: %s: %d\n", __FILE__, __func__, __LINE__);
@@ -856,8 +2061,11 @@ static void _kms_release_buffer(WLWSClientDrawable *drawable, struct kms_buffer
 	if (!buffer)
 		return;
 
-	if (buffer->map)
+	if (buffer->map) {
+		WLWS_TRACE_BEGIN("unmap", drawable, buffer - drawable->buffers);
 		pvr_unmap_memory(drawable->display->context, buffer->map);
+		WLWS_TRACE_END();
+	}
 
 	if (buffer->addr) {
 		if (buffer->flag & KMS_BUFFER_FLAG_TYPE_BO)
@@ -868,8 +2076,16 @@ static void _kms_release_buffer(WLWSClientDrawable *drawable, struct kms_buffer
 	if (buffer->prime_fd)
 		close(buffer->prime_fd);
 
-	if (buffer->bo)
+	if (buffer->bo) {
+		wlws_memory_uncharge(&drawable->memory, WLWS_MEMORY_KMS_BO, buffer->size);
 		kms_bo_destroy(&buffer->bo);
+	}
+
+	if (buffer->release)
+		zwp_linux_buffer_release_v1_destroy(buffer->release);
+	drop_release_fence(drawable, buffer);
+	if (buffer->feedback)
+		wp_presentation_feedback_destroy(buffer->feedback);
 
 	if (buffer->wl_buffer)
 		wl_buffer_destroy(buffer->wl_buffer);
@@ -886,7 +2102,8 @@ static void _kms_release_buffers(WLWSClientDrawable *drawable)
 
 	for (i = 0; i < drawable->num_bufs; i++) {
 		WSEGL_DEBUG("%s: %s: %d: i=%d:\n", __FILE__, __func__, __LINE__, i);
-		_kms_release_buffer(drawable, &drawable->buffers[i]);
+		if (!kms_pool_put(drawable, &drawable->buffers[i]))
+			_kms_release_buffer(drawable, &drawable->buffers[i]);
 		memset(&drawable->buffers[i], 0, sizeof(struct kms_buffer));
 	}
 	WSEGL_DEBUG("%s: %s: %d: done\n", __FILE__, __func__, __LINE__);
@@ -907,72 +2124,308 @@ static int _kms_get_number_of_buffers(void)
 	return num_buffers;
 }
 
-static int _kms_create_buffers(WLWSClientDrawable *drawable)
+/* the most an adaptive window may grow to, unless set explicitly */
+static int _kms_get_max_number_of_buffers(void)
+{
+	static int max_buffers = 0;
+
+	if (!max_buffers) {
+		max_buffers = get_config_value(PVRCONF_NUM_BUFFERS, ENV_NUM_BUFFERS, MAX_BACK_BUFFERS);
+		max_buffers = MIN(MAX(max_buffers, MIN_BACK_BUFFERS), MAX_BACK_BUFFERS);
+	}
+
+	return max_buffers;
+}
+
+/*
+ * Free the storage of a buffer of the size before a resize. The slot is
+ * allocated again at the new size when it is next dequeued.
+ */
+static void _kms_retire_buffer(WLWSClientDrawable *drawable, struct kms_buffer *buffer)
+{
+	WLWS_TRACE_EVENT("retire", drawable, buffer - drawable->buffers);
+
+	/* the pacing must not wait for feedback that is never coming */
+	if (buffer->feedback)
+		presentation_feedback_done(buffer);
+
+	/* kept for resizing back */
+	if (!kms_pool_put(drawable, buffer))
+		_kms_release_buffer(drawable, buffer);
+	memset(buffer, 0, sizeof(struct kms_buffer));
+	buffer->flag = KMS_BUFFER_FLAG_STALE;
+	buffer->drawable = drawable;
+}
+
+static int _kms_create_buffer(WLWSClientDrawable *drawable, struct kms_buffer *buffer)
 {
 	WLWSClientDisplay *display = drawable->display;
-	int i, err;
+	int err;
 	uint32_t handle;
 	unsigned attr[] = {
 		KMS_BO_TYPE, KMS_BO_TYPE_SCANOUT_X8R8G8B8,
-		KMS_WIDTH, 0,
-		KMS_HEIGHT, 0,
+		KMS_WIDTH, drawable->info.stride,
+		KMS_HEIGHT, drawable->info.height,
 		KMS_TERMINATE_PROP_LIST
 	};
 
+	if (kms_pool_take(drawable, buffer))
+		return 0;
+
+	if ((err = kms_bo_create(display->kms, attr, &buffer->bo))) {
+		WSEGL_DEBUG("%s: %s: %d: %s\n", __FILE__, __func__, __LINE__,
+			    strerror((err == -1) ? errno : err));
+		return -1;
+	}
+
+	buffer->size = _kms_bo_size(drawable, buffer->bo);
+	buffer->width = drawable->info.width;
+	buffer->height = drawable->info.height;
+	wlws_memory_charge(&drawable->memory, WLWS_MEMORY_KMS_BO, buffer->size);
+
+	kms_bo_get_prop(buffer->bo, KMS_HANDLE, &handle);
+
+	if (drmPrimeHandleToFD(display->fd, handle, DRM_CLOEXEC, &buffer->prime_fd)) {
+		WSEGL_DEBUG(
+			"%s: %s: %d: drmPrimeHandleToFD failed. %s\n",
+			__FILE__, __func__, __LINE__, strerror(errno));
+		return -1;
+	}
+
+	WSEGL_DEBUG("%s: %s: %d (prime_fd=%d)\n", __FILE__, __func__,
+		    __LINE__, buffer->prime_fd);
+
+	buffer->flag |= KMS_BUFFER_FLAG_TYPE_BO;
+	buffer->drawable = drawable;
+
+	kms_bo_get_prop(buffer->bo, KMS_PITCH, (unsigned int*)&drawable->info.pitch);
+	drawable->info.size = drawable->info.pitch * drawable->info.height;
+
+	/* Wrap KMS BO with PVR service */
+	WLWS_TRACE_BEGIN("map-dmabuf", drawable, buffer - drawable->buffers);
+	buffer->map = pvr_map_dmabuf(display->context, buffer->prime_fd,
+				     CLIENT_PVR_MAP_NAME, &drawable->memory, true);
+	WLWS_TRACE_END();
+	if (!buffer->map)
+		return -1;
+
+	return 0;
+}
+
+static int _kms_create_buffers(WLWSClientDrawable *drawable)
+{
+	int i;
+
 	WSEGL_DEBUG("%s: %s: %d\n", __FILE__, __func__, __LINE__);
 
 	drawable->info.width = drawable->window->width;
 	drawable->info.height = drawable->window->height;
 
 	// stride shall be 32 pixels aligned.
-	attr[3] = drawable->info.stride = ((drawable->info.width + 31) >> 5) << 5;
-	attr[5] = drawable->info.height;
+	drawable->info.stride = ((drawable->info.width + 31) >> 5) << 5;
 
 	// number of buffers
-	drawable->num_bufs = _kms_get_number_of_buffers();
+	if (drawable->display->adaptive_buffers) {
+		drawable->num_bufs = MIN_BACK_BUFFERS;
+		drawable->adapt.max_bufs = _kms_get_max_number_of_buffers();
+	} else {
+		drawable->num_bufs = drawable->adapt.max_bufs = _kms_get_number_of_buffers();
+	}
+	drawable->adapt.change_ns = wlws_timeline_now();
 
 	for (i = 0; i < drawable->num_bufs; i++) {
-		if ((err = kms_bo_create(display->kms, attr, &drawable->buffers[i].bo)))
+		if (_kms_create_buffer(drawable, &drawable->buffers[i]))
 			goto kms_error;
+	}
 
-		kms_bo_get_prop(drawable->buffers[i].bo, KMS_HANDLE, &handle);
+	WSEGL_DEBUG("%s: %s: %d: size=%d, %dx%d, pitch=%d, stride=%d\n", __FILE__, __func__, __LINE__,
+			drawable->info.size, drawable->info.width, drawable->info.height, drawable->info.pitch, drawable->info.stride);
 
-		if (drmPrimeHandleToFD(display->fd, handle, DRM_CLOEXEC,
-				       &drawable->buffers[i].prime_fd)) {
-			WSEGL_DEBUG(
-				"%s: %s: %d: drmPrimeHandleToFD failed. %s\n",
-				__FILE__, __func__, __LINE__, strerror(errno));
-			goto kms_error;
-		}
+	return 0;
+
+kms_error:
+	_kms_release_buffers(drawable);
+	return -1;
+}
 
-		WSEGL_DEBUG("%s: %s: %d (prime_fd=%d)\n", __FILE__, __func__,
-			    __LINE__, drawable->buffers[i].prime_fd);
+/*
+ * Allocate a buffer dequeued after a resize at the new size, along with
+ * its wl_buffer.
+ */
+static WSEGLError _kms_renew_buffer(WLWSClientDrawable *drawable, struct kms_buffer *buffer)
+{
+	WSEGL_DEBUG("%s: %s: %d: buffer %d, %dx%d\n", __FILE__, __func__, __LINE__,
+		    (int)(buffer - drawable->buffers), drawable->info.width, drawable->info.height);
 
-		drawable->buffers[i].flag |= KMS_BUFFER_FLAG_TYPE_BO;
+	if (buffer->bo)
+		_kms_retire_buffer(drawable, buffer);
 
-		drawable->buffers[i].drawable = drawable;
+	if (_kms_create_buffer(drawable, buffer)) {
+		_kms_retire_buffer(drawable, buffer);
+		return WSEGL_OUT_OF_MEMORY;
 	}
+	buffer->flag &= ~KMS_BUFFER_FLAG_STALE;
 
-	kms_bo_get_prop(drawable->buffers[0].bo, KMS_PITCH, (unsigned int*)&drawable->info.pitch);
-	drawable->info.size = drawable->info.pitch * drawable->info.height;
+	/* failing here is not fatal, it is retried on the commit */
+	wayland_create_wl_buffers(drawable->display, drawable);
+
+	return WSEGL_SUCCESS;
+}
+
+/*
+ * Take on the new size of the window without recreating the drawable, so
+ * that the swap interval, the frame callback and the pacing carry on. The
+ * buffers the compositor holds are retired as it releases them, all others
+ * right away; the new ones are allocated as they are dequeued.
+ */
+static void _kms_resize_buffers(WLWSClientDrawable *drawable)
+{
+	int i;
+
+	if (drawable->info.width == drawable->window->width &&
+	    drawable->info.height == drawable->window->height)
+		return;
+
+	WSEGL_DEBUG("%s: %s: %d: %dx%d -> %dx%d\n", __FILE__, __func__, __LINE__,
+		    drawable->info.width, drawable->info.height,
+		    drawable->window->width, drawable->window->height);
+
+	/* a frame of the old size is not worth committing any more */
+	wayland_mailbox_drop(drawable);
+
+	drawable->info.width = drawable->window->width;
+	drawable->info.height = drawable->window->height;
+	drawable->info.stride = ((drawable->info.width + 31) >> 5) << 5;
 
-	WSEGL_DEBUG("%s: %s: %d: size=%d, %dx%d, pitch=%d, stride=%d\n", __FILE__, __func__, __LINE__,
-			drawable->info.size, drawable->info.width, drawable->info.height, drawable->info.pitch, drawable->info.stride);
-	/* Wrap KMS BO with PVR service */
 	for (i = 0; i < drawable->num_bufs; i++) {
-		if (!(drawable->buffers[i].map =
-		      pvr_map_dmabuf(display->context,
-				     drawable->buffers[i].prime_fd,
-				     CLIENT_PVR_MAP_NAME)))
-			goto kms_error;
+		struct kms_buffer *buffer = &drawable->buffers[i];
+
+		buffer->flag |= KMS_BUFFER_FLAG_STALE;
+		if (!IS_KMS_BUFFER_LOCKED(buffer))
+			_kms_retire_buffer(drawable, buffer);
 	}
 
-	return 0;
+	/* nothing to preserve across a resize */
+	drawable->source = NULL;
+}
 
-kms_error:
-	WSEGL_DEBUG("%s: %s: %d: %s\n", __FILE__, __func__, __LINE__, strerror((err == -1) ? errno : err));
-	_kms_release_buffers(drawable);
-	return -1;
+/*
+ * Adaptive buffer count. A dequeue that finds all the buffers held by the
+ * compositor, although it is ready for the next frame, is a stall. Another
+ * stall within a second of the last one gets the window another buffer
+ * instead of waiting, up to adapt.max_bufs. After the idle timeout without
+ * stalls, a buffer is given back, down to MIN_BACK_BUFFERS.
+ */
+#define ADAPT_STALL_NS		1000000ULL
+#define ADAPT_STALL_WINDOW_NS	1000000000ULL
+
+static bool wayland_adapt_grow(WLWSClientDrawable *drawable)
+{
+	struct kms_buffer *buffer = &drawable->buffers[drawable->num_bufs];
+	uint64_t now = wlws_timeline_now();
+
+	if (drawable->num_bufs >= drawable->adapt.max_bufs || !drawable->adapt.stall_ns ||
+	    now - drawable->adapt.stall_ns > ADAPT_STALL_WINDOW_NS)
+		return false;
+
+	memset(buffer, 0, sizeof(struct kms_buffer));
+	if (_kms_create_buffer(drawable, buffer)) {
+		_kms_release_buffer(drawable, buffer);
+		memset(buffer, 0, sizeof(struct kms_buffer));
+		return false;
+	}
+
+	WLWS_TRACE_EVENT("grow", drawable, drawable->num_bufs);
+	WSEGL_DEBUG("%s: %s: %d buffers\n", __FILE__, __func__, drawable->num_bufs + 1);
+
+	drawable->num_bufs++;
+	drawable->current = buffer;
+	rebuild_free_buffer_queue(drawable);
+	drawable->adapt.stall_ns = drawable->adapt.change_ns = now;
+
+	/* failing here is not fatal, it is retried on the commit */
+	wayland_create_wl_buffers(drawable->display, drawable);
+
+	return true;
+}
+
+/*
+ * Give back the last buffer. If it is in use, it takes the place of a free
+ * one; either of them has to be free, i.e. neither locked nor current.
+ */
+static bool wayland_adapt_shrink(WLWSClientDrawable *drawable)
+{
+	struct kms_buffer *last = &drawable->buffers[drawable->num_bufs - 1];
+	struct kms_buffer *spare = NULL;
+	int i;
+
+	if (IS_KMS_BUFFER_LOCKED(last))
+		return false;
+
+	if (last == drawable->current) {
+		for (i = 0; i < drawable->num_bufs - 1; i++) {
+			struct kms_buffer *buffer = &drawable->buffers[i];
+
+			if (!IS_KMS_BUFFER_LOCKED(buffer) && buffer != drawable->current) {
+				spare = buffer;
+				break;
+			}
+		}
+		if (!spare)
+			return false;
+	} else {
+		spare = last;
+	}
+
+	WLWS_TRACE_EVENT("shrink", drawable, spare - drawable->buffers);
+	WSEGL_DEBUG("%s: %s: %d buffers\n", __FILE__, __func__, drawable->num_bufs - 1);
+
+	if (drawable->source == spare)
+		drawable->source = NULL;
+	if (spare->feedback)
+		presentation_feedback_done(spare);
+	if (!kms_pool_put(drawable, spare))
+		_kms_release_buffer(drawable, spare);
+
+	/* listeners hold on to the buffer, but it is neither locked nor fed back */
+	if (spare != last) {
+		if (last->feedback)
+			presentation_feedback_done(last);
+		*spare = *last;
+		if (drawable->current == last)
+			drawable->current = spare;
+		if (drawable->source == last)
+			drawable->source = spare;
+	}
+	memset(last, 0, sizeof(struct kms_buffer));
+
+	drawable->num_bufs--;
+	rebuild_free_buffer_queue(drawable);
+	return true;
+}
+
+/*
+ * Account for a dequeue, starved since the given time or 0 if it was not,
+ * and give back a buffer after long enough without stalls.
+ */
+static void wayland_adapt_buffers(WLWSClientDrawable *drawable, uint64_t starved)
+{
+	uint64_t now = wlws_timeline_now();
+
+	if (!drawable->display->adaptive_buffers)
+		return;
+
+	if (starved && now - starved >= ADAPT_STALL_NS) {
+		WLWS_TRACE_EVENT("stall", drawable, drawable->num_bufs);
+		drawable->adapt.stall_ns = drawable->adapt.change_ns = now;
+		return;
+	}
+
+	/* tried again on every dequeue until the buffers allow it; never if 0 */
+	if (drawable->num_bufs > MIN_BACK_BUFFERS && drawable->display->buffer_idle_ns &&
+	    now - drawable->adapt.change_ns >= drawable->display->buffer_idle_ns &&
+	    wayland_adapt_shrink(drawable))
+		drawable->adapt.change_ns = now;
 }
 
 static void _kms_resize_callback(struct wl_egl_window *window, void *private)
@@ -984,7 +2437,7 @@ static void _kms_resize_callback(struct wl_egl_window *window, void *private)
 
 	if (drawable->info.width  != drawable->window->width ||
 	    drawable->info.height != drawable->window->height)
-		drawable->resized = 1;
+		__atomic_store_n(&drawable->resized, 1, __ATOMIC_RELEASE);
 }
 
 /***********************************************************************************
@@ -1023,6 +2476,21 @@ static WSEGLError WSEGLc_CreateWindowDrawable(WSEGLDisplayHandle hDisplay,
 	drawable->display = display;
 	drawable->buffer_type = WLWS_BUFFER_KMS_BO;
 	drawable->info.pixelformat = psConfig->ePixelFormat;
+	wlws_memory_init(&drawable->memory, &display->memory);
+
+	if (!(drawable->wl_queue = wl_display_create_queue(display->wl_display)))
+		goto queue_error;
+	pthread_mutex_init(&drawable->lock, NULL);
+	if (!(drawable->wl_display_wrapper = wl_proxy_create_wrapper(display->wl_display)) ||
+	    !(drawable->wl_surface_wrapper = wl_proxy_create_wrapper(drawable->window->surface)))
+		goto kms_error;
+	wl_proxy_set_queue((struct wl_proxy*)drawable->wl_display_wrapper, drawable->wl_queue);
+	wl_proxy_set_queue((struct wl_proxy*)drawable->wl_surface_wrapper, drawable->wl_queue);
+	if (display->presentation) {
+		if (!(drawable->presentation_wrapper = wl_proxy_create_wrapper(display->presentation)))
+			goto kms_error;
+		wl_proxy_set_queue((struct wl_proxy*)drawable->presentation_wrapper, drawable->wl_queue);
+	}
 
 	/* Create KMS BO for rendering. */
 	if (_kms_create_buffers(drawable))
@@ -1032,11 +2500,33 @@ static WSEGLError WSEGLc_CreateWindowDrawable(WSEGLDisplayHandle hDisplay,
 	init_free_buffer_queue(drawable);
 	drawable->current = get_free_buffer(drawable);
 
+	/* failing here is not fatal, it is retried on the commit */
+	wayland_create_wl_buffers(display, drawable);
+
 	/* set swap interval, either default value or whatever previously set before resizing */
 	if (GET_EGL_WINDOW_PRIVATE(drawable->window)) {
 		WLWSClientDrawable *previous_drawable = GET_EGL_WINDOW_PRIVATE(drawable->window);
+
+		drawable_lock(previous_drawable);
 		drawable->surface = previous_drawable->surface;
 		previous_drawable->window = NULL;
+
+		/*
+		 * The pending frame callback moves over to our queue. Whatever
+		 * has been queued for it on the previous one is dispatched there.
+		 */
+		if (drawable->surface->frame_sync) {
+			wl_proxy_set_queue((struct wl_proxy*)drawable->surface->frame_sync,
+					   drawable->wl_queue);
+			wl_callback_set_user_data(drawable->surface->frame_sync, drawable);
+			wl_display_dispatch_queue_pending(display->wl_display,
+							  previous_drawable->wl_queue);
+		}
+
+		/* the pacing carries on from the last frame shown */
+		drawable->present = previous_drawable->present;
+		drawable->present.pending = false;
+		drawable_unlock(previous_drawable);
 	} else {
 		drawable->surface = calloc(sizeof(WLWSClientSurface), 1);
 		drawable->surface->interval = 1;
@@ -1053,11 +2543,25 @@ static WSEGLError WSEGLc_CreateWindowDrawable(WSEGLDisplayHandle hDisplay,
 	// No rotation
 	*eRotationAngle = WLWSEGL_ROTATE_0;
 
+	wlws_memory_register(&drawable->memory, drawable, "window");
+	wlws_timeline_register(&drawable->timeline, drawable, "window");
 	*phDrawable = (WSEGLDrawableHandle)drawable;
 
+	__atomic_add_fetch(&display->pool.windows, 1, __ATOMIC_ACQ_REL);
+	kms_pool_expire(display);
+
 	return WSEGL_SUCCESS;
 
 kms_error:
+	if (drawable->presentation_wrapper)
+		wl_proxy_wrapper_destroy(drawable->presentation_wrapper);
+	if (drawable->wl_surface_wrapper)
+		wl_proxy_wrapper_destroy(drawable->wl_surface_wrapper);
+	if (drawable->wl_display_wrapper)
+		wl_proxy_wrapper_destroy(drawable->wl_display_wrapper);
+	pthread_mutex_destroy(&drawable->lock);
+	wl_event_queue_destroy(drawable->wl_queue);
+queue_error:
 	free(drawable);
 	return WSEGL_CANNOT_INITIALISE;
 }
@@ -1077,6 +2581,7 @@ static void _kms_buffer_destroy_callback(struct wl_listener *listener,
 		drawable->kms_buffer_destroy_listener.notify = NULL;
 	} else {
 		_kms_release_buffers(drawable);
+		wlws_memory_unregister(&drawable->memory);
 		free(drawable);
 	}
 }
@@ -1094,6 +2599,7 @@ static WLWSClientDrawable *import_wl_kms_buffer(WLWSClientDisplay *display, stru
 	drawable->num_bufs = 1;
 	drawable->display = display;
 	drawable->buffer_type = WLWS_BUFFER_KMS_BO;
+	wlws_memory_init(&drawable->memory, &display->memory);
 
 	/*
 	 * XXX: Do we need to be able to handle non-Wayland Pixmap as well,
@@ -1247,6 +2753,7 @@ static WLWSClientDrawable *import_native_rel_buffer(WLWSClientDisplay *display,
 	drawable->num_bufs = 1;
 	drawable->display = display;
 	drawable->buffer_type = WLWS_BUFFER_USER_MEMORY;
+	wlws_memory_init(&drawable->memory, &display->memory);
 
 	switch(buffer->format & D_MASK_FORMAT) {
 	case EGL_NATIVE_PIXFORMAT_RGB565_REL:
@@ -1442,11 +2949,17 @@ static WSEGLError WSEGLc_CreatePixmapDrawable(WSEGLDisplayHandle hDisplay,
 			goto error;
 	}
 
-	if (!(drawable->current->map = pvr_map_memory(display->context, drawable->current->addr, drawable->info.size)))
+	WLWS_TRACE_BEGIN("map-memory", drawable, 0);
+	drawable->current->map = pvr_map_memory(display->context, drawable->current->addr,
+						drawable->info.size, &drawable->memory);
+	WLWS_TRACE_END();
+	if (!drawable->current->map)
 		goto error;
 
 	drawable->info.ui32DrawableType = WSEGL_DRAWABLE_PIXMAP;
 	drawable->ref_count = 1;
+	wlws_memory_register(&drawable->memory, drawable, "pixmap");
+	kms_pool_expire(display);
 
 	*phDrawable = (WSEGLDrawableHandle)drawable;
 	return WSEGL_SUCCESS;
@@ -1486,12 +2999,16 @@ static WSEGLError WSEGLc_DeleteDrawable(WSEGLDrawableHandle hDrawable)
 		SET_EGL_WINDOW_PRIVATE(drawable->window, NULL);
 		if (drawable->surface->frame_sync)
 			wl_callback_destroy(drawable->surface->frame_sync);
+		if (drawable->surface->surface_sync)
+			zwp_linux_surface_synchronization_v1_destroy(drawable->surface->surface_sync);
 		free(drawable->surface);
-		if (drawable->display->callback) {
-			wl_callback_destroy(drawable->display->callback);
-			drawable->display->callback = NULL;
-		}
 	}
+	if (drawable->callback) {
+		wl_callback_destroy(drawable->callback);
+		drawable->callback = NULL;
+	}
+	if (drawable->mailbox)
+		PVRSRVFenceDestroyExt(drawable->display->context->connection, drawable->mailbox_fence);
 
 	if (drawable->pixmap_kms_buffer_in_use)
 		return WSEGL_SUCCESS;
@@ -1502,54 +3019,136 @@ static WSEGLError WSEGLc_DeleteDrawable(WSEGLDrawableHandle hDrawable)
 		break;
 
 	case WLWS_BUFFER_USER_MEMORY:
+		WLWS_TRACE_BEGIN("unmap", drawable, 0);
 		pvr_unmap_memory(drawable->display->context, drawable->current->map);
+		WLWS_TRACE_END();
 		break;
 
 	default:
 		WSEGL_DEBUG("unknown buffer type: %d\n", drawable->buffer_type);
 	}
 
+	/* all its proxies are gone by now */
+	if (drawable->wl_queue) {
+		if (drawable->presentation_wrapper)
+			wl_proxy_wrapper_destroy(drawable->presentation_wrapper);
+		wl_proxy_wrapper_destroy(drawable->wl_surface_wrapper);
+		wl_proxy_wrapper_destroy(drawable->wl_display_wrapper);
+		wl_event_queue_destroy(drawable->wl_queue);
+		pthread_mutex_destroy(&drawable->lock);
+		kms_pool_window_deleted(drawable->display);
+	}
+
+	wlws_memory_unregister(&drawable->memory);
+	wlws_timeline_unregister(&drawable->timeline);
 	free(drawable);
 	
 	return WSEGL_SUCCESS;
 }
 
-static void wayland_surface_damage_buffer(struct wl_surface *surface, WLWSDrawableInfo *info,
-					  const EGLint *rects, EGLint num_rects)
+static void wayland_surface_damage_buffer(struct wl_surface *surface,
+					  const WLWSDamageRect *rects, int num_rects)
 {
 	int i;
-	for (i = 0; i < num_rects; i++) {
-		int idx = i * 4;
-		wl_surface_damage_buffer(surface,
-					 rects[idx], info->height - rects[idx + 1] - rects[idx + 3],
-					 rects[idx + 2], rects[idx + 3]);
+	for (i = 0; i < num_rects; i++)
+		wl_surface_damage_buffer(surface, rects[i].x, rects[i].y,
+					 rects[i].width, rects[i].height);
+}
+
+/*
+ * Pass the render fence to the compositor as the acquire fence of the
+ * next commit, so that it can schedule the composition on the completion
+ * of the rendering instead of blocking on the implicit fence of the
+ * dma-buf. The fd is duplicated when the request is marshalled.
+ * Also ask for a release fence for the buffer, if negotiated.
+ */
+static void wayland_set_explicit_sync(WLWSClientDisplay *display,
+				      WLWSClientDrawable *drawable,
+				      struct kms_buffer *kms_buffer,
+				      PVRSRV_FENCE fence)
+{
+	WLWSClientSurface *surface = drawable->surface;
+
+	if (!display->explicit_sync)
+		return;
+
+	if (!surface->surface_sync) {
+		surface->surface_sync =
+			zwp_linux_explicit_synchronization_v1_get_synchronization(
+					display->explicit_sync, drawable->window->surface);
+		if (!surface->surface_sync)
+			return;
+	}
+
+	if (fence != PVRSRV_NO_FENCE)
+		zwp_linux_surface_synchronization_v1_set_acquire_fence(surface->surface_sync, fence);
+
+	if (display->release_fences && !kms_buffer->release) {
+		kms_buffer->release =
+			zwp_linux_surface_synchronization_v1_get_release(surface->surface_sync);
+		if (!kms_buffer->release)
+			return;
+		wl_proxy_set_queue((struct wl_proxy*)kms_buffer->release, drawable->wl_queue);
+		zwp_linux_buffer_release_v1_add_listener(kms_buffer->release,
+							 &wayland_buffer_release_listener, kms_buffer);
 	}
 }
 
 static int wayland_commit_buffer(WLWSClientDisplay *display,
 				 WLWSClientDrawable *drawable,
-				 const EGLint *rects, EGLint num_rects)
+				 struct kms_buffer *kms_buffer,
+				 const EGLint *rects, EGLint num_rects,
+				 PVRSRV_FENCE fence)
 {
 	struct wl_buffer *buffer;
-	struct kms_buffer *kms_buffer = drawable->current;
 	struct wl_egl_window *window = drawable->window;
 	int interval = drawable->surface->interval;
+	uint32_t frame = kms_buffer->frame;
+	uint64_t start = wlws_timeline_now();
+	WLWSDamageRect damage[WLWS_DAMAGE_MAX_RECTS];
+	int num_damage;
+	bool throttled = false, paced = false;
+	int ret;
 
 	/* Sync with the server. */
 	if (drawable->surface->frame_sync) {
 		WSEGL_DEBUG("%s: %s: sync frame.\n", __FILE__, __func__);
 
 		wl_display_dispatch_queue_pending(display->wl_display,
-						  display->wl_queue);
+						  drawable->wl_queue);
 		while (drawable->surface->frame_sync) {
 			WSEGL_DEBUG("%s: %s: wait for sync (%p(@%p))\n",
 				    __FILE__, __func__, drawable->surface->frame_sync, &drawable->surface->frame_sync);
-			if (wl_display_dispatch_queue(display->wl_display,
-						      display->wl_queue) < 0)
+			if ((ret = wayland_dispatch_drawable(drawable, start)) < 0)
 				break;
+
+			/*
+			 * A hidden surface may never get its frame callback.
+			 * Stop throttling rather than hanging; the dequeue
+			 * then times out once the compositor holds all the
+			 * buffers.
+			 */
+			if (!ret) {
+				WSEGL_DEBUG("%s: %s: no frame callback in %d ms\n", __FILE__, __func__,
+					    display->dequeue_timeout);
+				wl_callback_destroy(drawable->surface->frame_sync);
+				drawable->surface->frame_sync = NULL;
+			}
 		}
+		throttled = true;
+	}
+
+	if (interval > 1) {
+		if (wayland_presentation_paced(drawable))
+			wayland_wait_present_slot(drawable, interval, start);
+		else
+			paced = wayland_wait_callback_slot(drawable, interval);
+		throttled = true;
 	}
 
+	if (throttled)
+		WLWS_TIMELINE_SET(&drawable->timeline, frame, throttle_ns, wlws_timeline_now() - start);
+
 	/*
 	 * Create wl_buffer. make sure that we get notified
 	 * when the fornt buffer is released by the compositor.
@@ -1565,11 +3164,13 @@ static int wayland_commit_buffer(WLWSClientDisplay *display,
 	WSEGL_DEBUG("%s: %s: got wl_buffer.\n", __FILE__, __func__);
 
 	/*
-	 * For SwapInterval.
+	 * For SwapInterval. In mailbox mode, the frame callback tells when
+	 * the compositor is ready for the next frame.
 	 */
-	if (interval > 0)
-		wayland_set_callback(display, wl_surface_frame(window->surface),
-				     &drawable->surface->frame_sync, "wl_surface_frame()");
+	if ((interval > 0 || display->mailbox) && !drawable->surface->frame_sync) {
+		drawable->present.callback_paced = paced;
+		wayland_request_frame(drawable);
+	}
 
 	WSEGL_DEBUG("%s: %s: attach wl_buffer.\n", __FILE__, __func__);
 	/*
@@ -1582,26 +3183,109 @@ static int wayland_commit_buffer(WLWSClientDisplay *display,
 	window->attached_height = drawable->info.height;
 	window->dx = window->dy = 0;
 
-	if (num_rects && drawable->enable_damage_buffer)
-		wayland_surface_damage_buffer(window->surface, &drawable->info,
-					      rects, num_rects);
-	else
+	/* merged into a few rectangles, or the whole buffer */
+	num_damage = WLWS_DAMAGE_FULL;
+	if (num_rects && drawable->enable_damage_buffer) {
+		num_damage = wlws_damage_process(rects, num_rects,
+						 drawable->info.width, drawable->info.height,
+						 display->max_damage_rects, damage);
+		WSEGL_DEBUG("%s: %s: %d damage rects, %d sent\n", __FILE__, __func__,
+			    num_rects, num_damage);
+	}
+
+	if (num_damage == WLWS_DAMAGE_FULL)
 		wl_surface_damage(window->surface, 0, 0,
 				  drawable->info.width, drawable->info.height);
+	else
+		wayland_surface_damage_buffer(window->surface, damage, num_damage);
+
+	wayland_set_explicit_sync(display, drawable, kms_buffer, fence);
+
+	if (drawable->presentation_wrapper) {
+		if (kms_buffer->feedback)
+			wp_presentation_feedback_destroy(kms_buffer->feedback);
+		kms_buffer->feedback = wp_presentation_feedback(drawable->presentation_wrapper,
+								window->surface);
+		wp_presentation_feedback_add_listener(kms_buffer->feedback,
+						      &presentation_feedback_listener, kms_buffer);
+		drawable->present.committed = frame;
+		drawable->present.pending = true;
+	}
 
 	wl_surface_commit(window->surface);
+	WLWS_TIMELINE_SET(&drawable->timeline, frame, commit_ns, wlws_timeline_now());
 
 	WSEGL_DEBUG("%s: %s: commited surface.\n", __FILE__, __func__);
 	// just to throttle.
 	if (!drawable->surface->frame_sync)
-		wayland_set_callback(display, wl_display_sync(display->wl_display), NULL,
+		wayland_set_callback(drawable, wl_display_sync(drawable->wl_display_wrapper), NULL,
 				     "wl_display_sync(1)");
 
 	wl_display_flush(display->wl_display);
+	WLWS_TIMELINE_SET(&drawable->timeline, frame, flush_ns, wlws_timeline_now());
 
 	return 0;
 }
 
+/*
+ * Mailbox mode, i.e. swap interval 0 with WseglMailbox. A frame swapped
+ * while the compositor has not taken the previous commit yet, i.e. before
+ * its frame callback, is held back rather than committed, replacing any
+ * frame held back before. Once the frame callback has cleared frame_sync,
+ * it is committed on the next call into the window, never from within the
+ * dispatch of the callback: the mode is meant for applications that keep
+ * rendering.
+ */
+static inline bool wayland_mailbox_enabled(WLWSClientDrawable *drawable)
+{
+	return drawable->display->mailbox && drawable->surface->interval == 0;
+}
+
+static void wayland_mailbox_drop(WLWSClientDrawable *drawable)
+{
+	struct kms_buffer *kms_buffer = drawable->mailbox;
+
+	if (!kms_buffer)
+		return;
+
+	WLWS_TRACE_EVENT("mailbox-replace", drawable, kms_buffer - drawable->buffers);
+	PVRSRVFenceDestroyExt(drawable->display->context->connection, drawable->mailbox_fence);
+	drawable->mailbox = NULL;
+	kms_buffer->flag &= ~KMS_BUFFER_FLAG_LOCKED;
+	put_free_buffer(drawable, kms_buffer);
+}
+
+static void wayland_mailbox_commit(WLWSClientDrawable *drawable)
+{
+	WLWSClientDisplay *display = drawable->display;
+	struct kms_buffer *kms_buffer = drawable->mailbox;
+
+	WLWS_TRACE_EVENT("mailbox-commit", drawable, kms_buffer - drawable->buffers);
+	drawable->mailbox = NULL;
+
+	/* the damage of the replaced frames is unknown */
+	if (wayland_commit_buffer(display, drawable, kms_buffer, NULL, 0, drawable->mailbox_fence)) {
+		kms_buffer->flag &= ~KMS_BUFFER_FLAG_LOCKED;
+		put_free_buffer(drawable, kms_buffer);
+	}
+	PVRSRVFenceDestroyExt(display->context->connection, drawable->mailbox_fence);
+}
+
+static void wayland_mailbox_flush(WLWSClientDrawable *drawable)
+{
+	WLWSClientDisplay *display = drawable->display;
+
+	if (!drawable->mailbox)
+		return;
+
+	/* pick up the frame callback without blocking */
+	if (wayland_dispatch_queue_timeout(display->wl_display, drawable->wl_queue, 0) < 0 ||
+	    drawable->surface->frame_sync)
+		return;
+
+	wayland_mailbox_commit(drawable);
+}
+
 /******************************************************************************
 ****
  Function Name      : WSEGL_SwapDrawableWithDamage
@@ -1615,14 +3299,20 @@ static WSEGLError WSEGLc_SwapDrawableWithDamage(WSEGLDrawableHandle hDrawable, E
 {
 	WLWSClientDrawable *drawable = (WLWSClientDrawable*)hDrawable;
 	WLWSClientDisplay *display = drawable->display;
-	int i;
-	PVRSRVFenceDestroyExt(display->context->connection, hFence);
+	int i, err;
 
 	WSEGL_DEBUG("%s: %s: %d\n", __FILE__, __func__, __LINE__);
 
+	drawable_lock(drawable);
+
 	/* NOP if current buffer is NULL */
-	if (!drawable->current)
+	if (!drawable->current) {
+		drawable_unlock(drawable);
+		PVRSRVFenceDestroyExt(display->context->connection, hFence);
 		return WSEGL_SUCCESS;
+	}
+
+	WLWS_TRACE_BEGIN("swap", drawable, drawable->current - drawable->buffers);
 
 	for (i = 0; i < drawable->num_bufs; i++) {
 		if (drawable->buffers[i].buffer_age > 0)
@@ -1633,8 +3323,44 @@ static WSEGLError WSEGLc_SwapDrawableWithDamage(WSEGLDrawableHandle hDrawable, E
 	/* mark that the buffer is locked. */
 	drawable->current->flag |= KMS_BUFFER_FLAG_LOCKED;
 
-	if (wayland_commit_buffer(display, drawable, pasDamageRect, uiNumDamageRect))
+	/* the render has been queued behind the release fence already */
+	drop_release_fence(drawable, drawable->current);
+
+	/* how long the application took, quick to go up and slow to come down */
+	if (drawable->render_begin_ns) {
+		uint64_t render = wlws_timeline_now() - drawable->render_begin_ns;
+
+		drawable->render_ns = (render > drawable->render_ns) ?
+			render : (drawable->render_ns * 7 + render) / 8;
+		drawable->render_begin_ns = 0;
+	}
+
+	drawable->current->frame = wlws_timeline_frame(&drawable->timeline);
+
+	/* this frame supersedes any held back, and is held back in turn if need be */
+	wayland_mailbox_drop(drawable);
+	if (wayland_mailbox_enabled(drawable) && drawable->surface->frame_sync) {
+		wayland_dispatch_queue_timeout(display->wl_display, drawable->wl_queue, 0);
+		if (drawable->surface->frame_sync) {
+			WLWS_TRACE_EVENT("mailbox-hold", drawable, drawable->current - drawable->buffers);
+			drawable->mailbox = drawable->current;
+			drawable->mailbox_fence = hFence;
+			goto swapped;
+		}
+	}
+
+	err = wayland_commit_buffer(display, drawable, drawable->current,
+				    pasDamageRect, uiNumDamageRect, hFence);
+	PVRSRVFenceDestroyExt(display->context->connection, hFence);
+	if (err) {
+		drawable_unlock(drawable);
+		WLWS_TRACE_END();
 		return WSEGL_BAD_NATIVE_WINDOW;
+	}
+
+swapped:
+	wlws_timeline_end(&drawable->timeline);
+	kms_pool_expire(display);
 
 	/*
 	 * We now have to get the new empty buffer.
@@ -1642,6 +3368,8 @@ static WSEGLError WSEGLc_SwapDrawableWithDamage(WSEGLDrawableHandle hDrawable, E
 	drawable->source = drawable->current;
 	drawable->current = get_free_buffer(drawable);
 
+	drawable_unlock(drawable);
+	WLWS_TRACE_END();
 	return WSEGL_SUCCESS;
 }
 
@@ -1659,7 +3387,24 @@ static WSEGLError WSEGLc_SwapControlInterval(WSEGLDrawableHandle hDrawable, EGLi
 
 	WSEGL_DEBUG("%s: %s: %d\n", __FILE__, __func__, __LINE__);
 
+	if (interval < 0)
+		interval = 0;
+	else if (interval > MAX_SWAP_INTERVAL)
+		interval = MAX_SWAP_INTERVAL;
+
+	drawable_lock(drawable);
+
+	/*
+	 * A frame held back in mailbox mode is committed now if the compositor
+	 * is ready for it, and otherwise dropped when leaving the mode, rather
+	 * than committed later under the pacing of the new interval.
+	 */
+	wayland_mailbox_flush(drawable);
+	if (interval > 0)
+		wayland_mailbox_drop(drawable);
+
 	drawable->surface->interval = (int)interval;
+	drawable_unlock(drawable);
 
 	return WSEGL_SUCCESS;
 }
@@ -1841,21 +3586,34 @@ static WSEGLError WSEGLc_GetDrawableParameters(WSEGLDrawableHandle hDrawable,
 						  WSEGLDrawableParams *psRenderParams)
 {
 	WLWSClientDrawable *drawable = (WLWSClientDrawable*)hDrawable;
+	WSEGLError err;
 
 	WSEGL_DEBUG("%s: %s: %d\n", __FILE__, __func__, __LINE__);
 
-	/*
-	 * This will let IMG EGL to delete the drawable, and then recreate
-	 * the drawable from the native window, i.e. drawable->resized is reset
-	 * automatically.
-	 */
-	if (drawable->resized)
-		return WSEGL_BAD_DRAWABLE;
+	wlws_timeline_poll();
+	kms_pool_expire(drawable->display);
+
+	drawable_lock(drawable);
+	wlws_timeline_begin(&drawable->timeline, wlws_timeline_now());
+
+	/* the window has been resized; the drawable follows it in place */
+	if (__atomic_exchange_n(&drawable->resized, 0, __ATOMIC_ACQ_REL))
+		_kms_resize_buffers(drawable);
+
+	/* commit the frame held back, if the compositor is ready for it */
+	wayland_mailbox_flush(drawable);
+
+	if (drawable->window && drawable->display->latency_mode &&
+	    drawable->surface->interval == 1 && !drawable->render_begin_ns)
+		wayland_wait_render_slot(drawable);
 
 	/*
 	 * We need to wait for buffer release if the drawable is a window.
 	 */
-	wayland_wait_for_buffer_release(drawable);
+	if ((err = wayland_wait_for_buffer_release(drawable)) != WSEGL_SUCCESS) {
+		drawable_unlock(drawable);
+		return err;
+	}
 
 	memset(psRenderParams, 0, sizeof(*psRenderParams));
 	pvr_get_params(drawable->current->map, &drawable->info, psRenderParams);
@@ -1868,6 +3626,22 @@ static WSEGLError WSEGLc_GetDrawableParameters(WSEGLDrawableHandle hDrawable,
 		memcpy(psSourceParams, psRenderParams, sizeof(*psSourceParams));
 	}
 
+	/*
+	 * The compositor may still be reading the buffer. Have the render
+	 * wait for its release fence; the GL driver owns the duplicate.
+	 */
+	if (IS_KMS_BUFFER_FENCED(drawable->current) &&
+	    !PVRSRVFenceDupExt(drawable->display->context->connection,
+			       drawable->current->release_fence,
+			       &psRenderParams->sBase.hFence)) {
+		pvr_wait_fence(drawable->display->context, drawable->current->release_fence);
+		psRenderParams->sBase.hFence = PVRSRV_NO_FENCE;
+	}
+
+	if (!drawable->render_begin_ns)
+		drawable->render_begin_ns = wlws_timeline_now();
+
+	drawable_unlock(drawable);
 	return WSEGL_SUCCESS;
 }
 
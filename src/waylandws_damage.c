@@ -0,0 +1,148 @@
+/*
+ * @File           waylandws_damage.c
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include <stdbool.h>
+
+#include "waylandws_damage.h"
+
+static inline int64_t rect_area(const WLWSDamageRect *r)
+{
+	return (int64_t)r->width * r->height;
+}
+
+static void rect_union(const WLWSDamageRect *a, const WLWSDamageRect *b, WLWSDamageRect *u)
+{
+	int32_t x1 = (a->x < b->x) ? a->x : b->x;
+	int32_t y1 = (a->y < b->y) ? a->y : b->y;
+	int32_t x2 = (a->x + a->width > b->x + b->width) ? a->x + a->width : b->x + b->width;
+	int32_t y2 = (a->y + a->height > b->y + b->height) ? a->y + a->height : b->y + b->height;
+
+	u->x = x1;
+	u->y = y1;
+	u->width = x2 - x1;
+	u->height = y2 - y1;
+}
+
+/*
+ * Grow a by b if they overlap or touch, and their bounding box adds no
+ * more area than they have in common.
+ */
+static bool rect_merge(WLWSDamageRect *a, const WLWSDamageRect *b)
+{
+	WLWSDamageRect u;
+
+	if (b->x > a->x + a->width || a->x > b->x + b->width ||
+	    b->y > a->y + a->height || a->y > b->y + b->height)
+		return false;
+
+	rect_union(a, b, &u);
+	if (rect_area(&u) > rect_area(a) + rect_area(b))
+		return false;
+
+	*a = u;
+	return true;
+}
+
+int __attribute__((visibility("internal"))) wlws_damage_process(const EGLint *rects, int num_rects,
+								int width, int height,
+								int max_rects, WLWSDamageRect *out)
+{
+	WLWSDamageRect bbox = { 0, 0, 0, 0 };
+	int64_t full = (int64_t)width * height;
+	bool overflow = false;
+	int i, j, k, count = 0;
+
+	if (max_rects > WLWS_DAMAGE_MAX_RECTS)
+		max_rects = WLWS_DAMAGE_MAX_RECTS;
+	else if (max_rects < 1)
+		max_rects = 1;
+
+	for (i = 0; i < num_rects; i++) {
+		const EGLint *rect = &rects[i * 4];
+		int64_t x1 = rect[0], x2 = (int64_t)rect[0] + rect[2];
+		int64_t y1 = (int64_t)height - rect[1] - rect[3], y2 = (int64_t)height - rect[1];
+		WLWSDamageRect r;
+
+		if (x1 < 0)
+			x1 = 0;
+		if (y1 < 0)
+			y1 = 0;
+		if (x2 > width)
+			x2 = width;
+		if (y2 > height)
+			y2 = height;
+		if (x2 <= x1 || y2 <= y1)
+			continue;
+
+		r.x = x1;
+		r.y = y1;
+		r.width = x2 - x1;
+		r.height = y2 - y1;
+
+		if (!bbox.width)
+			bbox = r;
+		else
+			rect_union(&bbox, &r, &bbox);
+
+		if (overflow)
+			continue;
+
+		for (j = 0; j < count; j++) {
+			if (rect_merge(&out[j], &r))
+				break;
+		}
+
+		if (j == count) {
+			if (count == max_rects) {
+				overflow = true;
+				continue;
+			}
+			out[count++] = r;
+		} else {
+			/* the grown rectangle may reach others now */
+			for (k = 0; k < count; k++) {
+				if (k == j || !rect_merge(&out[j], &out[k]))
+					continue;
+
+				out[k] = out[--count];
+				if (j == count)
+					j = k;
+				k = -1;
+			}
+		}
+
+		if (rect_area(&out[j]) == full)
+			return WLWS_DAMAGE_FULL;
+	}
+
+	/* merging gains nothing, so all of it */
+	if (overflow) {
+		if (rect_area(&bbox) == full)
+			return WLWS_DAMAGE_FULL;
+		out[0] = bbox;
+		return 1;
+	}
+
+	return count;
+}
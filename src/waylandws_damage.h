@@ -0,0 +1,65 @@
+/*
+ * @File           waylandws_damage.h
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __waylandws_damage_h__
+#define __waylandws_damage_h__
+
+#include <stdint.h>
+#include <EGL/egl.h>
+
+/*
+ * Damage of a swap, as sent with wl_surface.damage_buffer.
+ *
+ * The rectangles given to eglSwapBuffersWithDamage() are clipped to the
+ * buffer and flipped to its top left origin. Overlapping and adjacent ones
+ * are merged where the bounding box costs no more area than they share,
+ * e.g. one inside the other or neighbours along a whole edge, so that
+ * many small rectangles become few. Should more than the cap remain, the
+ * bounding box of all of them is sent instead, and if the damage covers
+ * the whole buffer, none of it is sent one by one.
+ */
+
+#define WLWS_DAMAGE_MAX_RECTS	64
+
+/* returned when the whole buffer is damaged */
+#define WLWS_DAMAGE_FULL	(-1)
+
+typedef struct {
+	int32_t		x;
+	int32_t		y;
+	int32_t		width;
+	int32_t		height;
+} WLWSDamageRect;
+
+/*
+ * Process num_rects EGL rectangles, i.e. x, y, width and height with the
+ * origin at the bottom left, for a buffer of width x height. Up to
+ * max_rects, at most WLWS_DAMAGE_MAX_RECTS, are written to out. Returns
+ * their number, 0 if nothing within the buffer is damaged, or
+ * WLWS_DAMAGE_FULL.
+ */
+extern int wlws_damage_process(const EGLint *rects, int num_rects, int width, int height,
+			       int max_rects, WLWSDamageRect *out);
+
+#endif /*! __waylandws_damage_h__ */
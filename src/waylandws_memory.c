@@ -0,0 +1,200 @@
+/*
+ * @File           waylandws_memory.c
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "waylandws.h"
+#include "waylandws_memory.h"
+#include "waylandws_pvr.h"
+
+/* Set to non-zero to dump the memory accounts when a display is closed. */
+static const char *ENV_DUMP_MEMORY = "WSEGL_DUMP_MEMORY";
+static const char *PVRCONF_DUMP_MEMORY = "WseglDumpMemory";
+
+static const char *const memory_origin_names[WLWS_MEMORY_NUM_ORIGINS] = {
+	[WLWS_MEMORY_KMS_BO]		= "kms-bo",
+	[WLWS_MEMORY_DMABUF_IMPORT]	= "dmabuf-import",
+	[WLWS_MEMORY_WRAP]		= "wrap",
+	[WLWS_MEMORY_GBM_BO]		= "gbm-bo",
+};
+
+static pthread_mutex_t memory_lock = PTHREAD_MUTEX_INITIALIZER;
+static WLWSMemoryAccount memory_process = { .kind = "process" };
+static WLWSMemoryAccount *memory_accounts;
+
+void __attribute__((visibility("internal"))) wlws_memory_init(WLWSMemoryAccount *account, WLWSMemoryAccount *parent)
+{
+	memset(account, 0, sizeof(*account));
+	account->parent = parent ? parent : &memory_process;
+}
+
+void __attribute__((visibility("internal"))) wlws_memory_register(WLWSMemoryAccount *account, const void *handle, const char *kind)
+{
+	pthread_mutex_lock(&memory_lock);
+	if (!account->registered) {
+		account->handle = handle;
+		account->kind = kind;
+		account->prev = NULL;
+		account->next = memory_accounts;
+		if (memory_accounts)
+			memory_accounts->prev = account;
+		memory_accounts = account;
+		account->registered = true;
+	}
+	pthread_mutex_unlock(&memory_lock);
+}
+
+void __attribute__((visibility("internal"))) wlws_memory_unregister(WLWSMemoryAccount *account)
+{
+	pthread_mutex_lock(&memory_lock);
+	if (account->registered) {
+		if (account->prev)
+			account->prev->next = account->next;
+		else
+			memory_accounts = account->next;
+		if (account->next)
+			account->next->prev = account->prev;
+		account->registered = false;
+	}
+	pthread_mutex_unlock(&memory_lock);
+}
+
+void __attribute__((visibility("internal"))) wlws_memory_charge(WLWSMemoryAccount *account, WLWSMemoryOrigin origin, uint64_t bytes)
+{
+	pthread_mutex_lock(&memory_lock);
+	for (; account; account = account->parent) {
+		WLWSMemoryStats *stats = &account->stats;
+
+		stats->bytes[origin] += bytes;
+		stats->buffers[origin]++;
+		stats->total_bytes += bytes;
+		if (stats->total_bytes > stats->peak_bytes)
+			stats->peak_bytes = stats->total_bytes;
+	}
+	pthread_mutex_unlock(&memory_lock);
+}
+
+void __attribute__((visibility("internal"))) wlws_memory_uncharge(WLWSMemoryAccount *account, WLWSMemoryOrigin origin, uint64_t bytes)
+{
+	pthread_mutex_lock(&memory_lock);
+	for (; account; account = account->parent) {
+		WLWSMemoryStats *stats = &account->stats;
+
+		stats->bytes[origin] -= bytes;
+		stats->buffers[origin]--;
+		stats->total_bytes -= bytes;
+	}
+	pthread_mutex_unlock(&memory_lock);
+}
+
+void __attribute__((visibility("internal"))) wlws_memory_map(WLWSMemoryAccount *account, int delta)
+{
+	pthread_mutex_lock(&memory_lock);
+	for (; account; account = account->parent)
+		account->stats.device_mappings += delta;
+	pthread_mutex_unlock(&memory_lock);
+}
+
+static void memory_dump_account(const WLWSMemoryAccount *account, int indent)
+{
+	const WLWSMemoryStats *stats = &account->stats;
+	int i;
+
+	fprintf(stderr, "wsegl: %*s%s %p: %llu bytes (peak %llu), %u device mappings\n",
+		indent, "", account->kind, account->handle,
+		(unsigned long long)stats->total_bytes,
+		(unsigned long long)stats->peak_bytes, stats->device_mappings);
+
+	for (i = 0; i < WLWS_MEMORY_NUM_ORIGINS; i++) {
+		if (!stats->buffers[i])
+			continue;
+		fprintf(stderr, "wsegl: %*s  %-14s %3u buffers %12llu bytes\n",
+			indent, "", memory_origin_names[i], stats->buffers[i],
+			(unsigned long long)stats->bytes[i]);
+	}
+}
+
+static void memory_dump_locked(void)
+{
+	const WLWSMemoryAccount *display, *drawable;
+
+	memory_dump_account(&memory_process, 0);
+
+	for (display = memory_accounts; display; display = display->next) {
+		if (display->parent != &memory_process)
+			continue;
+
+		memory_dump_account(display, 2);
+		for (drawable = memory_accounts; drawable; drawable = drawable->next) {
+			if (drawable->parent == display)
+				memory_dump_account(drawable, 4);
+		}
+	}
+}
+
+void __attribute__((visibility("internal"))) wlws_memory_close_display(WLWSMemoryAccount *account)
+{
+	static int dump = -1;
+	char *value;
+
+	if (dump < 0) {
+		if ((dump = pvr_get_config_value(PVRCONF_DUMP_MEMORY)) < 0)
+			dump = (value = getenv(ENV_DUMP_MEMORY)) ? atoi(value) : 0;
+	}
+
+	pthread_mutex_lock(&memory_lock);
+	if (dump)
+		memory_dump_locked();
+	pthread_mutex_unlock(&memory_lock);
+
+	wlws_memory_unregister(account);
+}
+
+WSEGL_EXPORT bool WSEGL_GetMemoryStats(void *handle, WLWSMemoryStats *stats)
+{
+	const WLWSMemoryAccount *account = handle ? NULL : &memory_process;
+
+	pthread_mutex_lock(&memory_lock);
+	if (!account) {
+		for (account = memory_accounts; account; account = account->next) {
+			if (account->handle == handle)
+				break;
+		}
+	}
+	if (account)
+		*stats = account->stats;
+	pthread_mutex_unlock(&memory_lock);
+
+	return account != NULL;
+}
+
+WSEGL_EXPORT void WSEGL_DumpMemoryStats(void)
+{
+	pthread_mutex_lock(&memory_lock);
+	memory_dump_locked();
+	pthread_mutex_unlock(&memory_lock);
+}
@@ -0,0 +1,105 @@
+/*
+ * @File           waylandws_memory.h
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __waylandws_memory_h__
+#define __waylandws_memory_h__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "powervr/wsegl.h"
+
+/*
+ * Memory footprint of displays and drawables.
+ *
+ * Every buffer allocated, imported or wrapped by the backend is charged to
+ * the drawable it belongs to, and through it to the display. Only live
+ * memory is counted; the peak is kept to help sizing the number of buffers.
+ * A BO the backend allocated and then imports into the PVR services is
+ * charged once, by its allocation: the import only counts as a buffer and
+ * a device mapping, with no bytes.
+ * With WSEGL_DUMP_MEMORY=1 (or WseglDumpMemory in powervr.ini) the accounts
+ * are dumped to stderr whenever a display is closed.
+ */
+
+typedef enum {
+	WLWS_MEMORY_KMS_BO,		/* libkms BO allocated by the client */
+	WLWS_MEMORY_DMABUF_IMPORT,	/* dma-buf imported into the PVR services */
+	WLWS_MEMORY_WRAP,		/* memory wrapped with PVRSRVWrapExtMemExt() */
+	WLWS_MEMORY_GBM_BO,		/* gbm BO allocated by the server */
+	WLWS_MEMORY_NUM_ORIGINS
+} WLWSMemoryOrigin;
+
+typedef struct {
+	uint64_t	bytes[WLWS_MEMORY_NUM_ORIGINS];
+	uint32_t	buffers[WLWS_MEMORY_NUM_ORIGINS];
+	uint32_t	device_mappings;
+
+	/* all origins together */
+	uint64_t	total_bytes;
+	uint64_t	peak_bytes;
+} WLWSMemoryStats;
+
+/**
+ * Get the memory charged to a display or a drawable handle, as returned by
+ * the function table, or to the whole process if the handle is NULL.
+ * Returns false if the handle is unknown.
+ */
+extern WSEGL_EXPORT bool WSEGL_GetMemoryStats(void *handle, WLWSMemoryStats *stats);
+
+/**
+ * Dump all displays and drawables with their memory to stderr.
+ */
+extern WSEGL_EXPORT void WSEGL_DumpMemoryStats(void);
+
+/*
+ * Accounts used by the backends
+ */
+typedef struct WLWSMemoryAccount {
+	const void			*handle;
+	const char			*kind;
+	struct WLWSMemoryAccount	*parent;
+	WLWSMemoryStats			stats;
+
+	/* list of registered accounts */
+	struct WLWSMemoryAccount	*prev;
+	struct WLWSMemoryAccount	*next;
+	bool				registered;
+} WLWSMemoryAccount;
+
+/* Charges go to parent as well. A NULL parent is the process account. */
+extern void wlws_memory_init(WLWSMemoryAccount *account, WLWSMemoryAccount *parent);
+
+/* Make the account visible to WSEGL_GetMemoryStats() under the given handle */
+extern void wlws_memory_register(WLWSMemoryAccount *account, const void *handle, const char *kind);
+extern void wlws_memory_unregister(WLWSMemoryAccount *account);
+
+extern void wlws_memory_charge(WLWSMemoryAccount *account, WLWSMemoryOrigin origin, uint64_t bytes);
+extern void wlws_memory_uncharge(WLWSMemoryAccount *account, WLWSMemoryOrigin origin, uint64_t bytes);
+extern void wlws_memory_map(WLWSMemoryAccount *account, int delta);
+
+/* Dump at display close, if enabled */
+extern void wlws_memory_close_display(WLWSMemoryAccount *account);
+
+#endif /*! __waylandws_memory_h__ */
@@ -0,0 +1,166 @@
+/*
+ * @File           waylandws_profile.c
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#define _GNU_SOURCE	/* RUSAGE_THREAD */
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "waylandws_profile.h"
+
+static const char *const startup_phase_names[WLWS_STARTUP_NUM_PHASES] = {
+	[WLWS_STARTUP_QUEUE]		= "queue",
+	[WLWS_STARTUP_GLOBALS]		= "globals",
+	[WLWS_STARTUP_DRM_OPEN]		= "drm-open",
+	[WLWS_STARTUP_KMS_AUTH]		= "kms-auth",
+	[WLWS_STARTUP_FORMATS]		= "formats",
+	[WLWS_STARTUP_KMS_CREATE]	= "kms-create",
+	[WLWS_STARTUP_PVR_CONNECT]	= "pvr-connect",
+};
+
+/* latest profile in this process */
+static pthread_mutex_t startup_lock = PTHREAD_MUTEX_INITIALIZER;
+static WLWSStartupProfile startup_profile;
+static bool startup_profile_valid;
+
+static uint64_t profile_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t timeval_ns(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000000000ULL + (uint64_t)tv->tv_usec * 1000;
+}
+
+/*
+ * Close the current phase
+ */
+static void startup_close_phase(WLWSStartupRecorder *rec, uint64_t now)
+{
+	WLWSStartupPhaseStats *stats;
+	struct rusage usage;
+
+	if (rec->phase < 0)
+		return;
+
+	stats = &rec->profile.phases[rec->phase];
+	stats->done = true;
+	stats->wall_ns += now - rec->phase_ns;
+
+	if (rec->detailed) {
+		getrusage(RUSAGE_THREAD, &usage);
+		stats->sys_ns += timeval_ns(&usage.ru_stime) - timeval_ns(&rec->usage.ru_stime);
+		stats->voluntary_switches += usage.ru_nvcsw - rec->usage.ru_nvcsw;
+		stats->minor_faults += usage.ru_minflt - rec->usage.ru_minflt;
+		rec->usage = usage;
+	}
+
+	rec->phase = -1;
+}
+
+void __attribute__((visibility("internal"))) wlws_startup_begin(WLWSStartupRecorder *rec, bool detailed)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->phase = -1;
+	rec->detailed = detailed;
+	rec->origin_ns = profile_now_ns();
+
+	if (detailed)
+		getrusage(RUSAGE_THREAD, &rec->usage);
+}
+
+void __attribute__((visibility("internal"))) wlws_startup_phase(WLWSStartupRecorder *rec, WLWSStartupPhase phase)
+{
+	uint64_t now = profile_now_ns();
+
+	startup_close_phase(rec, now);
+
+	rec->phase = phase;
+	rec->phase_ns = now;
+	if (!rec->profile.phases[phase].done)
+		rec->profile.phases[phase].start_ns = now - rec->origin_ns;
+}
+
+void __attribute__((visibility("internal"))) wlws_startup_roundtrip(WLWSStartupRecorder *rec)
+{
+	rec->profile.roundtrips++;
+	if (rec->phase >= 0)
+		rec->profile.phases[rec->phase].roundtrips++;
+}
+
+static void startup_log(const WLWSStartupProfile *profile)
+{
+	int i;
+
+	fprintf(stderr, "wsegl: startup %s in %.3f ms, %u round trips\n",
+		profile->success ? "done" : "failed",
+		profile->total_ns / 1e6, profile->roundtrips);
+
+	for (i = 0; i < WLWS_STARTUP_NUM_PHASES; i++) {
+		const WLWSStartupPhaseStats *stats = &profile->phases[i];
+
+		if (!stats->done)
+			continue;
+
+		fprintf(stderr, "wsegl: %-12s @%8.3f ms %8.3f ms  rt %u  sys %.3f ms  csw %u  minflt %u\n",
+			startup_phase_names[i], stats->start_ns / 1e6, stats->wall_ns / 1e6,
+			stats->roundtrips, stats->sys_ns / 1e6,
+			stats->voluntary_switches, stats->minor_faults);
+	}
+}
+
+void __attribute__((visibility("internal"))) wlws_startup_end(WLWSStartupRecorder *rec, bool success)
+{
+	uint64_t now = profile_now_ns();
+
+	startup_close_phase(rec, now);
+
+	rec->profile.success = success;
+	rec->profile.total_ns = now - rec->origin_ns;
+
+	pthread_mutex_lock(&startup_lock);
+	startup_profile = rec->profile;
+	startup_profile_valid = true;
+	pthread_mutex_unlock(&startup_lock);
+
+	if (rec->detailed)
+		startup_log(&rec->profile);
+}
+
+WSEGL_EXPORT bool WSEGL_GetStartupProfile(WLWSStartupProfile *profile)
+{
+	bool valid;
+
+	pthread_mutex_lock(&startup_lock);
+	valid = startup_profile_valid;
+	if (valid)
+		*profile = startup_profile;
+	pthread_mutex_unlock(&startup_lock);
+
+	return valid;
+}
@@ -0,0 +1,95 @@
+/*
+ * @File           waylandws_profile.h
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef __waylandws_profile_h__
+#define __waylandws_profile_h__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+
+#include "powervr/wsegl.h"
+
+/*
+ * Startup profile of the client WSEGL_InitialiseDisplay().
+ *
+ * Each phase is timestamped and the Wayland round trips are counted. With
+ * WSEGL_PROFILE_STARTUP=1 (or WseglProfileStartup in powervr.ini) the system
+ * time, voluntary context switches (the thread blocked or yielded) and page
+ * faults are recorded too, and the profile is logged to stderr.
+ */
+
+typedef enum {
+	WLWS_STARTUP_QUEUE,		/* event queue and registry */
+	WLWS_STARTUP_GLOBALS,		/* round trip for the globals */
+	WLWS_STARTUP_DRM_OPEN,		/* render node */
+	WLWS_STARTUP_KMS_AUTH,		/* wl_kms device and authentication */
+	WLWS_STARTUP_FORMATS,		/* dmabuf formats */
+	WLWS_STARTUP_KMS_CREATE,
+	WLWS_STARTUP_PVR_CONNECT,
+	WLWS_STARTUP_NUM_PHASES
+} WLWSStartupPhase;
+
+typedef struct {
+	bool		done;		/* the phase was run */
+	uint64_t	start_ns;	/* since the start of WSEGL_InitialiseDisplay */
+	uint64_t	wall_ns;
+	uint32_t	roundtrips;
+
+	/* only with WSEGL_PROFILE_STARTUP */
+	uint64_t	sys_ns;
+	uint32_t	voluntary_switches;
+	uint32_t	minor_faults;
+} WLWSStartupPhaseStats;
+
+typedef struct {
+	bool			success;
+	uint64_t		total_ns;
+	uint32_t		roundtrips;
+	WLWSStartupPhaseStats	phases[WLWS_STARTUP_NUM_PHASES];
+} WLWSStartupProfile;
+
+/**
+ * Get the profile of the latest client WSEGL_InitialiseDisplay() in this
+ * process. Returns false if there was none yet.
+ */
+extern WSEGL_EXPORT bool WSEGL_GetStartupProfile(WLWSStartupProfile *profile);
+
+/*
+ * Recorder used by the client backend
+ */
+typedef struct {
+	WLWSStartupProfile	profile;
+	int			phase;		/* current phase, or -1 */
+	uint64_t		origin_ns;
+	uint64_t		phase_ns;
+	bool			detailed;
+	struct rusage		usage;
+} WLWSStartupRecorder;
+
+extern void wlws_startup_begin(WLWSStartupRecorder *rec, bool detailed);
+extern void wlws_startup_phase(WLWSStartupRecorder *rec, WLWSStartupPhase phase);
+extern void wlws_startup_roundtrip(WLWSStartupRecorder *rec);
+extern void wlws_startup_end(WLWSStartupRecorder *rec, bool success);
+
+#endif /*! __waylandws_profile_h__ */
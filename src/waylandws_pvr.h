@@ -25,6 +25,7 @@
 #define __waylandws_pvr_h__
 
 #include "waylandws.h"
+#include "waylandws_memory.h"
 
 typedef enum {
         PVR_STATUS_ERROR = -1,
@@ -58,17 +59,26 @@ extern struct pvr_context *pvr_connect(PVRSRV_DEV_CONNECTION **ppsDeviceConnecti
 extern void pvr_disconnect(struct pvr_context *ctx);
 
 /**
- * Map memory to the PVR context.
+ * Map memory to the PVR context. The memory is charged to account.
  */
-extern struct pvr_map *pvr_map_memory(struct pvr_context *ctx, void *addr, int size);
+extern struct pvr_map *pvr_map_memory(struct pvr_context *ctx, void *addr, int size,
+				      WLWSMemoryAccount *account);
 
 /**
- * Map a dmabuf fd to the PVR context.
+ * Map a dmabuf fd to the PVR context. The memory is charged to account,
+ * unless charged is set, i.e. the backend allocated the BO and charged it
+ * already; then only the mapping is counted.
  */
-extern struct pvr_map *pvr_map_dmabuf(struct pvr_context *context, int fd, const char *name);
+extern struct pvr_map *pvr_map_dmabuf(struct pvr_context *context, int fd, const char *name,
+				      WLWSMemoryAccount *account, bool charged);
 
 /**
- * Unmap memory from the PVR context.
+ * Charge a mapping to another account, e.g. when a buffer outlives its drawable.
+ */
+extern void pvr_map_set_account(struct pvr_map *map, WLWSMemoryAccount *account);
+
+/**
+ * Unmap memory from the PVR context, and uncharge it.
  */
 extern void pvr_unmap_memory(struct pvr_context *ctx, struct pvr_map *map);
 
@@ -87,6 +97,22 @@ extern void pvr_sync(struct pvr_context *ctx, struct pvr_map *map);
  */
 extern int pvr_get_image_params(struct pvr_map *map, WLWSDrawableInfo *info, WSEGLImageParams *params);
 
+/**
+ * Take over a sync_file fd received from the compositor as a fence.
+ * The fd is closed.
+ */
+extern PVRSRV_FENCE pvr_import_fence(struct pvr_context *ctx, int fd);
+
+/**
+ * Check if a fence has signalled, without blocking.
+ */
+extern bool pvr_fence_is_signalled(struct pvr_context *ctx, PVRSRV_FENCE fence);
+
+/**
+ * Wait for a fence on the CPU.
+ */
+extern void pvr_wait_fence(struct pvr_context *ctx, PVRSRV_FENCE fence);
+
 /**
  * Request the CPU virtual address
  */
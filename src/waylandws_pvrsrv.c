@@ -26,6 +26,7 @@
  */
 
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "waylandws_pvr.h"
 
@@ -33,6 +34,11 @@
 struct pvr_map {
 	PVRSRV_MEMDESC		memdesc;
 	IMG_DEV_VIRTADDR	vaddr;
+
+	/* memory accounting; size is 0 for memory charged by its allocator */
+	WLWSMemoryAccount	*account;
+	WLWSMemoryOrigin	origin;
+	IMG_DEVMEM_SIZE_T	size;
 };
 
 struct pvr_context __attribute__((visibility("internal")))
@@ -89,10 +95,10 @@ void __attribute__((visibility("internal"))) pvr_disconnect(struct pvr_context *
 }
 
 static struct pvr_map *pvr_map_to_device(struct pvr_context *context,
-					 PVRSRV_MEMDESC memdesc, IMG_DEVMEM_SIZE_T size)
+					 PVRSRV_MEMDESC memdesc, IMG_DEVMEM_SIZE_T size,
+					 WLWSMemoryAccount *account, WLWSMemoryOrigin origin)
 {
 	struct pvr_map *map;
-	WSEGL_UNREFERENCED_PARAMETER(size);
 
 	if (!(map = calloc(1, sizeof(struct pvr_map))))
 		return NULL;
@@ -105,6 +111,12 @@ static struct pvr_map *pvr_map_to_device(struct pvr_context *context,
 
 	map->memdesc = memdesc;
 
+	map->account = account;
+	map->origin = origin;
+	map->size = size;
+	wlws_memory_charge(account, origin, size);
+	wlws_memory_map(account, 1);
+
 	return map;
 
 error:
@@ -113,7 +125,8 @@ error:
 	return NULL;
 }
 
-struct pvr_map __attribute__((visibility("internal"))) *pvr_map_memory(struct pvr_context *context, void *addr, int size)
+struct pvr_map __attribute__((visibility("internal"))) *pvr_map_memory(struct pvr_context *context, void *addr, int size,
+								       WLWSMemoryAccount *account)
 {
 	struct pvr_map *map;
 	PVRSRV_MEMDESC memdesc;
@@ -124,7 +137,7 @@ struct pvr_map __attribute__((visibility("internal"))) *pvr_map_memory(struct pv
 		return NULL;
 	}
 
-	map = pvr_map_to_device(context, memdesc, size);
+	map = pvr_map_to_device(context, memdesc, size, account, WLWS_MEMORY_WRAP);
 	if (!map) {
 		PVRSRVFreeDeviceMemExt(context->connection ,memdesc);
 		return NULL;
@@ -133,7 +146,8 @@ struct pvr_map __attribute__((visibility("internal"))) *pvr_map_memory(struct pv
 	return map;
 }
 
-struct pvr_map __attribute__((visibility("internal"))) *pvr_map_dmabuf(struct pvr_context *context, int fd, const char *name)
+struct pvr_map __attribute__((visibility("internal"))) *pvr_map_dmabuf(struct pvr_context *context, int fd, const char *name,
+								       WLWSMemoryAccount *account, bool charged)
 {
 	struct pvr_map *map;
 	PVRSRV_MEMDESC memdesc;
@@ -145,7 +159,9 @@ struct pvr_map __attribute__((visibility("internal"))) *pvr_map_dmabuf(struct pv
 		return NULL;
 	}
 
-	map = pvr_map_to_device(context, memdesc, size);
+	/* counted as a mapping only, if the BO has been charged already */
+	map = pvr_map_to_device(context, memdesc, charged ? 0 : size, account,
+				WLWS_MEMORY_DMABUF_IMPORT);
 	if (!map) {
 		PVRSRVFreeDeviceMemExt(context->connection ,memdesc);
 		return NULL;
@@ -154,6 +170,18 @@ struct pvr_map __attribute__((visibility("internal"))) *pvr_map_dmabuf(struct pv
 	return map;
 }
 
+void __attribute__((visibility("internal"))) pvr_map_set_account(struct pvr_map *map, WLWSMemoryAccount *account)
+{
+	if (!map || !map->memdesc || map->account == account)
+		return;
+
+	wlws_memory_uncharge(map->account, map->origin, map->size);
+	wlws_memory_map(map->account, -1);
+	map->account = account;
+	wlws_memory_charge(map->account, map->origin, map->size);
+	wlws_memory_map(map->account, 1);
+}
+
 void __attribute__((visibility("internal"))) pvr_unmap_memory(struct pvr_context *context, struct pvr_map *map)
 {
 	WSEGL_UNREFERENCED_PARAMETER(context);
@@ -164,6 +192,8 @@ void __attribute__((visibility("internal"))) pvr_unmap_memory(struct pvr_context
 	if (map->memdesc) {
 		PVRSRVReleaseDeviceMappingExt(map->memdesc);
 		PVRSRVFreeDeviceMemExt(context->connection ,map->memdesc);
+		wlws_memory_uncharge(map->account, map->origin, map->size);
+		wlws_memory_map(map->account, -1);
 	}
 	free(map);
 }
@@ -296,6 +326,50 @@ int __attribute__((visibility("internal"))) pvr_get_image_params(struct pvr_map
 	return 1;
 }
 
+/* long enough for any composition, so that a lost fence cannot hang us */
+#define PVR_FENCE_WAIT_TIMEOUT_MS	1000
+
+PVRSRV_FENCE __attribute__((visibility("internal"))) pvr_import_fence(struct pvr_context *context, int fd)
+{
+	PVRSRV_FENCE fence;
+
+	if (fd < 0)
+		return PVRSRV_NO_FENCE;
+
+	if (!PVRSRVFenceDupExt(context->connection, (PVRSRV_FENCE)fd, &fence)) {
+		WSEGL_DEBUG("%s: %s: PVRSRVFenceDupExt() failed\n", __FILE__, __func__);
+		pvr_wait_fence(context, (PVRSRV_FENCE)fd);
+		fence = PVRSRV_NO_FENCE;
+	}
+	close(fd);
+
+	return fence;
+}
+
+bool __attribute__((visibility("internal"))) pvr_fence_is_signalled(struct pvr_context *context, PVRSRV_FENCE fence)
+{
+	bool met = false;
+
+	if (fence == PVRSRV_NO_FENCE)
+		return true;
+
+	if (!PVRSRVFenceWaitExt(context->connection, fence, 0, &met))
+		return false;
+
+	return met;
+}
+
+void __attribute__((visibility("internal"))) pvr_wait_fence(struct pvr_context *context, PVRSRV_FENCE fence)
+{
+	bool met;
+
+	if (fence == PVRSRV_NO_FENCE)
+		return;
+
+	if (!PVRSRVFenceWaitExt(context->connection, fence, PVR_FENCE_WAIT_TIMEOUT_MS, &met) || !met)
+		WSEGL_DEBUG("%s: %s: fence %d not signalled\n", __FILE__, __func__, fence);
+}
+
 int __attribute__((visibility("internal"))) pvr_acquire_cpu_mapping(PVRSRV_MEMDESC hMemDesc, void **ppvCpuVirtAddr)
 {
 	return PVRSRVAcquireCPUMappingExt(hMemDesc, ppvCpuVirtAddr);
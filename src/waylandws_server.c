@@ -36,6 +36,9 @@
 #include "waylandws.h"
 #include "waylandws_server.h"
 #include "waylandws_pvr.h"
+#include "waylandws_memory.h"
+#include "waylandws_timeline.h"
+#include "waylandws_trace.h"
 
 #include "wayland-server.h"
 #include "wayland-kms-server-protocol.h"
@@ -68,6 +71,9 @@ typedef struct WaylandWS_Server_Display_TAG
 
 	/* PVR context */
 	struct pvr_context	*context;
+
+	/* memory of all drawables */
+	WLWSMemoryAccount	memory;
 } WLWSServerDisplay;
 
 /*
@@ -115,6 +121,9 @@ typedef struct WaylandWS_Server_Drawable_TAG
 	int			ref_count;
 	int			pixmap_kms_buffer_in_use;
 	struct wl_listener	kms_buffer_destroy_listener;
+
+	WLWSMemoryAccount	memory;
+	WLWSTimeline		timeline;
 } WLWSServerDrawable;
 
 /***********************************************************************************
@@ -150,6 +159,11 @@ static WSEGLError WSEGLs_InitialiseDisplay(NativeDisplayType hNativeDisplay,
 		return WSEGL_CANNOT_INITIALISE;
 	}
 
+	wlws_memory_init(&display->memory, NULL);
+	wlws_memory_register(&display->memory, display, "display");
+	wlws_timeline_setup();
+	wlws_trace_setup();
+
 	/* TODO: check supported pixelformat and set it in the capability list */
 
 	/* TODO: ref counter? */
@@ -181,6 +195,7 @@ static WSEGLError WSEGLs_CloseDisplay(WSEGLDisplayHandle hDisplay)
 
 	pvr_disconnect(display->context);
 
+	wlws_memory_close_display(&display->memory);
 	free(display);
 
 	return WSEGL_SUCCESS;
@@ -197,18 +212,25 @@ static void _gbm_destroy_drawable(WLWSServerDrawable *drawable)
 	for (i = 0; i < drawable->num_bufs; i++) {
 		WSEGL_DEBUG("%s: %s: %d: buffers[%d].meminfo=%p\n", __FILE__, __func__, __LINE__, i, drawable->buffers[i].map);
 		if (drawable->buffers[i].map) {
+			WLWS_TRACE_BEGIN("unmap", drawable, i);
 			pvr_unmap_memory(drawable->display->context, drawable->buffers[i].map);
+			WLWS_TRACE_END();
 		}
 
 		if (drawable->buffers[i].bo) {
-			if (drawable->buffers[i].allocated)
+			if (drawable->buffers[i].allocated) {
+				wlws_memory_uncharge(&drawable->memory, WLWS_MEMORY_GBM_BO,
+						     drawable->buffers[i].bo->size);
 				gbm_bo_destroy((struct gbm_bo*)drawable->buffers[i].bo);
+			}
 			drawable->buffers[i].bo = NULL;
 		}
 		if (drawable->buffers[i].dmafd)
 			close(drawable->buffers[i].dmafd);
 	}
 
+	wlws_memory_unregister(&drawable->memory);
+	wlws_timeline_unregister(&drawable->timeline);
 	free(drawable);
 }
 
@@ -256,6 +278,7 @@ static WSEGLError WSEGLs_CreateWindowDrawable(WSEGLDisplayHandle hDisplay,
 	drawable->info.height      = surface->base.height;
 	drawable->info.pixelformat = WLWSEGL_PIXFMT_ARGB8888;
 	drawable->display = display;
+	wlws_memory_init(&drawable->memory, &display->memory);
 
 	WSEGL_DEBUG("%s: %s: %d: %dx%d\n", __FILE__, __func__, __LINE__, drawable->info.width, drawable->info.height);
 	for (i = 0; i < MAX_BACK_BUFFERS; i++) {
@@ -271,6 +294,8 @@ static WSEGLError WSEGLs_CreateWindowDrawable(WSEGLDisplayHandle hDisplay,
 			if (!drawable->buffers[i].bo)
 				goto error;
 			drawable->buffers[i].allocated = true;
+			wlws_memory_charge(&drawable->memory, WLWS_MEMORY_GBM_BO,
+					   drawable->buffers[i].bo->size);
 		}
 
 		if (!drawable->info.pitch) {
@@ -280,7 +305,12 @@ static WSEGLError WSEGLs_CreateWindowDrawable(WSEGLDisplayHandle hDisplay,
 		}
 		WSEGL_DEBUG("%s: %s: %d: %p (size=%d)\n", __FILE__, __func__, __LINE__, drawable->buffers[i].bo->addr, drawable->buffers[i].bo->size);
 
-		if (!(drawable->buffers[i].map = pvr_map_dmabuf(display->context, drawable->buffers[i].bo->fd, SERVER_PVR_MAP_NAME))) {
+		WLWS_TRACE_BEGIN("map-dmabuf", drawable, i);
+		drawable->buffers[i].map = pvr_map_dmabuf(display->context, drawable->buffers[i].bo->fd,
+							  SERVER_PVR_MAP_NAME, &drawable->memory,
+							  drawable->buffers[i].allocated);
+		WLWS_TRACE_END();
+		if (!drawable->buffers[i].map) {
 			WSEGL_DEBUG("%s: %s: pvr_map_dmabuf() failed.\n", __FILE__, __func__);
 			goto error;
 		}
@@ -289,6 +319,8 @@ static WSEGLError WSEGLs_CreateWindowDrawable(WSEGLDisplayHandle hDisplay,
 	drawable->current = &drawable->buffers[0];
 
 	drawable->ref_count = 1;
+	wlws_memory_register(&drawable->memory, drawable, "window");
+	wlws_timeline_register(&drawable->timeline, drawable, "window");
 
 	/*
 	 * XXX: nothing to do here anymore?
@@ -382,6 +414,7 @@ static WSEGLError WSEGLs_CreatePixmapDrawable(WSEGLDisplayHandle hDisplay,
 	drawable->current = drawable->source = &drawable->buffers[0];
 	drawable->num_bufs = 1;
 	drawable->display = display;
+	wlws_memory_init(&drawable->memory, &display->memory);
 
 	/*
 	 * XXX: Do we need to be able to handle non-Wayland Pixmap as well,
@@ -450,7 +483,11 @@ static WSEGLError WSEGLs_CreatePixmapDrawable(WSEGLDisplayHandle hDisplay,
 		WSEGL_DEBUG("%s: %s: %d: invalid buffer = %p (.handle = %d, fd = %d)\n", __FILE__, __func__, __LINE__, buffer, buffer->handle, buffer->fd);
 		goto error;
 	}
-	if (!(drawable->current->map = pvr_map_dmabuf(display->context, fd, SERVER_PVR_MAP_NAME))) {
+	WLWS_TRACE_BEGIN("map-dmabuf", drawable, 0);
+	drawable->current->map = pvr_map_dmabuf(display->context, fd, SERVER_PVR_MAP_NAME,
+						&drawable->memory, false);
+	WLWS_TRACE_END();
+	if (!drawable->current->map) {
 		if (drawable->current->dmafd)
 			close(drawable->current->dmafd);
 		WSEGL_DEBUG("%s: %s: %d: import dmabuf failed\n", __FILE__, __func__, __LINE__);
@@ -458,6 +495,7 @@ static WSEGLError WSEGLs_CreatePixmapDrawable(WSEGLDisplayHandle hDisplay,
 	}
 
 	drawable->ref_count = 1;
+	wlws_memory_register(&drawable->memory, drawable, "pixmap");
 	buffer->private = drawable;
 	drawable->kms_buffer_destroy_listener.notify
 		= _kms_buffer_destroy_callback;
@@ -524,6 +562,8 @@ static WSEGLError WSEGLs_SwapDrawableWithDamage(WSEGLDrawableHandle hDrawable, E
 	WSEGL_UNREFERENCED_PARAMETER(uiNumDamageRect);
 	PVRSRVFenceDestroyExt(display->context->connection, hFence);
 
+	WLWS_TRACE_BEGIN("swap", drawable, drawable->count);
+
 	for (i = 0; i < drawable->num_bufs; i++) {
 		if (drawable->buffers[i].buffer_age > 0)
 			drawable->buffers[i].buffer_age++;
@@ -536,6 +576,9 @@ static WSEGLError WSEGLs_SwapDrawableWithDamage(WSEGLDrawableHandle hDrawable, E
 	 * gbm_surface_lock_front_buffer() and set the gbm_bo to drmModeSet().
 	 */
 	gbm_kms_set_front(drawable->surface, drawable->count);
+	WLWS_TIMELINE_SET(&drawable->timeline, wlws_timeline_frame(&drawable->timeline),
+			  commit_ns, wlws_timeline_now());
+	wlws_timeline_end(&drawable->timeline);
 
 	// get the next buffer
 	gbm_kms_advance_buffer(drawable);
@@ -546,6 +589,7 @@ static WSEGLError WSEGLs_SwapDrawableWithDamage(WSEGLDrawableHandle hDrawable, E
 		WSEGL_DEBUG("BO is still locked...\n");
 	}
 
+	WLWS_TRACE_END();
 	return WSEGL_SUCCESS;
 }
 
@@ -736,15 +780,21 @@ static WSEGLError WSEGLs_GetDrawableParameters(WSEGLDrawableHandle hDrawable,
 						  WSEGLDrawableParams *psRenderParams)
 {
 	WLWSServerDrawable *drawable = (WLWSServerDrawable*)hDrawable;
+	uint32_t frame;
 
 	WSEGL_DEBUG("%s: %s: %d\n", __FILE__, __func__, __LINE__);
 
+	wlws_timeline_poll();
+	frame = wlws_timeline_begin(&drawable->timeline, wlws_timeline_now());
+
 	/*
 	 * Check if the front buffer is updated by someone else, e.g. v4l2-renderer
 	 * in weston. We shall not render into the front buffer.
 	 */
 	if (drawable->surface && gbm_kms_get_front(drawable->surface) == drawable->count)
 		gbm_kms_advance_buffer(drawable);
+	wlws_timeline_set_buffer(&drawable->timeline, frame, drawable->current - drawable->buffers);
+	WLWS_TRACE_EVENT("dequeued", drawable, drawable->current - drawable->buffers);
 
 	memset(psRenderParams, 0, sizeof(*psRenderParams));
 	pvr_get_params(drawable->current->map, &drawable->info, psRenderParams);
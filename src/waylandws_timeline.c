@@ -0,0 +1,284 @@
+/*
+ * @File           waylandws_timeline.c
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "waylandws.h"
+#include "waylandws_timeline.h"
+#include "waylandws_pvr.h"
+
+/* Signal number to dump the timeline on, 0 for none. */
+static const char *ENV_TIMELINE_SIGNAL = "WSEGL_TIMELINE_SIGNAL";
+static const char *PVRCONF_TIMELINE_SIGNAL = "WseglTimelineSignal";
+
+static pthread_mutex_t timeline_lock = PTHREAD_MUTEX_INITIALIZER;
+static WLWSTimeline *timelines;
+static volatile sig_atomic_t timeline_dump_requested;
+
+void __attribute__((visibility("internal"))) wlws_timeline_register(WLWSTimeline *tl, const void *handle, const char *kind)
+{
+	pthread_mutex_lock(&timeline_lock);
+	if (!tl->registered) {
+		tl->handle = handle;
+		tl->kind = kind;
+		tl->prev = NULL;
+		tl->next = timelines;
+		if (timelines)
+			timelines->prev = tl;
+		timelines = tl;
+		tl->registered = true;
+	}
+	pthread_mutex_unlock(&timeline_lock);
+}
+
+void __attribute__((visibility("internal"))) wlws_timeline_unregister(WLWSTimeline *tl)
+{
+	pthread_mutex_lock(&timeline_lock);
+	if (tl->registered) {
+		if (tl->prev)
+			tl->prev->next = tl->next;
+		else
+			timelines = tl->next;
+		if (tl->next)
+			tl->next->prev = tl->prev;
+		tl->registered = false;
+	}
+	pthread_mutex_unlock(&timeline_lock);
+}
+
+/*
+ * Writer side of the sequence count: odd while a slot is being written
+ */
+static inline void timeline_write_begin(WLWSTimeline *tl, int slot)
+{
+	__atomic_store_n(&tl->seq[slot], tl->seq[slot] + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void timeline_write_end(WLWSTimeline *tl, int slot)
+{
+	__atomic_store_n(&tl->seq[slot], tl->seq[slot] + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t __attribute__((visibility("internal"))) wlws_timeline_begin(WLWSTimeline *tl, uint64_t now)
+{
+	uint32_t frame;
+	int slot;
+
+	if (tl->open)
+		return wlws_timeline_frame(tl);
+
+	frame = tl->frames;
+	slot = frame % WLWS_TIMELINE_FRAMES;
+
+	timeline_write_begin(tl, slot);
+	memset(&tl->records[slot], 0, sizeof(tl->records[slot]));
+	tl->records[slot].frame = frame;
+	tl->records[slot].buffer = -1;
+	tl->records[slot].params_ns = now;
+	timeline_write_end(tl, slot);
+
+	__atomic_store_n(&tl->frames, frame + 1, __ATOMIC_RELEASE);
+	tl->open = true;
+
+	return frame;
+}
+
+void __attribute__((visibility("internal"))) wlws_timeline_end(WLWSTimeline *tl)
+{
+	tl->open = false;
+}
+
+void __attribute__((visibility("internal"))) wlws_timeline_set(WLWSTimeline *tl, uint32_t frame, size_t offset, uint64_t value)
+{
+	int slot = frame % WLWS_TIMELINE_FRAMES;
+
+	if (!tl->frames || tl->records[slot].frame != frame)
+		return;
+
+	timeline_write_begin(tl, slot);
+	*(uint64_t*)((char*)&tl->records[slot] + offset) = value;
+	timeline_write_end(tl, slot);
+}
+
+void __attribute__((visibility("internal"))) wlws_timeline_set_buffer(WLWSTimeline *tl, uint32_t frame, int32_t buffer)
+{
+	int slot = frame % WLWS_TIMELINE_FRAMES;
+
+	if (!tl->frames || tl->records[slot].frame != frame)
+		return;
+
+	timeline_write_begin(tl, slot);
+	tl->records[slot].buffer = buffer;
+	timeline_write_end(tl, slot);
+}
+
+/*
+ * Reader side. Gives up on a slot that is rewritten under our feet.
+ */
+static bool timeline_read(const WLWSTimeline *tl, int slot, WLWSFrameRecord *record)
+{
+	uint32_t before, after;
+	int retry;
+
+	for (retry = 0; retry < 4; retry++) {
+		before = __atomic_load_n(&tl->seq[slot], __ATOMIC_ACQUIRE);
+		if (before & 1)
+			continue;
+
+		memcpy(record, &tl->records[slot], sizeof(*record));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		after = __atomic_load_n(&tl->seq[slot], __ATOMIC_RELAXED);
+		if (before == after)
+			return true;
+	}
+
+	return false;
+}
+
+static int timeline_copy(const WLWSTimeline *tl, WLWSFrameRecord *records, int count)
+{
+	uint32_t frames = __atomic_load_n(&tl->frames, __ATOMIC_ACQUIRE);
+	uint32_t first, frame;
+	int n = 0;
+
+	if (count <= 0)
+		return 0;
+
+	first = frames > WLWS_TIMELINE_FRAMES ? frames - WLWS_TIMELINE_FRAMES : 0;
+	if (frames - first > (uint32_t)count)
+		first = frames - count;
+
+	for (frame = first; frame != frames; frame++) {
+		if (timeline_read(tl, frame % WLWS_TIMELINE_FRAMES, &records[n]) &&
+		    records[n].frame == frame)
+			n++;
+	}
+
+	return n;
+}
+
+static double timeline_delta_ms(uint64_t t, uint64_t origin)
+{
+	return t ? (double)(int64_t)(t - origin) / 1e6 : 0.0;
+}
+
+static void timeline_dump_locked(void)
+{
+	static WLWSFrameRecord records[WLWS_TIMELINE_FRAMES];
+	const WLWSTimeline *tl;
+	int i, n;
+
+	for (tl = timelines; tl; tl = tl->next) {
+		n = timeline_copy(tl, records, WLWS_TIMELINE_FRAMES);
+
+		fprintf(stderr, "wsegl: timeline of %s %p, %d frames\n", tl->kind, tl->handle, n);
+		fprintf(stderr, "wsegl: %8s %3s %14s %9s %9s %9s %9s %9s %9s\n",
+			"frame", "buf", "params(ms)", "dequeue", "throttle", "commit", "flush", "release",
+			"present");
+
+		/* times in ms, durations first, then relative to params */
+		for (i = 0; i < n; i++) {
+			const WLWSFrameRecord *r = &records[i];
+
+			fprintf(stderr, "wsegl: %8u %3d %14.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+				r->frame, r->buffer, r->params_ns / 1e6,
+				r->dequeue_ns / 1e6, r->throttle_ns / 1e6,
+				timeline_delta_ms(r->commit_ns, r->params_ns),
+				timeline_delta_ms(r->flush_ns, r->params_ns),
+				timeline_delta_ms(r->release_ns, r->params_ns),
+				timeline_delta_ms(r->present_ns, r->params_ns));
+		}
+	}
+}
+
+static void timeline_signal_handler(int signo)
+{
+	(void)signo;
+	timeline_dump_requested = 1;
+}
+
+void __attribute__((visibility("internal"))) wlws_timeline_setup(void)
+{
+	static bool done;
+	struct sigaction sa, old;
+	char *value;
+	int signo;
+
+	pthread_mutex_lock(&timeline_lock);
+	if (!done) {
+		if ((signo = pvr_get_config_value(PVRCONF_TIMELINE_SIGNAL)) < 0)
+			signo = (value = getenv(ENV_TIMELINE_SIGNAL)) ? atoi(value) : 0;
+	}
+	if (!done && signo > 0) {
+		/* don't take over a signal the application handles */
+		if (!sigaction(signo, NULL, &old) && old.sa_handler == SIG_DFL) {
+			memset(&sa, 0, sizeof(sa));
+			sa.sa_handler = timeline_signal_handler;
+			sa.sa_flags = SA_RESTART;
+			sigemptyset(&sa.sa_mask);
+			sigaction(signo, &sa, NULL);
+		}
+		done = true;
+	}
+	pthread_mutex_unlock(&timeline_lock);
+}
+
+void __attribute__((visibility("internal"))) wlws_timeline_poll(void)
+{
+	if (!timeline_dump_requested)
+		return;
+
+	timeline_dump_requested = 0;
+	WSEGL_DumpTimeline();
+}
+
+WSEGL_EXPORT int WSEGL_GetTimeline(void *drawable, WLWSFrameRecord *records, int count)
+{
+	const WLWSTimeline *tl;
+	int n = -1;
+
+	pthread_mutex_lock(&timeline_lock);
+	for (tl = timelines; tl; tl = tl->next) {
+		if (tl->handle == drawable) {
+			n = timeline_copy(tl, records, count);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&timeline_lock);
+
+	return n;
+}
+
+WSEGL_EXPORT void WSEGL_DumpTimeline(void)
+{
+	pthread_mutex_lock(&timeline_lock);
+	timeline_dump_locked();
+	pthread_mutex_unlock(&timeline_lock);
+}
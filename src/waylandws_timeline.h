@@ -0,0 +1,127 @@
+/*
+ * @File           waylandws_timeline.h
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __waylandws_timeline_h__
+#define __waylandws_timeline_h__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "powervr/wsegl.h"
+
+/*
+ * Per-frame timeline of the swap path.
+ *
+ * Each window drawable keeps the last WLWS_TIMELINE_FRAMES frames in a ring.
+ * Recording is lock-free; the thread swapping the drawable is the only
+ * writer, and readers detect torn records with a per-slot sequence count.
+ * The rings are dumped to stderr with WSEGL_DumpTimeline(), or on the signal
+ * given by WSEGL_TIMELINE_SIGNAL (or WseglTimelineSignal in powervr.ini), in
+ * which case the dump is done by the next thread entering the swap path.
+ */
+
+#define WLWS_TIMELINE_FRAMES	64
+
+typedef struct {
+	uint32_t	frame;		/* frame number in the drawable */
+	int32_t		buffer;		/* index of the render buffer, -1 if none */
+
+	/* CLOCK_MONOTONIC timestamps, 0 if not reached */
+	uint64_t	params_ns;	/* entry to GetDrawableParameters */
+	uint64_t	commit_ns;	/* wl_surface.commit, or front buffer update */
+	uint64_t	flush_ns;	/* wl_display_flush */
+	uint64_t	release_ns;	/* wl_buffer.release of the buffer */
+	uint64_t	present_ns;	/* wp_presentation_feedback.presented */
+
+	/* durations */
+	uint64_t	dequeue_ns;	/* waiting for a free buffer */
+	uint64_t	throttle_ns;	/* waiting for the frame callback */
+} WLWSFrameRecord;
+
+/**
+ * Copy the frames of a window drawable handle, oldest first. Returns the
+ * number of records copied, or -1 if the handle is unknown.
+ */
+extern WSEGL_EXPORT int WSEGL_GetTimeline(void *drawable, WLWSFrameRecord *records, int count);
+
+/**
+ * Dump the timeline of all window drawables to stderr.
+ */
+extern WSEGL_EXPORT void WSEGL_DumpTimeline(void);
+
+/*
+ * Recorder used by the backends
+ */
+typedef struct WLWSTimeline {
+	WLWSFrameRecord		records[WLWS_TIMELINE_FRAMES];
+	uint32_t		seq[WLWS_TIMELINE_FRAMES];
+	uint32_t		frames;		/* frames begun */
+	bool			open;		/* current frame not committed yet */
+
+	const void		*handle;
+	const char		*kind;
+	struct WLWSTimeline	*prev;
+	struct WLWSTimeline	*next;
+	bool			registered;
+} WLWSTimeline;
+
+static inline uint64_t wlws_timeline_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+extern void wlws_timeline_register(WLWSTimeline *tl, const void *handle, const char *kind);
+extern void wlws_timeline_unregister(WLWSTimeline *tl);
+
+/* Start a frame unless the current one is not committed yet. Returns its number. */
+extern uint32_t wlws_timeline_begin(WLWSTimeline *tl, uint64_t now);
+
+/* Close the current frame */
+extern void wlws_timeline_end(WLWSTimeline *tl);
+
+/* Set a field of a frame, if it is still in the ring */
+extern void wlws_timeline_set(WLWSTimeline *tl, uint32_t frame, size_t offset, uint64_t value);
+extern void wlws_timeline_set_buffer(WLWSTimeline *tl, uint32_t frame, int32_t buffer);
+
+#define WLWS_TIMELINE_SET(tl, frame, member, value) \
+	wlws_timeline_set((tl), (frame), offsetof(WLWSFrameRecord, member), (value))
+
+/* Current frame of the drawable */
+static inline uint32_t wlws_timeline_frame(const WLWSTimeline *tl)
+{
+	return tl->frames - 1;
+}
+
+/* Install the dump signal handler if configured, once per process */
+extern void wlws_timeline_setup(void);
+
+/* Dump if the signal was received */
+extern void wlws_timeline_poll(void);
+
+#endif /*! __waylandws_timeline_h__ */
@@ -0,0 +1,101 @@
+/*
+ * @File           waylandws_trace.c
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "waylandws.h"
+#include "waylandws_trace.h"
+#include "waylandws_pvr.h"
+
+/* Set to non-zero to write trace markers. */
+static const char *ENV_TRACE = "WSEGL_TRACE";
+static const char *PVRCONF_TRACE = "WseglTrace";
+
+static const char *const trace_marker_paths[] = {
+	"/sys/kernel/tracing/trace_marker",
+	"/sys/kernel/debug/tracing/trace_marker",
+};
+
+int __attribute__((visibility("internal"))) wlws_trace_fd = -1;
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static int trace_pid;
+
+static void trace_open(void)
+{
+	char *value;
+	int enable;
+	unsigned int i;
+
+	if ((enable = pvr_get_config_value(PVRCONF_TRACE)) < 0)
+		enable = (value = getenv(ENV_TRACE)) ? atoi(value) : 0;
+
+	if (!enable)
+		return;
+
+	trace_pid = getpid();
+	for (i = 0; i < sizeof(trace_marker_paths) / sizeof(trace_marker_paths[0]); i++) {
+		if ((wlws_trace_fd = open(trace_marker_paths[i], O_WRONLY | O_CLOEXEC)) >= 0)
+			return;
+	}
+
+	WSEGL_DEBUG("%s: %s: no trace_marker available\n", __FILE__, __func__);
+}
+
+void __attribute__((visibility("internal"))) wlws_trace_setup(void)
+{
+	pthread_once(&trace_once, trace_open);
+}
+
+static void trace_write(const char *buf, int len)
+{
+	if (len > 0 && write(wlws_trace_fd, buf, len) < 0)
+		WSEGL_DEBUG("%s: %s: write failed\n", __FILE__, __func__);
+}
+
+void __attribute__((visibility("internal"))) wlws_trace_begin(const char *name, const void *drawable, int buffer)
+{
+	char buf[128];
+
+	trace_write(buf, snprintf(buf, sizeof(buf), "B|%d|wsegl %s drawable=%p buffer=%d",
+				  trace_pid, name, drawable, buffer));
+}
+
+void __attribute__((visibility("internal"))) wlws_trace_end(void)
+{
+	char buf[32];
+
+	trace_write(buf, snprintf(buf, sizeof(buf), "E|%d", trace_pid));
+}
+
+void __attribute__((visibility("internal"))) wlws_trace_event(const char *name, const void *drawable, int buffer)
+{
+	wlws_trace_begin(name, drawable, buffer);
+	wlws_trace_end();
+}
@@ -0,0 +1,74 @@
+/*
+ * @File           waylandws_trace.h
+ * @Copyright      Copyright (C) 2021 Renesas Electronics Corporation. All rights reserved.
+ * @License        MIT
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef __waylandws_trace_h__
+#define __waylandws_trace_h__
+
+#include <stdbool.h>
+
+/*
+ * Trace markers for system traces.
+ *
+ * With WSEGL_TRACE=1 (or WseglTrace in powervr.ini) the hot paths write
+ * events to the ftrace trace_marker in the atrace format, i.e. "B|pid|name"
+ * and "E|pid", which Perfetto and systrace turn into slices on the thread
+ * track. Every event names the drawable and the buffer index, so that the
+ * slices line up with the GPU, KMS and compositor activity in the trace.
+ */
+
+extern int wlws_trace_fd;
+
+static inline bool wlws_trace_enabled(void)
+{
+	return wlws_trace_fd >= 0;
+}
+
+/* Open the trace marker if configured, once per process */
+extern void wlws_trace_setup(void);
+
+extern void wlws_trace_begin(const char *name, const void *drawable, int buffer);
+extern void wlws_trace_end(void);
+
+/* A zero length slice, for events such as wl_buffer.release */
+extern void wlws_trace_event(const char *name, const void *drawable, int buffer);
+
+#define WLWS_TRACE_BEGIN(name, drawable, buffer)			\
+	do {								\
+		if (wlws_trace_enabled())				\
+			wlws_trace_begin((name), (drawable), (buffer));	\
+	} while (0)
+
+#define WLWS_TRACE_END()						\
+	do {								\
+		if (wlws_trace_enabled())				\
+			wlws_trace_end();				\
+	} while (0)
+
+#define WLWS_TRACE_EVENT(name, drawable, buffer)			\
+	do {								\
+		if (wlws_trace_enabled())				\
+			wlws_trace_event((name), (drawable), (buffer));	\
+	} while (0)
+
+#endif /*! __waylandws_trace_h__ */